@@ -0,0 +1,83 @@
+//------------------------------------------------------------------------------
+// AY benchmark
+//
+// Renders NUM_FRAMES frames of audio on each of NUM_CHIPS AY chips, driven by
+// a stream of random register writes like a music player's, and reports the
+// samples rendered per second and how many chips one core could run in real
+// time.  Built and run by `./build aybench`.
+//------------------------------------------------------------------------------
+
+#define KORE_IMPLEMENTATION
+#include "kore.h"
+
+#include "audio.h"
+#include "ay.h"
+#include "contention.h"
+
+#define NUM_CHIPS 16
+#define NUM_FRAMES 500
+
+// Register writes per frame: a player updates most registers once a frame
+#define WRITES_PER_FRAME 14
+
+static Ay g_chips[NUM_CHIPS];
+
+static u32 g_seed = 12345;
+
+static u32 random_u32(void)
+{
+    g_seed = g_seed * 1103515245 + 12345;
+    return g_seed >> 8;
+}
+
+// Queue a frame of writes, spread over the start of the frame as a player
+// called from the interrupt would
+static void play_frame(Ay* ay)
+{
+    for (u32 i = 0; i < WRITES_PER_FRAME; ++i) {
+        u8 reg = (u8)(i < 13 ? i : 13);
+        u8 value =
+            (u8)(reg == 7 ? 0x38 | (random_u32() & 7) : random_u32() & 0xff);
+        if (reg == 13 && (random_u32() & 7) != 0) {
+            continue; // Writing the shape restarts the envelope
+        }
+        ay_select(ay, reg);
+        ay_write(ay, 32 + i * 40, value);
+    }
+}
+
+int main(void)
+{
+    $.init();
+
+    // The 128K's clocks, as nx runs the AY
+    const MachineTiming* timing = contention_timing(MemoryModel_128K);
+    u32                  clock  = timing->clock_hz;
+    for (u32 i = 0; i < NUM_CHIPS; ++i) {
+        ay_init(&g_chips[i], clock / 2, clock, AUDIO_SAMPLE_RATE);
+    }
+
+    u64        samples = 0;
+    KTimePoint start   = $.time_now();
+    for (u32 f = 0; f < NUM_FRAMES; ++f) {
+        for (u32 i = 0; i < NUM_CHIPS; ++i) {
+            play_frame(&g_chips[i]);
+            ay_end_frame(&g_chips[i], timing->frame_tstates);
+            samples += g_chips[i].num_samples;
+        }
+    }
+    f64 secs = $.time_secs($.time_diff(start, $.time_now()));
+
+    f64 rate = (f64)samples / secs;
+    $.prn("%u chips x %u frames: %llu samples in %.3fs",
+          NUM_CHIPS,
+          NUM_FRAMES,
+          (unsigned long long)samples,
+          secs);
+    $.prn("%.2f M samples/s, %.0f chips in real time per core",
+          rate * 1e-6,
+          rate / AUDIO_SAMPLE_RATE);
+
+    $.done();
+    return EXIT_SUCCESS;
+}
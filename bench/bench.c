@@ -0,0 +1,357 @@
+//------------------------------------------------------------------------------
+// Headless emulation benchmark
+//
+// Runs fixed workloads through the emulation core with no window and prints
+// one JSON object per workload on stdout, so results can be compared from
+// commit to commit.  Built and run by `./build bench`.
+//
+// Usage: bench [--frames <n>] [--snapshot <file>] [--zexall <file.tap>]
+//              [--contended]
+//
+// --contended applies the 48K's memory contention, to measure its cost.
+//------------------------------------------------------------------------------
+
+#define KORE_IMPLEMENTATION
+#include "kore.h"
+
+#include "config.h"
+#include "contention.h"
+#include "memory.h"
+#include "roms.h"
+#include "snapshot.h"
+#include "tape.h"
+#include "z80.h"
+
+#if KORE_OS_LINUX
+#    include <sys/resource.h>
+#elif KORE_OS_WINDOWS
+#    include <psapi.h>
+#endif
+
+#define BOOT_MAX_FRAMES 500
+
+// Apply memory contention to every machine
+static bool g_contended = false;
+
+typedef struct {
+    const char* name;
+    u32         frames;
+    u64         tstates;
+    u64         instructions;
+    f64         secs;
+} BenchResult;
+
+//------------------------------------------------------------------------------
+// Machine
+//------------------------------------------------------------------------------
+
+typedef struct {
+    Memory memory;
+    Z80    z80;
+    Tape   tape;
+
+    u8 breakpoints[8192]; // The tape trap
+} Machine;
+
+static u8 bench_port_in(void* user, u16 port)
+{
+    (void)user;
+    (void)port;
+    return 0xff;
+}
+
+static void bench_port_out(void* user, u16 port, u8 value)
+{
+    Machine* m = (Machine*)user;
+    mem_port_out(&m->memory, port, value);
+}
+
+// Returns false if the ROM can't be loaded
+static bool machine_init(Machine* m)
+{
+    mem_init(&m->memory, MemoryModel_48K);
+    if (!roms_load(&m->memory, NULL)) {
+        return false;
+    }
+    z80_init(&m->z80, &m->memory);
+    m->z80.port_in  = bench_port_in;
+    m->z80.port_out = bench_port_out;
+    m->z80.user     = m;
+    if (g_contended) {
+        contention_attach(&m->z80, MemoryModel_48K);
+    }
+    return true;
+}
+
+static void machine_done(Machine* m)
+{
+    tape_close(&m->tape);
+    mem_done(&m->memory);
+}
+
+// Each stop is at the tape trap, as in nx
+static void machine_frame(Machine* m)
+{
+    z80_start_frame(&m->z80, TSTATES_PER_FRAME, INT_LENGTH);
+    z80_run(&m->z80, TSTATES_PER_FRAME);
+    while (m->z80.stopped) {
+        tape_trap(&m->tape, &m->z80);
+        z80_run(&m->z80, TSTATES_PER_FRAME);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Reporting
+//------------------------------------------------------------------------------
+
+static u64 peak_rss_kb(void)
+{
+#if KORE_OS_LINUX
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (u64)usage.ru_maxrss;
+#elif KORE_OS_WINDOWS
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return (u64)(counters.PeakWorkingSetSize / 1024);
+#else
+    return 0;
+#endif
+}
+
+static void report(const BenchResult* r)
+{
+    f64 tstates_per_sec = r->secs > 0 ? (f64)r->tstates / r->secs : 0;
+    f64 ns_per_instr =
+        r->instructions > 0 ? r->secs * 1e9 / (f64)r->instructions : 0;
+
+    printf("{\"workload\":\"%s\",\"frames\":%u,\"tstates\":%llu,"
+           "\"instructions\":%llu,\"seconds\":%.6f,\"tstates_per_sec\":%.0f,"
+           "\"ns_per_instr\":%.3f,\"peak_rss_kb\":%llu}\n",
+           r->name,
+           r->frames,
+           (unsigned long long)r->tstates,
+           (unsigned long long)r->instructions,
+           r->secs,
+           tstates_per_sec,
+           ns_per_instr,
+           (unsigned long long)peak_rss_kb());
+    fflush(stdout);
+}
+
+static void report_skipped(const char* name, const char* reason)
+{
+    printf("{\"workload\":\"%s\",\"skipped\":\"%s\"}\n", name, reason);
+    fflush(stdout);
+}
+
+// Run frames on a machine and time them
+static BenchResult bench_frames(Machine* m, const char* name, u32 frames)
+{
+    u64        instructions = m->z80.instructions;
+    KTimePoint start        = $.time_now();
+    for (u32 i = 0; i < frames; ++i) {
+        machine_frame(m);
+    }
+    f64 secs = $.time_secs($.time_diff(start, $.time_now()));
+
+    return (BenchResult){
+        .name         = name,
+        .frames       = frames,
+        .tstates      = (u64)frames * TSTATES_PER_FRAME,
+        .instructions = m->z80.instructions - instructions,
+        .secs         = secs,
+    };
+}
+
+//------------------------------------------------------------------------------
+// Workloads
+//------------------------------------------------------------------------------
+
+// True if any pixel in the given character row of the display is set
+static bool screen_row_set(Memory* memory, u32 row)
+{
+    u16 base = (u16)(0x4000 + (row / 8) * 0x800 + (row % 8) * 32);
+    for (u16 line = 0; line < 8; ++line) {
+        for (u16 x = 0; x < 32; ++x) {
+            if (mem_peek(memory, (u16)(base + line * 0x100 + x))) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Boot the 48K ROM until the copyright message appears on the bottom line.
+// The RAM test leaves junk there, so wait for it to be cleared first.
+static bool bench_boot(Machine* m)
+{
+    u64        instructions = m->z80.instructions;
+    KTimePoint start        = $.time_now();
+    bool       cleared      = false;
+    u32        frames       = 0;
+    while (frames < BOOT_MAX_FRAMES) {
+        machine_frame(m);
+        frames++;
+
+        bool set = screen_row_set(&m->memory, 23);
+        if (!set) {
+            cleared = true;
+        } else if (cleared) {
+            break;
+        }
+    }
+    f64 secs = $.time_secs($.time_diff(start, $.time_now()));
+
+    if (frames == BOOT_MAX_FRAMES) {
+        report_skipped("boot", "copyright message never appeared");
+        return false;
+    }
+
+    report(&(BenchResult){
+        .name         = "boot",
+        .frames       = frames,
+        .tstates      = (u64)frames * TSTATES_PER_FRAME,
+        .instructions = m->z80.instructions - instructions,
+        .secs         = secs,
+    });
+    return true;
+}
+
+// LOAD "" and ENTER, typed as nx's autoload does
+static const u8 g_load_keys[] = {0xef, '"', '"', 0x0d, 0};
+
+// Type LOAD "" into a booted 48K and run until the trap has loaded every
+// block of the tape.  Returns false if that takes more than BOOT_MAX_FRAMES.
+static bool bench_load_tape(Machine* m)
+{
+    m->breakpoints[TAPE_LD_BYTES >> 3] |= 1 << (TAPE_LD_BYTES & 7);
+    m->z80.breakpoints = m->breakpoints;
+
+    const u8* key = g_load_keys;
+    for (u32 i = 0; i < BOOT_MAX_FRAMES; ++i) {
+        if (m->tape.block == array_length(m->tape.blocks)) {
+            // Time the program on the same core as the other workloads
+            m->z80.breakpoints = NULL;
+            return true;
+        }
+        u8 flags = mem_peek(&m->memory, SYSVAR_FLAGS);
+        if (*key && !(flags & FLAGS_NEW_KEY)) {
+            mem_poke(&m->memory, SYSVAR_LAST_K, *key++);
+            mem_poke(&m->memory, SYSVAR_FLAGS, flags | FLAGS_NEW_KEY);
+        }
+        machine_frame(m);
+    }
+    return false;
+}
+
+// zexall exercises every instruction; run a fixed number of frames of it on
+// top of a booted ROM, which it uses to print its progress.
+static void bench_zexall(u32 frames, const char* filename)
+{
+    Machine m = {0};
+    if (!machine_init(&m)) {
+        report_skipped("zexall", "no ROM");
+        machine_done(&m);
+        return;
+    }
+    if (!tape_open(&m.tape, filename)) {
+        report_skipped("zexall", "can't be opened");
+        machine_done(&m);
+        return;
+    }
+    for (u32 i = 0; i < BOOT_MAX_FRAMES / 2; ++i) {
+        machine_frame(&m);
+    }
+
+    if (!bench_load_tape(&m)) {
+        report_skipped("zexall", "tape never loaded");
+        machine_done(&m);
+        return;
+    }
+
+    BenchResult r = bench_frames(&m, "zexall", frames);
+    report(&r);
+    machine_done(&m);
+}
+
+// Any SNA or Z80 snapshot of a 48K
+static void bench_snapshot(u32 frames, const char* filename)
+{
+    Snapshot snap;
+    if (!snapshot_open(&snap, filename)) {
+        report_skipped("snapshot", "can't be opened");
+        return;
+    }
+    if (snap.model != MemoryModel_48K) {
+        report_skipped("snapshot", "not a 48K snapshot");
+        snapshot_close(&snap);
+        return;
+    }
+
+    Machine m = {0};
+    if (!machine_init(&m)) {
+        report_skipped("snapshot", "no ROM");
+        snapshot_close(&snap);
+        machine_done(&m);
+        return;
+    }
+    bool loaded = snapshot_load(&snap, &m.memory, &m.z80);
+    snapshot_close(&snap);
+    if (!loaded) {
+        report_skipped("snapshot", "corrupt snapshot");
+        machine_done(&m);
+        return;
+    }
+
+    // z80_start_frame takes a frame off before the first one runs
+    m.z80.t = TSTATES_PER_FRAME + snap.tstates;
+
+    BenchResult r = bench_frames(&m, "snapshot", frames);
+    report(&r);
+    machine_done(&m);
+}
+
+//------------------------------------------------------------------------------
+// Entry point
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    $.init();
+
+    u32         frames   = 3000;
+    const char* snapshot = "etc/tests/Timing_Tests-48k_v1.0.sna";
+    const char* zexall   = "etc/tests/zexall2-0.1.tap";
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot = argv[++i];
+        } else if (strcmp(argv[i], "--zexall") == 0 && i + 1 < argc) {
+            zexall = argv[++i];
+        } else if (strcmp(argv[i], "--contended") == 0) {
+            g_contended = true;
+        } else {
+            $.eprn("Unknown option: %s", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    Machine m = {0};
+    if (!machine_init(&m)) {
+        $.eprn("Failed to load the 48K ROM.");
+        machine_done(&m);
+        $.done();
+        return EXIT_FAILURE;
+    }
+    bool booted = bench_boot(&m);
+    machine_done(&m);
+
+    bench_zexall(frames, zexall);
+    bench_snapshot(frames, snapshot);
+
+    $.done();
+    return booted ? EXIT_SUCCESS : EXIT_FAILURE;
+}
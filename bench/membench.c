@@ -0,0 +1,122 @@
+//------------------------------------------------------------------------------
+// Memory accessor microbenchmark
+//
+// Compares the out-of-line mem_peek/mem_poke family with the inline
+// mem_read/mem_write family.  Built and run by `./build membench`.
+//------------------------------------------------------------------------------
+
+#define KORE_IMPLEMENTATION
+#include "kore.h"
+
+#include "memory.h"
+
+#define NUM_ADDRESSES 65536
+#define NUM_PASSES 2000
+
+static u16 g_addresses[NUM_ADDRESSES];
+
+// Stops the compiler throwing away the loops
+static volatile u32 g_sink;
+
+typedef u32 (*BenchFn)(Memory* memory);
+
+static u32 bench_peek(Memory* memory)
+{
+    u32 sum = 0;
+    for (u32 pass = 0; pass < NUM_PASSES; ++pass) {
+        for (u32 i = 0; i < NUM_ADDRESSES; ++i) {
+            sum += mem_peek(memory, g_addresses[i]);
+        }
+    }
+    return sum;
+}
+
+static u32 bench_read(Memory* memory)
+{
+    u32 sum = 0;
+    for (u32 pass = 0; pass < NUM_PASSES; ++pass) {
+        for (u32 i = 0; i < NUM_ADDRESSES; ++i) {
+            sum += mem_read(memory, g_addresses[i]);
+        }
+    }
+    return sum;
+}
+
+static u32 bench_poke(Memory* memory)
+{
+    for (u32 pass = 0; pass < NUM_PASSES; ++pass) {
+        for (u32 i = 0; i < NUM_ADDRESSES; ++i) {
+            mem_poke(memory, g_addresses[i], (u8)i);
+        }
+    }
+    return mem_peek(memory, 0x8000);
+}
+
+static u32 bench_write(Memory* memory)
+{
+    for (u32 pass = 0; pass < NUM_PASSES; ++pass) {
+        for (u32 i = 0; i < NUM_ADDRESSES; ++i) {
+            mem_write(memory, g_addresses[i], (u8)i);
+        }
+    }
+    return mem_peek(memory, 0x8000);
+}
+
+static u32 bench_peek16(Memory* memory)
+{
+    u32 sum = 0;
+    for (u32 pass = 0; pass < NUM_PASSES; ++pass) {
+        for (u32 i = 0; i < NUM_ADDRESSES; ++i) {
+            sum += mem_peek16(memory, g_addresses[i]);
+        }
+    }
+    return sum;
+}
+
+static u32 bench_read16(Memory* memory)
+{
+    u32 sum = 0;
+    for (u32 pass = 0; pass < NUM_PASSES; ++pass) {
+        for (u32 i = 0; i < NUM_ADDRESSES; ++i) {
+            sum += mem_read16(memory, g_addresses[i]);
+        }
+    }
+    return sum;
+}
+
+static void bench_run(Memory* memory, const char* name, BenchFn fn)
+{
+    KTimePoint start = $.time_now();
+    g_sink           = fn(memory);
+    f64 secs         = $.time_secs($.time_diff(start, $.time_now()));
+
+    f64 accesses     = (f64)NUM_PASSES * NUM_ADDRESSES;
+    $.prn("%-12s %8.1f M accesses/s", name, accesses / secs / 1000000.0);
+}
+
+int main(void)
+{
+    $.init();
+
+    Memory memory = {0};
+    mem_init(&memory, MemoryModel_48K);
+
+    // A fixed pseudo-random spread of addresses so the loops can't be
+    // vectorised into something a CPU core would never do
+    u32 seed = 12345;
+    for (u32 i = 0; i < NUM_ADDRESSES; ++i) {
+        seed           = seed * 1103515245 + 12345;
+        g_addresses[i] = (u16)(seed >> 16);
+    }
+
+    bench_run(&memory, "mem_peek", bench_peek);
+    bench_run(&memory, "mem_read", bench_read);
+    bench_run(&memory, "mem_poke", bench_poke);
+    bench_run(&memory, "mem_write", bench_write);
+    bench_run(&memory, "mem_peek16", bench_peek16);
+    bench_run(&memory, "mem_read16", bench_read16);
+
+    mem_done(&memory);
+    $.done();
+    return 0;
+}
@@ -0,0 +1,100 @@
+//------------------------------------------------------------------------------
+// Scaler benchmark
+//
+// Times scaling a full 320x256 frame at scales 1 to 6 with every scaling
+// kernel the CPU supports, against the original nested-loop scaler.  Built
+// and run by `./build scalebench`.
+//------------------------------------------------------------------------------
+
+#define KORE_IMPLEMENTATION
+#include "kore.h"
+
+#include "config.h"
+#include "scale.h"
+
+#define MAX_SCALE 6
+#define NUM_FRAMES 500
+
+static u32 g_src[WINDOW_WIDTH * WINDOW_HEIGHT];
+static u32 g_dst[WINDOW_WIDTH * MAX_SCALE * WINDOW_HEIGHT * MAX_SCALE];
+static u32 g_expected[WINDOW_WIDTH * MAX_SCALE * WINDOW_HEIGHT * MAX_SCALE];
+
+// The scaler the X11 frame used to have: one store per output pixel
+static void scale_nested(u32* dst, const u32* src, u32 scale)
+{
+    u32 dst_w = WINDOW_WIDTH * scale;
+    for (u32 y = 0; y < WINDOW_HEIGHT; ++y) {
+        const u32* src_row = src + y * WINDOW_WIDTH;
+        for (u32 sy = 0; sy < scale; ++sy) {
+            u32* dst_row = dst + (y * scale + sy) * dst_w;
+            for (u32 x = 0; x < WINDOW_WIDTH; ++x) {
+                u32 px = src_row[x];
+                for (u32 sx = 0; sx < scale; ++sx) {
+                    dst_row[x * scale + sx] = px;
+                }
+            }
+        }
+    }
+}
+
+static void scale_frame(u32 scale)
+{
+    scale_image(g_dst,
+                WINDOW_WIDTH * scale,
+                g_src,
+                WINDOW_WIDTH,
+                WINDOW_WIDTH,
+                WINDOW_HEIGHT,
+                scale);
+}
+
+static void report(const char* name, u32 scale, f64 secs)
+{
+    $.prn("%-8s x%u %8.1f us/frame", name, scale, secs / NUM_FRAMES * 1e6);
+}
+
+int main(void)
+{
+    $.init();
+
+    u32 seed = 12345;
+    for (u32 i = 0; i < WINDOW_WIDTH * WINDOW_HEIGHT; ++i) {
+        seed     = seed * 1103515245 + 12345;
+        g_src[i] = seed;
+    }
+
+    bool ok = true;
+    for (u32 scale = 1; scale <= MAX_SCALE; ++scale) {
+        usize size = (usize)WINDOW_WIDTH * WINDOW_HEIGHT * scale * scale;
+
+        KTimePoint start = $.time_now();
+        for (u32 i = 0; i < NUM_FRAMES; ++i) {
+            scale_nested(g_expected, g_src, scale);
+        }
+        report("nested", scale, $.time_secs($.time_diff(start, $.time_now())));
+
+        for (u32 k = 0; k < ScaleKernel_COUNT; ++k) {
+            if (!scale_select((ScaleKernel)k)) {
+                continue;
+            }
+
+            memset(g_dst, 0, size * sizeof(u32));
+            start = $.time_now();
+            for (u32 i = 0; i < NUM_FRAMES; ++i) {
+                scale_frame(scale);
+            }
+            f64 secs = $.time_secs($.time_diff(start, $.time_now()));
+            report(scale_kernel_name((ScaleKernel)k), scale, secs);
+
+            if (memcmp(g_dst, g_expected, size * sizeof(u32)) != 0) {
+                $.eprn("%s x%u: output differs from the nested scaler",
+                       scale_kernel_name((ScaleKernel)k),
+                       scale);
+                ok = false;
+            }
+        }
+    }
+
+    $.done();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
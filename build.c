@@ -1,14 +1,11 @@
 #include "build.h"
 
-int main(int argc, char** argv)
-{
-    build_check(argc, argv);
-
-    bool run = false;
-    if (argc > 1 && strcmp(argv[1], "run") == 0) {
-        run = true;
-    }
+// Raw profiles from the PGO training run, and the merged result
+#define PGO_FOLDER "_bin/pgo"
+#define PGO_PROFDATA "_bin/nx.profdata"
 
+static bool add_platform_libraries(CompileInfo* info)
+{
     KArray(const char*) libraries = 0;
 
     switch (build_platform()) {
@@ -16,39 +13,240 @@ int main(int argc, char** argv)
         array_add(libraries, "user32");
         array_add(libraries, "gdi32");
         array_add(libraries, "opengl32");
+        array_add(libraries, "winmm");
         break;
     case Platform_Linux:
         array_add(libraries, "X11");
+        array_add(libraries, "Xext");
+        array_add(libraries, "pthread");
+        array_add(libraries, "dl");
+        array_add(libraries, "m");
         break;
     case Platform_MacOS:
         array_add(libraries, "Cocoa");
         break;
     default:
         $.eprn("Unsupported platform.");
-        return EXIT_FAILURE;
+        return false;
     }
 
-    Arena global_arena = arena_init();
+    compile_info_add_libraries(info, libraries);
+    array_free(libraries);
+    return true;
+}
 
-    CompileInfo info   = compile_info_init(&global_arena, "nx");
+// The emulator itself
+static CompileInfo nx_info(Arena* arena)
+{
+    CompileInfo info = compile_info_init(arena, "nx");
     compile_info_output_folder(&info, "_bin");
-    compile_info_debug(&info);
     compile_info_add_folder(&info, "src", true);
     compile_info_add_include_path(&info, "3rd/kore");
-    compile_info_add_libraries(&info, libraries);
+    return info;
+}
 
-    if (compile(&info) != 0) {
+// Headless emulation benchmark: the emulation core from src without the
+// window, graphics or the emulator's main().
+static CompileInfo bench_info(Arena* arena)
+{
+    CompileInfo info = compile_info_init(arena, "bench");
+    compile_info_output_folder(&info, "_bin");
+    compile_info_release(&info);
+    compile_info_add_folder(&info, "src", true);
+    compile_info_exclude_file(&info, "main.c");
+    compile_info_exclude_file(&info, "frame.c");
+    compile_info_exclude_file(&info, "frame-linux.c");
+    compile_info_exclude_file(&info, "frame-win32.c");
+    compile_info_exclude_file(&info, "gfx.c");
+    compile_info_exclude_file(&info, "gfx-soft.c");
+    compile_info_exclude_file(&info, "audio.c");
+    compile_info_add_file(&info, "bench/bench.c");
+    compile_info_add_include_path(&info, "src");
+    compile_info_add_include_path(&info, "3rd/kore");
+    if (build_platform() != Platform_Windows) {
+        compile_info_add_library(&info, "m"); // The beeper's filter kernel
+    }
+    return info;
+}
+
+static int build(CompileInfo* info)
+{
+    if (compile(info) != 0) {
         $.eprn("Compilation failed. Please check the output above.");
         return EXIT_FAILURE;
     }
+    return EXIT_SUCCESS;
+}
+
+// Run a built executable with the given arguments
+static int run(Arena* arena, const char* exe, int argc, char** argv)
+{
+    StringBuilder sb = string_builder_init(arena);
+    string_builder_append_zstring(&sb, exe);
+    for (int i = 0; i < argc; ++i) {
+        string_builder_append_zstring(&sb, " ");
+        string_builder_append_zstring(&sb, argv[i]);
+    }
+    string_builder_null_terminate(&sb);
+    if (build_run(sb.str) != 0) {
+        $.eprn("Failed to run the executable. Please check the output above.");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Memory accessor microbenchmark: always optimised, never linked with the
+// windowing code.
+static int build_membench(Arena* arena)
+{
+    CompileInfo info = compile_info_init(arena, "membench");
+    compile_info_output_folder(&info, "_bin");
+    compile_info_release(&info);
+    compile_info_add_file(&info, "bench/membench.c");
+    compile_info_add_file(&info, "src/memory.c");
+    compile_info_add_include_path(&info, "src");
+    compile_info_add_include_path(&info, "3rd/kore");
+
+    if (build(&info) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    return run(arena, "_bin/membench", 0, nullptr);
+}
+
+// Frame scaler benchmark: every scaling kernel at scales 1 to 6
+static int build_scalebench(Arena* arena)
+{
+    CompileInfo info = compile_info_init(arena, "scalebench");
+    compile_info_output_folder(&info, "_bin");
+    compile_info_release(&info);
+    compile_info_add_file(&info, "bench/scalebench.c");
+    compile_info_add_file(&info, "src/scale.c");
+    compile_info_add_include_path(&info, "src");
+    compile_info_add_include_path(&info, "3rd/kore");
+
+    if (build(&info) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    return run(arena, "_bin/scalebench", 0, nullptr);
+}
+
+// AY sound chip benchmark: samples rendered per second per core
+static int build_aybench(Arena* arena)
+{
+    CompileInfo info = compile_info_init(arena, "aybench");
+    compile_info_output_folder(&info, "_bin");
+    compile_info_release(&info);
+    compile_info_add_file(&info, "bench/aybench.c");
+    compile_info_add_file(&info, "src/ay.c");
+    compile_info_add_file(&info, "src/contention.c");
+    compile_info_add_include_path(&info, "src");
+    compile_info_add_include_path(&info, "3rd/kore");
+
+    if (build(&info) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    return run(arena, "_bin/aybench", 0, nullptr);
+}
+
+// Extra arguments are passed on to the benchmark
+static int build_bench(Arena* arena, int argc, char** argv)
+{
+    CompileInfo info = bench_info(arena);
+    if (build(&info) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    return run(arena, "_bin/bench", argc, argv);
+}
+
+// Profile-guided build.  An instrumented benchmark is trained on the etc/tests
+// workloads, then the emulator and benchmark are rebuilt with the profile.
+static int build_pgo(void)
+{
+    build_run(string_view("rm -rf " PGO_FOLDER));
+
+    Arena       train_arena = arena_init();
+    CompileInfo train       = bench_info(&train_arena);
+    compile_info_pgo_generate(&train, PGO_FOLDER);
+    if (build(&train) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (run(&train_arena, "_bin/bench", 0, nullptr) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (compile_pgo_merge(&train_arena, PGO_FOLDER, PGO_PROFDATA) != 0) {
+        $.eprn("Failed to merge the PGO profiles.");
+        return EXIT_FAILURE;
+    }
+
+    Arena       bench_arena = arena_init();
+    CompileInfo bench       = bench_info(&bench_arena);
+    compile_info_lto(&bench);
+    compile_info_pgo_use(&bench, PGO_PROFDATA);
+    if (build(&bench) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    Arena       nx_arena = arena_init();
+    CompileInfo nx       = nx_info(&nx_arena);
+    compile_info_release(&nx);
+    compile_info_lto(&nx);
+    compile_info_pgo_use(&nx, PGO_PROFDATA);
+    if (!add_platform_libraries(&nx)) {
+        return EXIT_FAILURE;
+    }
+    return build(&nx);
+}
+
+// Usage: build [run | release [run] | profile | pgo | bench [args] | membench |
+//              scalebench | aybench]
+int main(int argc, char** argv)
+{
+    build_check(argc, argv);
+
+    Arena       global_arena = arena_init();
+    const char* command      = argc > 1 ? argv[1] : "";
+
+    if (strcmp(command, "membench") == 0) {
+        return build_membench(&global_arena);
+    }
+
+    if (strcmp(command, "scalebench") == 0) {
+        return build_scalebench(&global_arena);
+    }
+
+    if (strcmp(command, "aybench") == 0) {
+        return build_aybench(&global_arena);
+    }
+
+    if (strcmp(command, "bench") == 0) {
+        return build_bench(&global_arena, argc - 2, argv + 2);
+    }
+
+    if (strcmp(command, "pgo") == 0) {
+        return build_pgo();
+    }
+
+    CompileInfo info = nx_info(&global_arena);
+    bool        go   = strcmp(command, "run") == 0;
+    if (strcmp(command, "release") == 0) {
+        compile_info_release(&info);
+        compile_info_lto(&info);
+        go = argc > 2 && strcmp(argv[2], "run") == 0;
+    } else if (strcmp(command, "profile") == 0) {
+        compile_info_profile(&info);
+    } else {
+        compile_info_debug(&info);
+    }
+
+    if (!add_platform_libraries(&info)) {
+        return EXIT_FAILURE;
+    }
+    if (build(&info) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
 
-    if (run) {
-        String exe_file = string_view("_bin/nx");
-        if (build_run(exe_file) != 0) {
-            $.eprn(
-                "Failed to run the executable. Please check the output above.");
-            return EXIT_FAILURE;
-        }
+    if (go) {
+        return run(&global_arena, "_bin/nx", 0, nullptr);
     }
 
     return 0;
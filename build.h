@@ -19,6 +19,8 @@
 #else
 #    include <dirent.h>
 #    include <sys/stat.h>
+#    include <sys/wait.h>
+#    include <unistd.h>
 #endif
 
 //
@@ -41,11 +43,13 @@ typedef struct {
     usize cursor;
 } Arena;
 
-#define ARENA_PAGE_SIZE 4096
+// String builders grow in place, so an arena can never move.  Reserve all of
+// it up front; the OS only commits the pages that are touched.
+#define ARENA_SIZE (64 * 1024 * 1024)
 
 Arena arena_init()
 {
-    void* buffer = KORE_ALLOC(ARENA_PAGE_SIZE);
+    void* buffer = KORE_ALLOC(ARENA_SIZE);
     Arena arena  = {.buffer = buffer, .cursor = 0};
     return arena;
 }
@@ -72,9 +76,9 @@ void arena_restore(Arena* arena, u64 cursor)
 
 void* arena_alloc(Arena* arena, size_t size)
 {
-    while ($.memory_size(arena->buffer) < arena->cursor + size) {
-        size_t new_size = $.memory_size(arena->buffer) + ARENA_PAGE_SIZE;
-        arena->buffer   = KORE_REALLOC(arena->buffer, new_size);
+    if (arena->cursor + size > ARENA_SIZE) {
+        fprintf(stderr, "Arena out of memory\n");
+        exit(EXIT_FAILURE);
     }
 
     void* ptr = (char*)arena->buffer + arena->cursor;
@@ -171,6 +175,16 @@ void string_builder_null_terminate(StringBuilder* sb)
     *null_place      = '\0';
 }
 
+// Null-terminate, but return a string whose length doesn't include the
+// terminator so it can still be appended to other builders.
+String string_builder_to_zstring(StringBuilder* sb)
+{
+    string_builder_null_terminate(sb);
+    String str = sb->str;
+    str.length--;
+    return str;
+}
+
 //
 // File Management
 //
@@ -181,7 +195,12 @@ u64 file_time(const char* path)
     if (stat(path, &st) != 0) {
         return 0;
     }
+#if defined(__linux__)
+    // Nanoseconds, so a header saved in the same second as a build is seen
+    return (u64)st.st_mtim.tv_sec * 1000000000ull + (u64)st.st_mtim.tv_nsec;
+#else
     return (u64)st.st_mtime;
+#endif
 }
 
 i32 file_time_compare(u64 time1, u64 time2)
@@ -359,18 +378,133 @@ i32 build_run(String command)
     return exit_code;
 }
 
+u32 build_cpu_count()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (u32)count : 1;
+#endif
+}
+
+// Run null-terminated commands with at most `jobs` running at once.  Returns
+// the number of commands that failed.
+u32 build_run_parallel(KArray(String) commands, u32 jobs)
+{
+    usize count  = array_length(commands);
+    usize next   = 0;
+    u32   active = 0;
+    u32   failed = 0;
+
+#ifdef _WIN32
+    if (jobs > MAXIMUM_WAIT_OBJECTS) {
+        jobs = MAXIMUM_WAIT_OBJECTS;
+    }
+    HANDLE processes[MAXIMUM_WAIT_OBJECTS];
+
+    while (next < count || active > 0) {
+        while (active < jobs && next < count) {
+            String command = commands[next++];
+            printf("Running command: %.*s\n", STRINGV(command));
+
+            STARTUPINFOA        si;
+            PROCESS_INFORMATION pi;
+            ZeroMemory(&si, sizeof(si));
+            si.cb = sizeof(si);
+            ZeroMemory(&pi, sizeof(pi));
+            if (CreateProcessA(NULL,
+                               (LPSTR)command.data,
+                               NULL,
+                               NULL,
+                               FALSE,
+                               0,
+                               NULL,
+                               NULL,
+                               &si,
+                               &pi)) {
+                CloseHandle(pi.hThread);
+                processes[active++] = pi.hProcess;
+            } else {
+                fprintf(stderr, "Failed to run command: %s\n", command.data);
+                failed++;
+            }
+        }
+        if (active == 0) {
+            continue;
+        }
+
+        DWORD index =
+            WaitForMultipleObjects(active, processes, FALSE, INFINITE) -
+            WAIT_OBJECT_0;
+        DWORD exit_code = 1;
+        GetExitCodeProcess(processes[index], &exit_code);
+        CloseHandle(processes[index]);
+        processes[index] = processes[--active];
+        if (exit_code != 0) {
+            failed++;
+        }
+    }
+#else
+    while (next < count || active > 0) {
+        while (active < jobs && next < count) {
+            String command = commands[next++];
+            printf("Running command: %.*s\n", STRINGV(command));
+            fflush(stdout);
+
+            pid_t pid = fork();
+            if (pid == 0) {
+                execl("/bin/sh", "sh", "-c", command.data, (char*)NULL);
+                _exit(127);
+            } else if (pid > 0) {
+                active++;
+            } else {
+                fprintf(stderr, "Failed to run command: %s\n", command.data);
+                failed++;
+            }
+        }
+        if (active == 0) {
+            continue;
+        }
+
+        int status = 0;
+        if (waitpid(-1, &status, 0) > 0) {
+            active--;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                failed++;
+            }
+        }
+    }
+#endif
+
+    return failed;
+}
+
 //
 // C compilation support
 //
 
+typedef enum {
+    CompileProfile_Default, // No optimisation
+    CompileProfile_Release, // -O2, assertions off
+    CompileProfile_Profile, // -O2 with symbols and frame pointers, for perf
+} CompileProfile;
+
 typedef struct {
     Arena* arena;
     KArray(String) files;
     KArray(String) libraries;
     KArray(String) include_paths;
-    bool   debug;
-    String output_file;
-    String output_folder;
+    KArray(String) flags;
+    bool           debug;
+    CompileProfile profile;
+    bool           lto;
+    String         pgo_generate; // Folder to write raw profiles into
+    String         pgo_use;      // Merged .profdata file to optimise with
+    String         output_file;
+    String         output_folder;
 } CompileInfo;
 
 CompileInfo compile_info_init(Arena* arena, const char* output_file)
@@ -380,7 +514,12 @@ CompileInfo compile_info_init(Arena* arena, const char* output_file)
     info.files         = nullptr;
     info.libraries     = nullptr;
     info.include_paths = nullptr;
+    info.flags         = nullptr;
     info.debug         = false;
+    info.profile       = CompileProfile_Default;
+    info.lto           = false;
+    info.pgo_generate  = (String){0};
+    info.pgo_use       = (String){0};
 
     StringBuilder sb   = string_builder_init(arena);
     string_builder_append_zstring(&sb, output_file);
@@ -394,6 +533,34 @@ CompileInfo compile_info_init(Arena* arena, const char* output_file)
 
 void compile_info_debug(CompileInfo* info) { info->debug = true; }
 
+void compile_info_release(CompileInfo* info)
+{
+    info->profile = CompileProfile_Release;
+}
+
+void compile_info_profile(CompileInfo* info)
+{
+    info->profile = CompileProfile_Profile;
+}
+
+void compile_info_lto(CompileInfo* info) { info->lto = true; }
+
+// Instrument the build so that running it writes raw profiles into folder
+void compile_info_pgo_generate(CompileInfo* info, const char* folder)
+{
+    StringBuilder sb = string_builder_init(info->arena);
+    string_builder_append_zstring(&sb, folder);
+    info->pgo_generate = sb.str;
+}
+
+// Optimise the build with a profile merged by compile_pgo_merge
+void compile_info_pgo_use(CompileInfo* info, const char* profdata)
+{
+    StringBuilder sb = string_builder_init(info->arena);
+    string_builder_append_zstring(&sb, profdata);
+    info->pgo_use = string_builder_to_zstring(&sb);
+}
+
 void compile_info_add_file(CompileInfo* info, const char* file)
 {
     StringBuilder sb = string_builder_init(info->arena);
@@ -423,6 +590,14 @@ void compile_info_add_include_path(CompileInfo* info, const char* path)
     array_add(info->include_paths, sb.str);
 }
 
+// Pass an extra option straight through to the compiler, e.g. "-O2"
+void compile_info_add_flag(CompileInfo* info, const char* flag)
+{
+    StringBuilder sb = string_builder_init(info->arena);
+    string_builder_append_zstring(&sb, flag);
+    array_add(info->flags, sb.str);
+}
+
 void compile_info_add_folder(CompileInfo* info,
                              const char*  folder,
                              bool         recursive)
@@ -437,6 +612,31 @@ void compile_info_add_folder(CompileInfo* info,
     array_free(files);
 }
 
+// Remove a file added by compile_info_add_folder, matched by its file name
+// (e.g. "main.c").
+void compile_info_exclude_file(CompileInfo* info, const char* name)
+{
+    usize name_length    = strlen(name);
+    KArray(String) files = nullptr;
+    for (usize i = 0; i < array_length(info->files); ++i) {
+        String file  = info->files[i];
+        bool   match = false;
+        if (string_ends_with_zstring(file, name)) {
+            if (file.length == name_length) {
+                match = true;
+            } else {
+                char sep = file.data[file.length - name_length - 1];
+                match    = sep == '/' || sep == '\\';
+            }
+        }
+        if (!match) {
+            array_add(files, file);
+        }
+    }
+    array_free(info->files);
+    info->files = files;
+}
+
 void compile_info_dump(CompileInfo* info)
 {
     printf("CompileInfo:\n");
@@ -444,6 +644,11 @@ void compile_info_dump(CompileInfo* info)
            (int)info->output_file.length,
            info->output_file.data);
     printf("  Debug mode: %s\n", info->debug ? "enabled" : "disabled");
+    printf("  Profile: %s%s\n",
+           info->profile == CompileProfile_Release   ? "release"
+           : info->profile == CompileProfile_Profile ? "profile"
+                                                     : "default",
+           info->lto ? " (LTO)" : "");
     printf("  Files to compile:\n");
     for (usize i = 0; i < array_length(info->files); ++i) {
         printf("    %.*s\n", (int)info->files[i].length, info->files[i].data);
@@ -457,40 +662,247 @@ void compile_info_output_folder(CompileInfo* info, const char* folder)
     info->output_folder = sb.str;
 }
 
+// Flags that affect code generation, shared by the compile and link steps
+static void compile_append_flags(StringBuilder* sb, CompileInfo* info)
+{
+    if (info->debug) {
+        string_builder_append_zstring(sb, " -g -DDEBUG");
+    }
+
+    switch (info->profile) {
+    case CompileProfile_Release:
+        string_builder_append_zstring(sb, " -O2 -DNDEBUG");
+        break;
+    case CompileProfile_Profile:
+        string_builder_append_zstring(sb, " -O2 -g -fno-omit-frame-pointer");
+        break;
+    default:
+        break;
+    }
+
+    if (info->lto) {
+        string_builder_append_zstring(sb, " -flto");
+    }
+
+    if (info->pgo_generate.length > 0) {
+        string_builder_append_zstring(sb, " -fprofile-generate=");
+        string_builder_append_string(sb, info->pgo_generate);
+    }
+
+    if (info->pgo_use.length > 0) {
+        // The training binary need not contain every function
+        string_builder_append_zstring(sb, " -fprofile-use=");
+        string_builder_append_string(sb, info->pgo_use);
+        string_builder_append_zstring(sb, " -Wno-profile-instr-unprofiled");
+    }
+
+    for (usize i = 0; i < array_length(info->flags); ++i) {
+        string_builder_append_zstring(sb, " ");
+        string_builder_append_string(sb, info->flags[i]);
+    }
+}
+
+// True if any file listed in a -MMD depfile is newer than time, or has gone
+static bool compile_deps_changed(const char* depfile, u64 time)
+{
+    FILE* f = fopen(depfile, "rb");
+    if (!f) {
+        return true;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* text = KORE_ARRAY_ALLOC(char, size + 1);
+    size       = (long)fread(text, 1, size, f);
+    text[size] = '\0';
+    fclose(f);
+
+    bool  changed = false;
+    char* cursor  = text;
+    while (!changed && *cursor) {
+        while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' ||
+               *cursor == '\n' || *cursor == '\\') {
+            cursor++;
+        }
+        char* token = cursor;
+        while (*cursor && *cursor != ' ' && *cursor != '\t' &&
+               *cursor != '\r' && *cursor != '\n') {
+            cursor++;
+        }
+        if (cursor == token) {
+            break;
+        }
+        char end = *cursor;
+        *cursor  = '\0';
+
+        // Skip the "target:" at the start
+        if (cursor[-1] != ':') {
+            u64 dep_time = file_time(token);
+            changed      = dep_time == 0 || file_time_compare(dep_time, time) > 0;
+        }
+        *cursor = end;
+    }
+
+    KORE_ARRAY_FREE(text);
+    return changed;
+}
+
+// Compile every file to its own object in parallel, then link them.  Objects
+// live in a folder named after the output and a hash of the flags, so switching
+// profile never reuses objects built with other flags.  A file is recompiled
+// only if its object is older than it, than any header in its depfile or than
+// the profile it is optimised with.
 i32 compile(CompileInfo* info)
 {
     printf("Compiling project...\n");
+
+    // Flags for the compile step
+    StringBuilder flags_sb = string_builder_init(info->arena);
+    compile_append_flags(&flags_sb, info);
+    for (usize i = 0; i < array_length(info->include_paths); ++i) {
+        string_builder_append_zstring(&flags_sb, " -I");
+        string_builder_append_string(&flags_sb, info->include_paths[i]);
+    }
+    String flags = flags_sb.str;
+
+    // FNV-1a
+    u32 hash     = 2166136261u;
+    for (usize i = 0; i < flags.length; ++i) {
+        hash = (hash ^ (u8)flags.data[i]) * 16777619u;
+    }
+    char hash_text[16];
+    snprintf(hash_text, sizeof(hash_text), "-%08x", hash);
+
+    // Retraining changes the code of every file without changing the flags
+    u64 profile_time =
+        info->pgo_use.length > 0 ? file_time(info->pgo_use.data) : 0;
+
     StringBuilder sb = string_builder_init(info->arena);
-    string_builder_append_zstring(&sb, "mkdir -p ");
     string_builder_append_string(&sb, info->output_folder);
+    string_builder_append_zstring(&sb, "/obj/");
+    string_builder_append_string(&sb, info->output_file);
+    string_builder_append_zstring(&sb, hash_text);
+    String obj_folder = sb.str;
+
+    sb                = string_builder_init(info->arena);
+    string_builder_append_zstring(&sb, "mkdir -p ");
+    string_builder_append_string(&sb, obj_folder);
     string_builder_null_terminate(&sb);
     build_run(sb.str);
 
     sb = string_builder_init(info->arena);
-    string_builder_append_zstring(&sb, "clang --std=c23 -o ");
     string_builder_append_string(&sb, info->output_folder);
     string_builder_append_zstring(&sb, "/");
     string_builder_append_string(&sb, info->output_file);
+    String exe_file = string_builder_to_zstring(&sb);
 
-    if (info->debug) {
-        string_builder_append_zstring(&sb, " -g -DDEBUG");
+    KArray(String) objects  = nullptr;
+    KArray(String) commands = nullptr;
+    for (usize i = 0; i < array_length(info->files); ++i) {
+        String source = info->files[i];
+
+        // src/z80.c -> <obj_folder>/src_z80.o
+        sb            = string_builder_init(info->arena);
+        string_builder_append_string(&sb, obj_folder);
+        string_builder_append_zstring(&sb, "/");
+        usize name_start = sb.str.length;
+        string_builder_append_string(
+            &sb, (String){.data = source.data, .length = source.length - 2});
+        char* name = (char*)sb.str.data + name_start;
+        for (usize j = 0; j < sb.str.length - name_start; ++j) {
+            if (name[j] == '/' || name[j] == '\\' || name[j] == ':') {
+                name[j] = '_';
+            }
+        }
+        String base = sb.str;
+        string_builder_append_zstring(&sb, ".o");
+        String object = string_builder_to_zstring(&sb);
+        array_add(objects, object);
+
+        sb = string_builder_init(info->arena);
+        string_builder_append_string(&sb, base);
+        string_builder_append_zstring(&sb, ".d");
+        String depfile = string_builder_to_zstring(&sb);
+
+        sb             = string_builder_init(info->arena);
+        string_builder_append_string(&sb, source);
+        String source_z = string_builder_to_zstring(&sb);
+
+        u64 object_time = file_time(object.data);
+        if (object_time != 0 &&
+            file_time_compare(file_time(source_z.data), object_time) <= 0 &&
+            file_time_compare(profile_time, object_time) <= 0 &&
+            !compile_deps_changed(depfile.data, object_time)) {
+            continue;
+        }
+
+        sb = string_builder_init(info->arena);
+        string_builder_append_zstring(&sb, "clang --std=c23 -c ");
+        string_builder_append_string(&sb, source);
+        string_builder_append_zstring(&sb, " -o ");
+        string_builder_append_string(&sb, object);
+        string_builder_append_zstring(&sb, " -MMD -MF ");
+        string_builder_append_string(&sb, depfile);
+        string_builder_append_string(&sb, flags);
+        string_builder_null_terminate(&sb);
+        array_add(commands, sb.str);
     }
 
-    for (usize i = 0; i < array_length(info->include_paths); ++i) {
-        string_builder_append_zstring(&sb, " -I");
-        string_builder_append_string(&sb, info->include_paths[i]);
+    usize compiled = array_length(commands);
+    u32   failed   = build_run_parallel(commands, build_cpu_count());
+    array_free(commands);
+    if (failed > 0) {
+        array_free(objects);
+        return 1;
     }
 
-    for (usize i = 0; i < array_length(info->libraries); ++i) {
-        string_builder_append_zstring(&sb, " -l");
-        string_builder_append_string(&sb, info->libraries[i]);
+    // Link if anything was rebuilt or the executable is missing or stale
+    bool link     = compiled > 0;
+    u64  exe_time = file_time(exe_file.data);
+    if (exe_time == 0) {
+        link = true;
+    }
+    for (usize i = 0; !link && i < array_length(objects); ++i) {
+        link = file_time_compare(file_time(objects[i].data), exe_time) > 0;
     }
 
-    for (usize i = 0; i < array_length(info->files); ++i) {
-        string_builder_append_zstring(&sb, " ");
-        string_builder_append_string(&sb, info->files[i]);
+    i32 result = 0;
+    if (link) {
+        sb = string_builder_init(info->arena);
+        string_builder_append_zstring(&sb, "clang --std=c23 -o ");
+        string_builder_append_string(&sb, exe_file);
+        compile_append_flags(&sb, info);
+
+        for (usize i = 0; i < array_length(objects); ++i) {
+            string_builder_append_zstring(&sb, " ");
+            string_builder_append_string(&sb, objects[i]);
+        }
+
+        for (usize i = 0; i < array_length(info->libraries); ++i) {
+            string_builder_append_zstring(&sb, " -l");
+            string_builder_append_string(&sb, info->libraries[i]);
+        }
+
+        string_builder_null_terminate(&sb);
+        result = build_run(sb.str);
+    } else {
+        printf("%.*s is up to date.\n", STRINGV(exe_file));
     }
 
+    array_free(objects);
+    return result;
+}
+
+// Merge the raw profiles written by a compile_info_pgo_generate build into a
+// single file for compile_info_pgo_use.
+i32 compile_pgo_merge(Arena* arena, const char* folder, const char* profdata)
+{
+    StringBuilder sb = string_builder_init(arena);
+    string_builder_append_zstring(&sb, "llvm-profdata merge -output=");
+    string_builder_append_zstring(&sb, profdata);
+    string_builder_append_zstring(&sb, " ");
+    string_builder_append_zstring(&sb, folder);
+    string_builder_append_zstring(&sb, "/*.profraw");
     string_builder_null_terminate(&sb);
     return build_run(sb.str);
 }
@@ -0,0 +1,343 @@
+//------------------------------------------------------------------------------
+// Audio output
+//------------------------------------------------------------------------------
+
+#include "audio.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if KORE_OS_LINUX
+#    include <dlfcn.h>
+#    include <pthread.h>
+#elif KORE_OS_WINDOWS
+#    include <mmsystem.h>
+#endif
+
+//------------------------------------------------------------------------------
+// Ring buffer
+//------------------------------------------------------------------------------
+
+u32 audio_ring_fill(AudioRing* ring)
+{
+    u32 write = atomic_load_explicit(&ring->write, memory_order_acquire);
+    u32 read  = atomic_load_explicit(&ring->read, memory_order_acquire);
+    return write - read;
+}
+
+static void audio_ring_copy(i16* dst, const i16* src, u32 count)
+{
+    memcpy(dst, src, (usize)count * AUDIO_CHANNELS * sizeof(i16));
+}
+
+u32 audio_ring_write(AudioRing* ring, const i16* frames, u32 count)
+{
+    u32 write = atomic_load_explicit(&ring->write, memory_order_relaxed);
+    u32 read  = atomic_load_explicit(&ring->read, memory_order_acquire);
+    u32 space = AUDIO_RING_FRAMES - (write - read);
+    if (count > space) {
+        count = space;
+    }
+
+    u32 index = write & (AUDIO_RING_FRAMES - 1);
+    u32 first = AUDIO_RING_FRAMES - index;
+    if (first > count) {
+        first = count;
+    }
+    audio_ring_copy(ring->samples + index * AUDIO_CHANNELS, frames, first);
+    audio_ring_copy(
+        ring->samples, frames + first * AUDIO_CHANNELS, count - first);
+
+    atomic_store_explicit(&ring->write, write + count, memory_order_release);
+    return count;
+}
+
+u32 audio_ring_read(AudioRing* ring, i16* frames, u32 count)
+{
+    u32 read  = atomic_load_explicit(&ring->read, memory_order_relaxed);
+    u32 write = atomic_load_explicit(&ring->write, memory_order_acquire);
+    if (count > write - read) {
+        count = write - read;
+    }
+
+    u32 index = read & (AUDIO_RING_FRAMES - 1);
+    u32 first = AUDIO_RING_FRAMES - index;
+    if (first > count) {
+        first = count;
+    }
+    audio_ring_copy(frames, ring->samples + index * AUDIO_CHANNELS, first);
+    audio_ring_copy(
+        frames + first * AUDIO_CHANNELS, ring->samples, count - first);
+
+    atomic_store_explicit(&ring->read, read + count, memory_order_release);
+    return count;
+}
+
+// Fill a period from the ring, padding it with silence if the ring runs dry
+static void audio_fill_period(Audio* audio, i16* period)
+{
+    u32 got = audio_ring_read(&audio->ring, period, AUDIO_PERIOD_FRAMES);
+    if (got < AUDIO_PERIOD_FRAMES) {
+        memset(period + got * AUDIO_CHANNELS,
+               0,
+               (usize)(AUDIO_PERIOD_FRAMES - got) * AUDIO_CHANNELS *
+                   sizeof(i16));
+        atomic_fetch_add_explicit(&audio->underruns, 1, memory_order_relaxed);
+    }
+}
+
+#if KORE_OS_LINUX
+
+//------------------------------------------------------------------------------
+// ALSA output
+//
+// libasound is loaded at run time, so nx builds without the ALSA headers and
+// still runs, silently, on machines without it.
+//------------------------------------------------------------------------------
+
+typedef struct snd_pcm snd_pcm_t;
+
+#    define SND_PCM_STREAM_PLAYBACK 0
+#    define SND_PCM_FORMAT_S16_LE 2
+#    define SND_PCM_ACCESS_RW_INTERLEAVED 3
+
+// Device latency asked for, in microseconds
+#    define AUDIO_LATENCY_US 40000
+
+struct AudioDevice {
+    void*        library;
+    snd_pcm_t*   pcm;
+    pthread_t    thread;
+    _Atomic bool running;
+
+    int (*pcm_open)(snd_pcm_t**, const char*, int, int);
+    int (*pcm_set_params)(
+        snd_pcm_t*, int, int, unsigned, unsigned, int, unsigned);
+    long (*pcm_writei)(snd_pcm_t*, const void*, unsigned long);
+    int (*pcm_recover)(snd_pcm_t*, int, int);
+    int (*pcm_close)(snd_pcm_t*);
+};
+
+// The device blocks the write until there is room, which paces the thread
+static void* audio_thread(void* p)
+{
+    Audio*       audio  = (Audio*)p;
+    AudioDevice* device = audio->device;
+    i16          period[AUDIO_PERIOD_FRAMES * AUDIO_CHANNELS];
+
+    while (atomic_load_explicit(&device->running, memory_order_relaxed)) {
+        audio_fill_period(audio, period);
+        long written =
+            device->pcm_writei(device->pcm, period, AUDIO_PERIOD_FRAMES);
+        if (written < 0) {
+            device->pcm_recover(device->pcm, (int)written, 1);
+        }
+    }
+    return NULL;
+}
+
+static bool audio_load(AudioDevice* device)
+{
+    device->library = dlopen("libasound.so.2", RTLD_NOW);
+    if (!device->library) {
+        return false;
+    }
+    *(void**)&device->pcm_open = dlsym(device->library, "snd_pcm_open");
+    *(void**)&device->pcm_set_params =
+        dlsym(device->library, "snd_pcm_set_params");
+    *(void**)&device->pcm_writei  = dlsym(device->library, "snd_pcm_writei");
+    *(void**)&device->pcm_recover = dlsym(device->library, "snd_pcm_recover");
+    *(void**)&device->pcm_close   = dlsym(device->library, "snd_pcm_close");
+    return device->pcm_open && device->pcm_set_params && device->pcm_writei &&
+           device->pcm_recover && device->pcm_close;
+}
+
+static bool audio_device_open(Audio* audio)
+{
+    AudioDevice* device = (AudioDevice*)calloc(1, sizeof(AudioDevice));
+    if (!device) {
+        return false;
+    }
+    if (!audio_load(device) ||
+        device->pcm_open(&device->pcm, "default", SND_PCM_STREAM_PLAYBACK, 0) <
+            0) {
+        goto fail;
+    }
+    if (device->pcm_set_params(device->pcm,
+                               SND_PCM_FORMAT_S16_LE,
+                               SND_PCM_ACCESS_RW_INTERLEAVED,
+                               AUDIO_CHANNELS,
+                               AUDIO_SAMPLE_RATE,
+                               1,
+                               AUDIO_LATENCY_US) < 0) {
+        goto fail;
+    }
+
+    audio->device = device;
+    atomic_store(&device->running, true);
+    if (pthread_create(&device->thread, NULL, audio_thread, audio) != 0) {
+        audio->device = NULL;
+        goto fail;
+    }
+    return true;
+
+fail:
+    if (device->pcm) {
+        device->pcm_close(device->pcm);
+    }
+    if (device->library) {
+        dlclose(device->library);
+    }
+    free(device);
+    return false;
+}
+
+static void audio_device_close(Audio* audio)
+{
+    AudioDevice* device = audio->device;
+    atomic_store(&device->running, false);
+    pthread_join(device->thread, NULL);
+    device->pcm_close(device->pcm);
+    dlclose(device->library);
+    free(device);
+}
+
+#elif KORE_OS_WINDOWS
+
+//------------------------------------------------------------------------------
+// waveOut output
+//------------------------------------------------------------------------------
+
+// Periods queued on the device at once
+#    define AUDIO_BUFFERS 4
+
+struct AudioDevice {
+    HWAVEOUT     wave;
+    WAVEHDR      headers[AUDIO_BUFFERS];
+    i16          buffers[AUDIO_BUFFERS][AUDIO_PERIOD_FRAMES * AUDIO_CHANNELS];
+    HANDLE       thread;
+    _Atomic bool running;
+};
+
+// Refill each buffer as the device finishes with it
+static DWORD WINAPI audio_thread(LPVOID p)
+{
+    Audio*       audio  = (Audio*)p;
+    AudioDevice* device = audio->device;
+
+    while (atomic_load_explicit(&device->running, memory_order_relaxed)) {
+        bool queued = false;
+        for (u32 i = 0; i < AUDIO_BUFFERS; ++i) {
+            WAVEHDR* header = &device->headers[i];
+            if (header->dwFlags & WHDR_INQUEUE) {
+                continue;
+            }
+            audio_fill_period(audio, device->buffers[i]);
+            waveOutWrite(device->wave, header, sizeof(WAVEHDR));
+            queued = true;
+        }
+        if (!queued) {
+            Sleep(1);
+        }
+    }
+    return 0;
+}
+
+static bool audio_device_open(Audio* audio)
+{
+    AudioDevice* device = (AudioDevice*)calloc(1, sizeof(AudioDevice));
+    if (!device) {
+        return false;
+    }
+
+    WAVEFORMATEX format = {
+        .wFormatTag      = WAVE_FORMAT_PCM,
+        .nChannels       = AUDIO_CHANNELS,
+        .nSamplesPerSec  = AUDIO_SAMPLE_RATE,
+        .wBitsPerSample  = 16,
+        .nBlockAlign     = AUDIO_CHANNELS * sizeof(i16),
+        .nAvgBytesPerSec = AUDIO_SAMPLE_RATE * AUDIO_CHANNELS * sizeof(i16),
+    };
+    if (waveOutOpen(&device->wave, WAVE_MAPPER, &format, 0, 0, CALLBACK_NULL) !=
+        MMSYSERR_NOERROR) {
+        free(device);
+        return false;
+    }
+    for (u32 i = 0; i < AUDIO_BUFFERS; ++i) {
+        device->headers[i] = (WAVEHDR){
+            .lpData         = (LPSTR)device->buffers[i],
+            .dwBufferLength = sizeof(device->buffers[i]),
+        };
+        waveOutPrepareHeader(
+            device->wave, &device->headers[i], sizeof(WAVEHDR));
+    }
+
+    audio->device = device;
+    atomic_store(&device->running, true);
+    device->thread = CreateThread(NULL, 0, audio_thread, audio, 0, NULL);
+    if (!device->thread) {
+        audio->device = NULL;
+        waveOutClose(device->wave);
+        free(device);
+        return false;
+    }
+    return true;
+}
+
+static void audio_device_close(Audio* audio)
+{
+    AudioDevice* device = audio->device;
+    atomic_store(&device->running, false);
+    WaitForSingleObject(device->thread, INFINITE);
+    CloseHandle(device->thread);
+    waveOutReset(device->wave);
+    for (u32 i = 0; i < AUDIO_BUFFERS; ++i) {
+        waveOutUnprepareHeader(
+            device->wave, &device->headers[i], sizeof(WAVEHDR));
+    }
+    waveOutClose(device->wave);
+    free(device);
+}
+
+#else
+
+static bool audio_device_open(Audio* audio)
+{
+    (void)audio;
+    return false;
+}
+
+static void audio_device_close(Audio* audio) { (void)audio; }
+
+#endif
+
+//------------------------------------------------------------------------------
+// Output
+//------------------------------------------------------------------------------
+
+bool audio_open(Audio* audio)
+{
+    memset(audio, 0, sizeof(*audio));
+    return audio_device_open(audio);
+}
+
+void audio_close(Audio* audio)
+{
+    if (audio->device) {
+        audio_device_close(audio);
+        audio->device = NULL;
+    }
+}
+
+u32 audio_write(Audio* audio, const i16* frames, u32 count)
+{
+    if (!audio->device) {
+        return count;
+    }
+    return audio_ring_write(&audio->ring, frames, count);
+}
+
+f64 audio_fill(Audio* audio)
+{
+    return (f64)audio_ring_fill(&audio->ring) / AUDIO_RING_FRAMES;
+}
@@ -0,0 +1,58 @@
+//------------------------------------------------------------------------------
+// Audio output
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "kore.h"
+
+#include <stdatomic.h>
+
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_CHANNELS 2
+
+// Ring buffer size in sample frames; must be a power of two
+#define AUDIO_RING_FRAMES 4096
+
+// Sample frames the audio thread hands to the device at a time
+#define AUDIO_PERIOD_FRAMES 256
+
+// Single-producer, single-consumer ring of interleaved 16-bit sample frames.
+// The emulator writes and the audio thread reads, with no locks: each side
+// only advances its own index, and publishes it with release ordering after
+// touching the samples.  The indices count frames forever and wrap through
+// the buffer by masking.  The indices have a cache line each, so the two
+// threads don't keep taking the line from each other.
+typedef struct {
+    i16                       samples[AUDIO_RING_FRAMES * AUDIO_CHANNELS];
+    _Alignas(64) _Atomic(u32) write;
+    _Alignas(64) _Atomic(u32) read;
+} AudioRing;
+
+// Frames waiting to be read
+u32 audio_ring_fill(AudioRing* ring);
+
+// Copy up to count frames in or out, returning how many were copied
+u32 audio_ring_write(AudioRing* ring, const i16* frames, u32 count);
+u32 audio_ring_read(AudioRing* ring, i16* frames, u32 count);
+
+typedef struct AudioDevice AudioDevice;
+
+// Plays whatever is in the ring on a thread of its own, with silence when it
+// runs dry
+typedef struct {
+    AudioRing    ring;
+    AudioDevice* device;
+    _Atomic(u64) underruns; // Periods padded with silence
+} Audio;
+
+// Open the default output device.  Returns false if there isn't one, in which
+// case nothing is played and audio_write discards everything.
+bool audio_open(Audio* audio);
+void audio_close(Audio* audio);
+
+// Queue frames to play, returning how many fitted
+u32 audio_write(Audio* audio, const i16* frames, u32 count);
+
+// Fraction of the ring waiting to be played, from 0 to 1
+f64 audio_fill(Audio* audio);
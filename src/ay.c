@@ -0,0 +1,403 @@
+//------------------------------------------------------------------------------
+// AY-3-8912 sound chip
+//------------------------------------------------------------------------------
+
+#include "ay.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#    define AY_SSE2 1
+#    include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#    define AY_NEON 1
+#    include <arm_neon.h>
+#endif
+
+// Bits of each register that exist; the rest read back as 0
+static const u8 g_reg_masks[AY_NUM_REGS] = {
+    0xff, 0x0f, 0xff, 0x0f, 0xff, 0x0f, 0x1f, 0xff,
+    0x1f, 0x1f, 0x1f, 0xff, 0xff, 0x0f, 0xff, 0xff,
+};
+
+// Output of the DAC for each volume level, measured from a real chip
+static const f32 g_volumes[16] = {
+    0.0f,    0.0106f, 0.0150f, 0.0222f, 0.0320f, 0.0466f, 0.0665f, 0.1039f,
+    0.1237f, 0.1986f, 0.2803f, 0.3548f, 0.4702f, 0.6030f, 0.7530f, 1.0f,
+};
+
+// ABC stereo: A on the left, B in the middle and C on the right.  The gain
+// leaves room to mix in the beeper.
+#define AY_GAIN 0.25f
+static const f32 g_pan_left[4]  = {1.0f, 0.7f, 0.3f, 0.0f};
+static const f32 g_pan_right[4] = {0.3f, 0.7f, 1.0f, 0.0f};
+
+// Pole of the DC blocker, a high-pass filter at about 8Hz
+#define AY_DC_POLE 0.999f
+
+enum {
+    AyReg_NoisePeriod = 6,
+    AyReg_Mixer       = 7,
+    AyReg_VolumeA     = 8,
+    AyReg_EnvFine     = 11,
+    AyReg_EnvCoarse   = 12,
+    AyReg_EnvShape    = 13,
+};
+
+void ay_init(Ay* ay, u32 clock_hz, u32 cpu_hz, u32 sample_rate)
+{
+    memset(ay, 0, sizeof(*ay));
+    ay->noise_lfsr = 1;
+    ay->env_hold   = true;
+
+    u32 tick_rate    = clock_hz / 8;
+    ay->tick_step    = ((u64)tick_rate << 32) / cpu_hz;
+    ay->sample_ticks = (u32)(((u64)tick_rate << 16) / sample_rate);
+    ay->sample_left  = ay->sample_ticks;
+    ay->sample_scale = AY_GAIN * 65536.0f / (f32)ay->sample_ticks;
+}
+
+void ay_select(Ay* ay, u8 reg) { ay->selected = reg & 0x0f; }
+
+u8 ay_read(const Ay* ay) { return ay->regs[ay->selected]; }
+
+void ay_write(Ay* ay, u32 t, u8 value)
+{
+    u8 reg = ay->selected;
+    value &= g_reg_masks[reg];
+    ay->regs[reg] = value;
+    if (ay->num_writes < AY_MAX_WRITES) {
+        ay->writes[ay->num_writes++] = (AyWrite){
+            .t     = t,
+            .reg   = reg,
+            .value = value,
+        };
+    }
+}
+
+//------------------------------------------------------------------------------
+// Generators
+//------------------------------------------------------------------------------
+
+static void ay_apply(Ay* ay, u8 reg, u8 value)
+{
+    ay->live[reg] = value;
+    if (reg == AyReg_EnvShape) {
+        // Writing the shape restarts the envelope
+        ay->env_count  = 0;
+        ay->env_step   = 0;
+        ay->env_invert = (value & 4) ? 0 : 15;
+        ay->env_hold   = false;
+    }
+}
+
+static u32 ay_tone_period(const Ay* ay, u32 channel)
+{
+    u32 period = ay->live[channel * 2] | (ay->live[channel * 2 + 1] << 8);
+    return period ? period : 1;
+}
+
+// Move the envelope on one step at the end of its period
+static void ay_step_envelope(Ay* ay)
+{
+    if (ay->env_hold || ++ay->env_step < 16) {
+        return;
+    }
+
+    u8 shape = ay->live[AyReg_EnvShape];
+    if (!(shape & 8)) {
+        // One cycle, then silence
+        ay->env_step   = 0;
+        ay->env_invert = 0;
+        ay->env_hold   = true;
+    } else if (shape & 1) {
+        // One cycle, then hold the last level, or the first if alternating
+        ay->env_step = 15;
+        if (shape & 2) {
+            ay->env_invert ^= 15;
+        }
+        ay->env_hold = true;
+    } else {
+        // Repeat, changing direction each cycle if alternating
+        ay->env_step = 0;
+        if (shape & 2) {
+            ay->env_invert ^= 15;
+        }
+    }
+}
+
+// Run the chip for count steps, storing the channel levels of each
+static void ay_generate(Ay* ay, f32 (*out)[4], u32 count)
+{
+    u32 tone_period[3] = {
+        ay_tone_period(ay, 0),
+        ay_tone_period(ay, 1),
+        ay_tone_period(ay, 2),
+    };
+
+    // Noise and the envelope step at half the tone rate
+    u32 noise_period = ay->live[AyReg_NoisePeriod];
+    u32 env_period = ay->live[AyReg_EnvFine] | (ay->live[AyReg_EnvCoarse] << 8);
+    noise_period   = (noise_period ? noise_period : 1) * 2;
+    env_period     = (env_period ? env_period : 1) * 2;
+
+    // A disabled tone or noise counts as always high
+    u8 mixer        = ay->live[AyReg_Mixer];
+    u8 tone_off[3]  = {mixer & 1, (mixer >> 1) & 1, (mixer >> 2) & 1};
+    u8 noise_off[3] = {(mixer >> 3) & 1, (mixer >> 4) & 1, (mixer >> 5) & 1};
+
+    for (u32 i = 0; i < count; ++i) {
+        for (u32 c = 0; c < 3; ++c) {
+            if (++ay->tone_count[c] >= tone_period[c]) {
+                ay->tone_count[c] = 0;
+                ay->tone_out[c] ^= 1;
+            }
+        }
+        if (++ay->noise_count >= noise_period) {
+            // 17-bit LFSR
+            ay->noise_count = 0;
+            u32 bit         = (ay->noise_lfsr ^ (ay->noise_lfsr >> 3)) & 1;
+            ay->noise_lfsr  = (ay->noise_lfsr >> 1) | (bit << 16);
+        }
+        if (++ay->env_count >= env_period) {
+            ay->env_count = 0;
+            ay_step_envelope(ay);
+        }
+
+        u8 noise = ay->noise_lfsr & 1;
+        u8 env   = ay->env_step ^ ay->env_invert;
+        for (u32 c = 0; c < 3; ++c) {
+            u8 volume = ay->live[AyReg_VolumeA + c];
+            u8 level  = (volume & 0x10) ? env : (volume & 0x0f);
+            u8 tone   = ay->tone_out[c] | tone_off[c];
+            out[i][c] = (tone & (noise | noise_off[c])) ? g_volumes[level] : 0;
+        }
+        out[i][3] = 0.0f;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Downsampling and mixing
+//
+// Each output sample is the average of the chip steps it covers, with the
+// steps at either end weighted by how much of them falls inside it.  There
+// are several steps to a sample, so at most one sample ends in any step.
+//------------------------------------------------------------------------------
+
+#if AY_SSE2
+
+static void ay_downsample(Ay* ay, const f32 (*ticks)[4], u32 count)
+{
+    __m128 sum   = _mm_loadu_ps(ay->sample_sum);
+    __m128 scale = _mm_set1_ps(ay->sample_scale);
+    __m128 left  = _mm_loadu_ps(g_pan_left);
+    __m128 right = _mm_loadu_ps(g_pan_right);
+    u32    todo  = ay->sample_left;
+    f32*   out   = ay->samples + ay->num_samples * 2;
+
+    for (u32 i = 0; i < count; ++i) {
+        __m128 tick = _mm_load_ps(ticks[i]);
+        if (todo > 65536) {
+            sum = _mm_add_ps(sum, tick);
+            todo -= 65536;
+            continue;
+        }
+
+        // The sample ends in this step
+        __m128 part = _mm_set1_ps((f32)todo * (1.0f / 65536.0f));
+        __m128 v = _mm_mul_ps(_mm_add_ps(sum, _mm_mul_ps(tick, part)), scale);
+        sum      = _mm_sub_ps(tick, _mm_mul_ps(tick, part));
+        todo     = ay->sample_ticks - (65536 - todo);
+
+        // (l0 r0 l1 r1) + (l2 r2 l3 r3), then the two halves added
+        __m128 l  = _mm_mul_ps(v, left);
+        __m128 r  = _mm_mul_ps(v, right);
+        __m128 lr = _mm_add_ps(_mm_unpacklo_ps(l, r), _mm_unpackhi_ps(l, r));
+        lr        = _mm_add_ps(lr, _mm_movehl_ps(lr, lr));
+        if (ay->num_samples < AY_MAX_SAMPLES) {
+            _mm_storel_pi((__m64*)out, lr);
+            out += 2;
+            ay->num_samples++;
+        }
+    }
+
+    _mm_storeu_ps(ay->sample_sum, sum);
+    ay->sample_left = todo;
+}
+
+#elif AY_NEON
+
+static void ay_downsample(Ay* ay, const f32 (*ticks)[4], u32 count)
+{
+    float32x4_t sum   = vld1q_f32(ay->sample_sum);
+    float32x4_t left  = vld1q_f32(g_pan_left);
+    float32x4_t right = vld1q_f32(g_pan_right);
+    u32         todo  = ay->sample_left;
+    f32*        out   = ay->samples + ay->num_samples * 2;
+
+    for (u32 i = 0; i < count; ++i) {
+        float32x4_t tick = vld1q_f32(ticks[i]);
+        if (todo > 65536) {
+            sum = vaddq_f32(sum, tick);
+            todo -= 65536;
+            continue;
+        }
+
+        // The sample ends in this step
+        f32         part = (f32)todo * (1.0f / 65536.0f);
+        float32x4_t v =
+            vmulq_n_f32(vmlaq_n_f32(sum, tick, part), ay->sample_scale);
+        sum  = vmlsq_n_f32(tick, tick, part);
+        todo = ay->sample_ticks - (65536 - todo);
+
+        // Pairwise adds of (l0 l1 l2 l3) and (r0 r1 r2 r3) down to (l r)
+        float32x4_t l  = vmulq_f32(v, left);
+        float32x4_t r  = vmulq_f32(v, right);
+        float32x4_t lr = vpaddq_f32(l, r);
+        if (ay->num_samples < AY_MAX_SAMPLES) {
+            vst1_f32(out, vget_low_f32(vpaddq_f32(lr, lr)));
+            out += 2;
+            ay->num_samples++;
+        }
+    }
+
+    vst1q_f32(ay->sample_sum, sum);
+    ay->sample_left = todo;
+}
+
+#else
+
+static void ay_downsample(Ay* ay, const f32 (*ticks)[4], u32 count)
+{
+    u32  todo = ay->sample_left;
+    f32* sum  = ay->sample_sum;
+    f32* out  = ay->samples + ay->num_samples * 2;
+
+    for (u32 i = 0; i < count; ++i) {
+        if (todo > 65536) {
+            for (u32 c = 0; c < 4; ++c) {
+                sum[c] += ticks[i][c];
+            }
+            todo -= 65536;
+            continue;
+        }
+
+        // The sample ends in this step
+        f32 part = (f32)todo * (1.0f / 65536.0f);
+        f32 l    = 0.0f;
+        f32 r    = 0.0f;
+        for (u32 c = 0; c < 4; ++c) {
+            f32 v = (sum[c] + ticks[i][c] * part) * ay->sample_scale;
+            l += v * g_pan_left[c];
+            r += v * g_pan_right[c];
+            sum[c] = ticks[i][c] - ticks[i][c] * part;
+        }
+        todo = ay->sample_ticks - (65536 - todo);
+
+        if (ay->num_samples < AY_MAX_SAMPLES) {
+            *out++ = l;
+            *out++ = r;
+            ay->num_samples++;
+        }
+    }
+
+    ay->sample_left = todo;
+}
+
+#endif
+
+// Run the chip for count steps and downsample them
+static void ay_render(Ay* ay, u32 count)
+{
+    while (count > 0) {
+        u32 n = count < AY_CHUNK_TICKS ? count : AY_CHUNK_TICKS;
+        ay_generate(ay, ay->ticks, n);
+        ay_downsample(ay, (const f32(*)[4])ay->ticks, n);
+        count -= n;
+    }
+}
+
+void ay_end_frame(Ay* ay, u32 frame_tstates)
+{
+    ay->num_samples = 0;
+
+    // Render up to each write in turn
+    u32 tick = 0;
+    u32 kept = 0;
+    for (u32 i = 0; i < ay->num_writes; ++i) {
+        AyWrite w = ay->writes[i];
+        if (w.t >= frame_tstates) {
+            w.t -= frame_tstates;
+            ay->writes[kept++] = w;
+            continue;
+        }
+        u32 at = (u32)((ay->start + w.t * ay->tick_step) >> 32);
+        if (at > tick) {
+            ay_render(ay, at - tick);
+            tick = at;
+        }
+        ay_apply(ay, w.reg, w.value);
+    }
+    ay->num_writes = kept;
+
+    u64 end = ay->start + frame_tstates * ay->tick_step;
+    ay_render(ay, (u32)(end >> 32) - tick);
+    ay->start = end & 0xffffffffull;
+
+    // The chip's output is never negative, so take out the DC
+    for (u32 i = 0; i < ay->num_samples * 2; i += 2) {
+        for (u32 c = 0; c < 2; ++c) {
+            f32 in             = ay->samples[i + c];
+            ay->dc_out[c]      = in - ay->dc_in[c] + AY_DC_POLE * ay->dc_out[c];
+            ay->dc_in[c]       = in;
+            ay->samples[i + c] = ay->dc_out[c];
+        }
+    }
+}
+
+void ay_save(const Ay* ay, AyState* state)
+{
+    memcpy(state->regs, ay->regs, sizeof(state->regs));
+    memcpy(state->live, ay->live, sizeof(state->live));
+    memcpy(state->tone_count, ay->tone_count, sizeof(state->tone_count));
+    memcpy(state->tone_out, ay->tone_out, sizeof(state->tone_out));
+    memcpy(state->sample_sum, ay->sample_sum, sizeof(state->sample_sum));
+    memcpy(state->dc_in, ay->dc_in, sizeof(state->dc_in));
+    memcpy(state->dc_out, ay->dc_out, sizeof(state->dc_out));
+    state->selected    = ay->selected;
+    state->noise_count = ay->noise_count;
+    state->noise_lfsr  = ay->noise_lfsr;
+    state->env_count   = ay->env_count;
+    state->env_step    = ay->env_step;
+    state->env_invert  = ay->env_invert;
+    state->env_hold    = ay->env_hold;
+    state->start       = ay->start;
+    state->sample_left = ay->sample_left;
+
+    u32 n = ay->num_writes < AY_STATE_WRITES ? ay->num_writes : AY_STATE_WRITES;
+    memcpy(state->writes, ay->writes, n * sizeof(AyWrite));
+    state->num_writes = n;
+}
+
+void ay_restore(Ay* ay, const AyState* state)
+{
+    memcpy(ay->regs, state->regs, sizeof(ay->regs));
+    memcpy(ay->live, state->live, sizeof(ay->live));
+    memcpy(ay->tone_count, state->tone_count, sizeof(ay->tone_count));
+    memcpy(ay->tone_out, state->tone_out, sizeof(ay->tone_out));
+    memcpy(ay->sample_sum, state->sample_sum, sizeof(ay->sample_sum));
+    memcpy(ay->dc_in, state->dc_in, sizeof(ay->dc_in));
+    memcpy(ay->dc_out, state->dc_out, sizeof(ay->dc_out));
+    ay->selected    = state->selected;
+    ay->noise_count = state->noise_count;
+    ay->noise_lfsr  = state->noise_lfsr;
+    ay->env_count   = state->env_count;
+    ay->env_step    = state->env_step;
+    ay->env_invert  = state->env_invert;
+    ay->env_hold    = state->env_hold;
+    ay->start       = state->start;
+    ay->sample_left = state->sample_left;
+
+    memcpy(ay->writes, state->writes, state->num_writes * sizeof(AyWrite));
+    ay->num_writes = state->num_writes;
+}
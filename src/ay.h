@@ -0,0 +1,123 @@
+//------------------------------------------------------------------------------
+// AY-3-8912 sound chip
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "kore.h"
+
+// The 128K models have an AY-3-8912 on ports 0xFFFD (register select, and
+// read) and 0xBFFD (register write).  Its three tone generators, the noise
+// generator and the envelope are stepped at the chip's internal rate of
+// clock / 8.
+//
+// Register writes aren't applied when the CPU makes them.  They are queued
+// with their T-state, and ay_end_frame renders the whole frame's block of
+// audio in one go, applying each write when the chip reaches its time.  The
+// chip's output is box-filtered down to the sample rate and mixed to ABC
+// stereo, all three channels at a time in SIMD registers.
+//
+// An Ay has no global state, so any number of them can run side by side.
+
+#define AY_NUM_REGS 16
+
+// More register writes than this in one frame are ignored
+#define AY_MAX_WRITES 4096
+
+// Enough samples for a frame at up to 96kHz
+#define AY_MAX_SAMPLES 2048
+
+// Chip steps rendered at a time before downsampling
+#define AY_CHUNK_TICKS 256
+
+typedef struct {
+    u32 t;     // T-state of the write from the start of the frame
+    u8  reg;
+    u8  value;
+} AyWrite;
+
+typedef struct {
+    u8 regs[AY_NUM_REGS]; // As the CPU sees them
+    u8 selected;          // Register selected by port 0xFFFD
+
+    // Registers as the chip has reached them while rendering
+    u8 live[AY_NUM_REGS];
+
+    // Generators
+    u32  tone_count[3];
+    u8   tone_out[3];
+    u32  noise_count;
+    u32  noise_lfsr;
+    u32  env_count;
+    u8   env_step;   // 0-15 through the current cycle
+    u8   env_invert; // 0 for a rising cycle, 15 for a falling one
+    bool env_hold;
+
+    AyWrite writes[AY_MAX_WRITES];
+    u32     num_writes;
+
+    // Chip steps per T-state, and the position of the frame start in steps,
+    // both 32.32 fixed point
+    u64 tick_step;
+    u64 start;
+
+    // Downsampler: chip steps per output sample and the steps still to go in
+    // the current sample, 16.16 fixed point, and the sum of the sample so far
+    // (A, B, C, unused)
+    u32 sample_ticks;
+    u32 sample_left;
+    f32 sample_sum[4];
+    f32 sample_scale; // 1 / sample_ticks, with the mixing gain
+
+    f32 dc_in[2]; // DC blocker state, left and right
+    f32 dc_out[2];
+
+    _Alignas(16) f32 ticks[AY_CHUNK_TICKS][4]; // Channel levels of each step
+
+    f32 samples[AY_MAX_SAMPLES * 2]; // Stereo output of the last frame
+    u32 num_samples;
+} Ay;
+
+// Writes past the end of a frame that a saved state keeps.  Only the
+// instruction that overruns the frame can make them.
+#define AY_STATE_WRITES 4
+
+// What a saved state keeps of the chip, between frames: the registers, the
+// generators and the filters, without the buffers
+typedef struct {
+    u8   regs[AY_NUM_REGS];
+    u8   selected;
+    u8   live[AY_NUM_REGS];
+    u32  tone_count[3];
+    u8   tone_out[3];
+    u32  noise_count;
+    u32  noise_lfsr;
+    u32  env_count;
+    u8   env_step;
+    u8   env_invert;
+    bool env_hold;
+    u64  start;
+    u32  sample_left;
+    f32  sample_sum[4];
+    f32  dc_in[2];
+    f32  dc_out[2];
+
+    AyWrite writes[AY_STATE_WRITES];
+    u32     num_writes;
+} AyState;
+
+// clock_hz is the AY's clock, cpu_hz the clock the write times are counted in
+void ay_init(Ay* ay, u32 clock_hz, u32 cpu_hz, u32 sample_rate);
+
+void ay_select(Ay* ay, u8 reg);
+u8   ay_read(const Ay* ay);
+
+// Write value to the selected register at time t of the frame
+void ay_write(Ay* ay, u32 t, u8 value);
+
+// Render the frame's audio into samples[0..num_samples * 2).  Writes after
+// frame_tstates are kept for the next frame.
+void ay_end_frame(Ay* ay, u32 frame_tstates);
+
+void ay_save(const Ay* ay, AyState* state);
+void ay_restore(Ay* ay, const AyState* state);
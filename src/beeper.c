@@ -0,0 +1,163 @@
+//------------------------------------------------------------------------------
+// Beeper sound
+//------------------------------------------------------------------------------
+
+#include "beeper.h"
+
+#include <math.h>
+#include <string.h>
+
+// Output level for each combination of EAR (bit 1) and MIC (bit 0).  MIC on its
+// own is barely audible through the speaker.
+static const f32 g_levels[4] = {0.0f, 0.05f, 0.5f, 0.55f};
+
+// Pole of the DC blocker, a high-pass filter at about 8Hz
+#define BEEPER_DC_POLE 0.999f
+
+static f32  g_kernel[BEEPER_PHASES][BEEPER_TAPS];
+static bool g_kernel_ready = false;
+
+// Windowed sinc impulses, one per sub-sample phase, each summing to 1 so the
+// integrated step reaches the full level
+static void beeper_build_kernel(void)
+{
+    const f64 pi     = 3.14159265358979323846;
+    const f64 cutoff = 0.9; // Of the Nyquist frequency
+
+    for (u32 p = 0; p < BEEPER_PHASES; ++p) {
+        f64 offset = (f64)p / BEEPER_PHASES;
+        f64 sum    = 0.0;
+        for (u32 i = 0; i < BEEPER_TAPS; ++i) {
+            f64 x    = (f64)i - BEEPER_TAPS / 2 + 1 - offset;
+            f64 arg  = pi * cutoff * x;
+            f64 sinc = x == 0.0 ? 1.0 : sin(arg) / arg;
+
+            // Blackman window across the kernel
+            f64 w = 2.0 * pi * (x + BEEPER_TAPS / 2) / BEEPER_TAPS;
+            f64 window = 0.42 - 0.5 * cos(w) + 0.08 * cos(2.0 * w);
+
+            g_kernel[p][i] = (f32)(sinc * window);
+            sum += sinc * window;
+        }
+        for (u32 i = 0; i < BEEPER_TAPS; ++i) {
+            g_kernel[p][i] = (f32)(g_kernel[p][i] / sum);
+        }
+    }
+    g_kernel_ready = true;
+}
+
+void beeper_init(Beeper* beeper, u32 clock_hz, u32 sample_rate)
+{
+    if (!g_kernel_ready) {
+        beeper_build_kernel();
+    }
+    memset(beeper, 0, sizeof(*beeper));
+    beeper->step = ((u64)sample_rate << 32) / clock_hz;
+}
+
+void beeper_write(Beeper* beeper, u32 t, u8 value)
+{
+    u8 bits = (value >> 3) & 3;
+    if (bits == beeper->bits) {
+        return;
+    }
+    f32 level    = g_levels[bits];
+    beeper->bits = bits;
+    if (beeper->num_edges < BEEPER_MAX_EDGES) {
+        beeper->edges[beeper->num_edges++] = (BeeperEdge){
+            .t     = t,
+            .delta = level - beeper->level,
+        };
+        beeper->level = level;
+    }
+}
+
+// Add the band-limited impulse of an edge at sample position pos (32.32)
+static void beeper_add_edge(Beeper* beeper, u64 pos, f32 delta)
+{
+    u32        index  = (u32)(pos >> 32);
+    u32        phase  = (u32)(pos >> 27) & (BEEPER_PHASES - 1);
+    const f32* kernel = g_kernel[phase];
+    f32*       out    = beeper->impulses + index;
+    for (u32 i = 0; i < BEEPER_TAPS; ++i) {
+        out[i] += kernel[i] * delta;
+    }
+}
+
+void beeper_end_frame(Beeper* beeper, u32 frame_tstates)
+{
+    u32 kept = 0;
+    for (u32 i = 0; i < beeper->num_edges; ++i) {
+        BeeperEdge e = beeper->edges[i];
+        if (e.t >= frame_tstates) {
+            e.t -= frame_tstates;
+            beeper->edges[kept++] = e;
+            continue;
+        }
+        beeper_add_edge(beeper, beeper->start + e.t * beeper->step, e.delta);
+    }
+    beeper->num_edges = kept;
+
+    // Integrate the impulses of every sample that has finished
+    u64 end   = beeper->start + frame_tstates * beeper->step;
+    u32 count = (u32)(end >> 32);
+    if (count > BEEPER_MAX_SAMPLES) {
+        count = BEEPER_MAX_SAMPLES;
+    }
+
+    f32 sum    = beeper->sum;
+    f32 dc_in  = beeper->dc_in;
+    f32 dc_out = beeper->dc_out;
+    for (u32 i = 0; i < count; ++i) {
+        sum += beeper->impulses[i];
+        dc_out             = sum - dc_in + BEEPER_DC_POLE * dc_out;
+        dc_in              = sum;
+        beeper->samples[i] = dc_out;
+    }
+    beeper->sum         = sum;
+    beeper->dc_in       = dc_in;
+    beeper->dc_out      = dc_out;
+    beeper->num_samples = count;
+
+    // The tails of the last edges belong to the next frame
+    memmove(beeper->impulses,
+            beeper->impulses + count,
+            BEEPER_TAPS * sizeof(f32));
+    memset(beeper->impulses + BEEPER_TAPS,
+           0,
+           BEEPER_MAX_SAMPLES * sizeof(f32));
+    beeper->start = end - ((u64)count << 32);
+}
+
+void beeper_save(const Beeper* beeper, BeeperState* state)
+{
+    state->start  = beeper->start;
+    state->level  = beeper->level;
+    state->bits   = beeper->bits;
+    state->sum    = beeper->sum;
+    state->dc_in  = beeper->dc_in;
+    state->dc_out = beeper->dc_out;
+    memcpy(state->tail, beeper->impulses, sizeof(state->tail));
+
+    u32 n = beeper->num_edges < BEEPER_STATE_EDGES ? beeper->num_edges
+                                                   : BEEPER_STATE_EDGES;
+    memcpy(state->edges, beeper->edges, n * sizeof(BeeperEdge));
+    state->num_edges = n;
+}
+
+void beeper_restore(Beeper* beeper, const BeeperState* state)
+{
+    beeper->start  = state->start;
+    beeper->level  = state->level;
+    beeper->bits   = state->bits;
+    beeper->sum    = state->sum;
+    beeper->dc_in  = state->dc_in;
+    beeper->dc_out = state->dc_out;
+    memcpy(beeper->impulses, state->tail, sizeof(state->tail));
+    memset(beeper->impulses + BEEPER_TAPS,
+           0,
+           BEEPER_MAX_SAMPLES * sizeof(f32));
+
+    memcpy(beeper->edges, state->edges, state->num_edges * sizeof(BeeperEdge));
+    beeper->num_edges = state->num_edges;
+}
@@ -0,0 +1,82 @@
+//------------------------------------------------------------------------------
+// Beeper sound
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "kore.h"
+
+// The beeper is driven by the EAR and MIC bits of port 0xFE.  Rather than
+// sampling the level every T-state, each change is recorded with its time, and
+// at the end of the frame every change is added to the output as a
+// band-limited step (BLEP): a step smoothed by a windowed sinc so that it has
+// nothing above the output's Nyquist frequency to alias.  Synthesis costs
+// BEEPER_TAPS multiply-adds per edge plus one add per output sample, however
+// many T-states the frame has.
+
+// Band-limited step kernel: BEEPER_PHASES sub-sample positions of BEEPER_TAPS
+// samples each.  The output is delayed by BEEPER_TAPS / 2 samples.
+#define BEEPER_PHASES 32
+#define BEEPER_TAPS 16
+
+// More edges than this in one frame are ignored.  A tight OUT loop manages
+// about 6400 a frame.
+#define BEEPER_MAX_EDGES 8192
+
+// Enough samples for a frame at up to 96kHz
+#define BEEPER_MAX_SAMPLES 2048
+
+typedef struct {
+    u32 t;     // Time of the change in T-states from the start of the frame
+    f32 delta; // Change in level
+} BeeperEdge;
+
+typedef struct {
+    u64 step;  // Output samples per T-state, 32.32 fixed point
+    u64 start; // Position of the frame start in samples, 32.32 fixed point
+    f32 level; // Current output level
+    u8  bits;  // Last EAR and MIC bits written
+
+    BeeperEdge edges[BEEPER_MAX_EDGES];
+    u32        num_edges;
+
+    // Impulses added by the edges, integrated into samples at the end of the
+    // frame.  The last BEEPER_TAPS carry over into the next frame.
+    f32 impulses[BEEPER_MAX_SAMPLES + BEEPER_TAPS];
+    f32 sum;     // Integrator
+    f32 dc_in;   // DC blocker state
+    f32 dc_out;
+
+    f32 samples[BEEPER_MAX_SAMPLES]; // Mono output of the last frame
+    u32 num_samples;
+} Beeper;
+
+// Edges past the end of a frame that a saved state keeps
+#define BEEPER_STATE_EDGES 4
+
+// What a saved state keeps of the beeper, between frames: the level, the
+// filters and the tails of the last frame's edges
+typedef struct {
+    u64 start;
+    f32 level;
+    u8  bits;
+    f32 sum;
+    f32 dc_in;
+    f32 dc_out;
+    f32 tail[BEEPER_TAPS];
+
+    BeeperEdge edges[BEEPER_STATE_EDGES];
+    u32        num_edges;
+} BeeperState;
+
+void beeper_init(Beeper* beeper, u32 clock_hz, u32 sample_rate);
+
+// Port 0xFE was written with value at time t of the frame
+void beeper_write(Beeper* beeper, u32 t, u8 value);
+
+// Synthesise the frame's edges into samples[0..num_samples).  Edges after
+// frame_tstates are kept for the next frame.
+void beeper_end_frame(Beeper* beeper, u32 frame_tstates);
+
+void beeper_save(const Beeper* beeper, BeeperState* state);
+void beeper_restore(Beeper* beeper, const BeeperState* state);
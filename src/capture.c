@@ -0,0 +1,132 @@
+//------------------------------------------------------------------------------
+// Audio capture
+//------------------------------------------------------------------------------
+
+#include "capture.h"
+
+#include <string.h>
+
+#define CAPTURE_FNV_OFFSET 0xcbf29ce484222325ull
+#define CAPTURE_FNV_PRIME 0x100000001b3ull
+
+// Size of the RIFF, fmt and data chunk headers
+#define CAPTURE_WAV_HEADER_SIZE 44
+
+static void capture_put_u16(u8* p, u16 value)
+{
+    p[0] = (u8)value;
+    p[1] = (u8)(value >> 8);
+}
+
+static void capture_put_u32(u8* p, u32 value)
+{
+    capture_put_u16(p, (u16)value);
+    capture_put_u16(p + 2, (u16)(value >> 16));
+}
+
+// The sizes are only known at the end, so this is written twice
+static bool capture_write_wav_header(Capture* capture)
+{
+    u64 bytes = capture->frames * 4;
+    u32 data  = bytes > 0xffffffffu - 36 ? 0xffffffffu - 36 : (u32)bytes;
+
+    u8 h[CAPTURE_WAV_HEADER_SIZE];
+    memcpy(h, "RIFF", 4);
+    capture_put_u32(h + 4, 36 + data);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    capture_put_u32(h + 16, 16);                       // fmt chunk size
+    capture_put_u16(h + 20, 1);                        // PCM
+    capture_put_u16(h + 22, 2);                        // Channels
+    capture_put_u32(h + 24, capture->sample_rate);     // Sample rate
+    capture_put_u32(h + 28, capture->sample_rate * 4); // Bytes per second
+    capture_put_u16(h + 32, 4);                        // Bytes per frame
+    capture_put_u16(h + 34, 16);                       // Bits per sample
+    memcpy(h + 36, "data", 4);
+    capture_put_u32(h + 40, data);
+
+    return fseek(capture->file, 0, SEEK_SET) == 0 &&
+           fwrite(h, sizeof(h), 1, capture->file) == 1;
+}
+
+bool capture_open(Capture*    capture,
+                  CaptureMode mode,
+                  const char* path,
+                  u32         sample_rate)
+{
+    memset(capture, 0, sizeof(*capture));
+    capture->mode        = mode;
+    capture->sample_rate = sample_rate;
+    capture->hash        = CAPTURE_FNV_OFFSET;
+
+    if (mode == CaptureMode_Hash) {
+        return true;
+    }
+
+    capture->file = fopen(path, "wb");
+    if (!capture->file) {
+        $.eprn("Unable to create %s", path);
+        return false;
+    }
+    if (mode == CaptureMode_Wav && !capture_write_wav_header(capture)) {
+        fclose(capture->file);
+        capture->file = NULL;
+        return false;
+    }
+    return true;
+}
+
+// Write the buffer out in one go.  Every host nx runs on is little-endian, as
+// the files are.
+static void capture_flush(Capture* capture)
+{
+    usize count = (usize)capture->buffered * 2;
+    if (fwrite(capture->buffer, sizeof(i16), count, capture->file) != count) {
+        capture->failed = true;
+    }
+    capture->buffered = 0;
+}
+
+void capture_write(Capture* capture, const i16* frames, u32 count)
+{
+    // Hash the bytes of each sample as a raw file holds them, low byte first
+    u64 hash = capture->hash;
+    for (u32 i = 0; i < count * 2; ++i) {
+        u16 sample = (u16)frames[i];
+        hash       = (hash ^ (u8)sample) * CAPTURE_FNV_PRIME;
+        hash       = (hash ^ (u8)(sample >> 8)) * CAPTURE_FNV_PRIME;
+    }
+    capture->hash = hash;
+    capture->frames += count;
+
+    if (!capture->file) {
+        return;
+    }
+    while (count > 0) {
+        u32 space = CAPTURE_BUFFER_FRAMES - capture->buffered;
+        u32 n     = count < space ? count : space;
+        memcpy(capture->buffer + capture->buffered * 2,
+               frames,
+               (usize)n * 2 * sizeof(i16));
+        capture->buffered += n;
+        frames += n * 2;
+        count -= n;
+        if (capture->buffered == CAPTURE_BUFFER_FRAMES) {
+            capture_flush(capture);
+        }
+    }
+}
+
+bool capture_close(Capture* capture)
+{
+    if (!capture->file) {
+        return true;
+    }
+    capture_flush(capture);
+    bool ok = !capture->failed;
+    if (capture->mode == CaptureMode_Wav) {
+        ok = capture_write_wav_header(capture) && ok;
+    }
+    ok            = fclose(capture->file) == 0 && ok;
+    capture->file = NULL;
+    return ok;
+}
@@ -0,0 +1,52 @@
+//------------------------------------------------------------------------------
+// Audio capture
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "kore.h"
+
+// A sink for the emulator's sound when there is no audio device, to check
+// it against golden files.  Samples are written as fast as they are made, so
+// a headless run renders audio as fast as it can emulate.
+//
+// WAV and raw files are written in large blocks, not a frame at a time.  The
+// hash mode writes nothing and only keeps a hash of the samples, which is far
+// cheaper to compare.  Every mode keeps the hash: the 64-bit FNV-1a of the
+// bytes a raw capture would hold, so any FNV-1a tool gives the same value for
+// the raw file.
+
+typedef enum {
+    CaptureMode_Wav,  // 16-bit stereo WAV
+    CaptureMode_Raw,  // Headerless 16-bit stereo little-endian PCM
+    CaptureMode_Hash, // No file
+
+    CaptureMode_COUNT,
+} CaptureMode;
+
+// Sample frames buffered before a write
+#define CAPTURE_BUFFER_FRAMES 65536
+
+typedef struct {
+    CaptureMode mode;
+    FILE*       file;
+    u32         sample_rate;
+    u64         frames; // Sample frames captured
+    u64         hash;   // FNV-1a of the raw PCM bytes
+    bool        failed; // A write to the file failed
+
+    i16 buffer[CAPTURE_BUFFER_FRAMES * 2];
+    u32 buffered;
+} Capture;
+
+// Start capturing stereo frames at sample_rate.  path is ignored in hash
+// mode.  Returns false if the file can't be created.
+bool capture_open(Capture*    capture,
+                  CaptureMode mode,
+                  const char* path,
+                  u32         sample_rate);
+
+void capture_write(Capture* capture, const i16* frames, u32 count);
+
+// Flush and finish the file.  Returns false if any write failed.
+bool capture_close(Capture* capture);
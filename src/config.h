@@ -25,11 +25,29 @@
 #define WINDOW_HEIGHT 256
 
 // Size of the borders
-#define BORDER_WIDTH ((WINDOW_WIDTH - SCREEN_WIDTH) / 2
-#define BORDER_HEIGHT ((WINDOW_HEIGHT - SCREEN_HEIGHT) / 2
+#define BORDER_WIDTH ((WINDOW_WIDTH - SCREEN_WIDTH) / 2)
+#define BORDER_HEIGHT ((WINDOW_HEIGHT - SCREEN_HEIGHT) / 2)
 
 // The actual size of the UI window in pixels.
 #define UI_WIDTH (WINDOW_WIDTH * 2)
 #define UI_HEIGHT (WINDOW_HEIGHT * 2)
 
 #define DEFAULT_SCALE 3
+
+// 48K timing: a 3.5MHz CPU and 312 lines of 224 T-states each, or 50.08
+// frames a second.  The ULA holds the INT line active for the first 32
+// T-states of the frame.
+#define CPU_CLOCK_HZ 3500000
+#define TSTATES_PER_LINE 224
+#define TSTATES_PER_FRAME (TSTATES_PER_LINE * TV_HEIGHT)
+#define INT_LENGTH 32
+
+// The first T-state at which the ULA contends memory, one before it fetches the
+// top-left pixel of the display
+#define CONTENTION_START 14335
+#define DISPLAY_START 14336
+
+// System variables the ROM's keyboard routine leaves a key in
+#define SYSVAR_LAST_K 0x5c08
+#define SYSVAR_FLAGS 0x5c3b
+#define FLAGS_NEW_KEY 0x20
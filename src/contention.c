@@ -0,0 +1,120 @@
+//------------------------------------------------------------------------------
+// ULA memory contention
+//------------------------------------------------------------------------------
+
+#include "contention.h"
+#include "config.h"
+
+#define FRAME_48K TSTATES_PER_FRAME // 312 lines of 224 T-states
+#define FRAME_128K (228 * 311)      // 70908
+
+static const MachineTiming g_timings[MemoryModel_COUNT] = {
+    [MemoryModel_48K] =
+        {
+            .clock_hz         = CPU_CLOCK_HZ,
+            .frame_tstates    = FRAME_48K,
+            .line_tstates     = TSTATES_PER_LINE,
+            .int_length       = INT_LENGTH,
+            .contention_start = CONTENTION_START,
+            .display_start    = DISPLAY_START,
+            .pattern          = {6, 5, 4, 3, 2, 1, 0, 0},
+            .io_contended     = true,
+        },
+    [MemoryModel_128K] =
+        {
+            .clock_hz         = 3546900,
+            .frame_tstates    = FRAME_128K,
+            .line_tstates     = 228,
+            .int_length       = 36,
+            .contention_start = 14361,
+            .display_start    = 14362,
+            .pattern          = {6, 5, 4, 3, 2, 1, 0, 0},
+            .io_contended     = true,
+        },
+    [MemoryModel_Plus2] =
+        {
+            .clock_hz         = 3546900,
+            .frame_tstates    = FRAME_128K,
+            .line_tstates     = 228,
+            .int_length       = 36,
+            .contention_start = 14361,
+            .display_start    = 14362,
+            .pattern          = {6, 5, 4, 3, 2, 1, 0, 0},
+            .io_contended     = true,
+        },
+
+    // The +3's gate array starts contending later, with its own pattern, and
+    // never holds up I/O
+    [MemoryModel_Plus3] =
+        {
+            .clock_hz         = 3546900,
+            .frame_tstates    = FRAME_128K,
+            .line_tstates     = 228,
+            .int_length       = 32,
+            .contention_start = 14365,
+            .display_start    = 14366,
+            .pattern          = {1, 0, 7, 6, 5, 4, 3, 2},
+        },
+
+    // The CPU tests run on a 48K frame with nothing contended
+    [MemoryModel_Ram64] =
+        {
+            .clock_hz      = CPU_CLOCK_HZ,
+            .frame_tstates = FRAME_48K,
+            .line_tstates  = TSTATES_PER_LINE,
+            .int_length    = INT_LENGTH,
+            .display_start = DISPLAY_START,
+        },
+};
+
+// The 128K and +2 share a table.  The +3's I/O uses the zeros.
+static u8 g_table_48k[FRAME_48K + CONTENTION_OVERRUN];
+static u8 g_table_128k[FRAME_128K + CONTENTION_OVERRUN];
+static u8 g_table_plus3[FRAME_128K + CONTENTION_OVERRUN];
+static u8 g_table_none[FRAME_128K + CONTENTION_OVERRUN];
+
+static u8* const g_tables[MemoryModel_COUNT] = {
+    [MemoryModel_48K]   = g_table_48k,
+    [MemoryModel_128K]  = g_table_128k,
+    [MemoryModel_Plus2] = g_table_128k,
+    [MemoryModel_Plus3] = g_table_plus3,
+    [MemoryModel_Ram64] = NULL,
+};
+
+static bool g_built[MemoryModel_COUNT];
+
+// Each of the 192 display lines has 128 T-states of the model's delay pattern,
+// and the rest of the frame has none.  The table starts zeroed.
+static void contention_build(u8* table, const MachineTiming* timing)
+{
+    for (u32 line = 0; line < SCREEN_HEIGHT; ++line) {
+        u32 start = timing->contention_start + line * timing->line_tstates;
+        for (u32 t = 0; t < 128 && start + t < timing->frame_tstates; ++t) {
+            table[start + t] = timing->pattern[t & 7];
+        }
+    }
+}
+
+const MachineTiming* contention_timing(MemoryModel model)
+{
+    return &g_timings[model];
+}
+
+const u8* contention_table(MemoryModel model)
+{
+    u8* table = g_tables[model];
+    if (table && !g_built[model]) {
+        contention_build(table, &g_timings[model]);
+        g_built[model] = true;
+    }
+    return table;
+}
+
+void contention_attach(Z80* z, MemoryModel model)
+{
+    z->contention    = contention_table(model);
+    z->io_contention = z->contention;
+    if (z->contention && !g_timings[model].io_contended) {
+        z->io_contention = g_table_none;
+    }
+}
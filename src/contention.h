@@ -0,0 +1,39 @@
+//------------------------------------------------------------------------------
+// ULA memory contention
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "memory.h"
+#include "z80.h"
+
+// While the ULA is fetching the display, a CPU access to contended memory or
+// I/O waits until the ULA lets go of the bus.  How long depends only on the
+// T-state within the frame, so each model has a table with the delay for
+// every T-state of its frame, built once.  A contended access then costs one
+// lookup.  Which addresses are contended comes from the memory map (see
+// mem_contended).
+typedef struct {
+    u32  clock_hz;         // CPU clock
+    u32  frame_tstates;    // T-states per frame
+    u32  line_tstates;     // T-states per line
+    u32  int_length;       // T-states the INT line is held active
+    u32  contention_start; // First contended T-state
+    u32  display_start;    // T-state the top-left display pixel is fetched
+    u8   pattern[8];       // Delays through each 8 T-states of display fetch
+    bool io_contended;     // I/O waits for the ULA as memory does
+} MachineTiming;
+
+const MachineTiming* contention_timing(MemoryModel model);
+
+// A run stops at the first instruction boundary at or after its end, so the
+// last instruction of a frame can go past it by its own length and delays.
+// The tables carry on with this many zeros, so they are never bounds checked.
+#define CONTENTION_OVERRUN 256
+
+// The model's delay table, timing->frame_tstates + CONTENTION_OVERRUN entries
+// long, or NULL if nothing is contended
+const u8* contention_table(MemoryModel model);
+
+// Have the CPU apply the model's contention
+void contention_attach(Z80* z, MemoryModel model);
@@ -0,0 +1,114 @@
+//------------------------------------------------------------------------------
+// Read-only file mapping
+//------------------------------------------------------------------------------
+
+#include "filemap.h"
+
+#include <string.h>
+
+#if !KORE_OS_WINDOWS
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#if KORE_OS_WINDOWS
+
+bool filemap_open(FileMap* map, const char* path)
+{
+    memset(map, 0, sizeof(*map));
+
+    HANDLE file = CreateFileA(path,
+                              GENERIC_READ,
+                              FILE_SHARE_READ,
+                              NULL,
+                              OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL,
+                              NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+    if (size.QuadPart == 0) {
+        CloseHandle(file);
+        return true;
+    }
+
+    // The mapping keeps the file open, so its handle can go now
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) {
+        return false;
+    }
+
+    const u8* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    map->data    = data;
+    map->size    = (usize)size.QuadPart;
+    map->mapping = mapping;
+    return true;
+}
+
+void filemap_close(FileMap* map)
+{
+    if (map->data) {
+        UnmapViewOfFile(map->data);
+    }
+    if (map->mapping) {
+        CloseHandle(map->mapping);
+    }
+    memset(map, 0, sizeof(*map));
+}
+
+#else
+
+bool filemap_open(FileMap* map, const char* path)
+{
+    memset(map, 0, sizeof(*map));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    // The mapping keeps the file open, so the descriptor can go now
+    void* data = mmap(NULL, (usize)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    map->data = data;
+    map->size = (usize)st.st_size;
+    return true;
+}
+
+void filemap_close(FileMap* map)
+{
+    if (map->data) {
+        munmap((void*)map->data, map->size);
+    }
+    memset(map, 0, sizeof(*map));
+}
+
+#endif
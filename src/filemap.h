@@ -0,0 +1,21 @@
+//------------------------------------------------------------------------------
+// Read-only file mapping
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "kore.h"
+
+// A whole file mapped into memory, read-only.  Loaders parse tapes and
+// snapshots in place instead of reading them into a buffer first, so opening
+// one costs a system call or two and pages are only read when touched.
+typedef struct {
+    const u8* data;
+    usize     size;
+    void*     mapping; // The Windows file mapping object
+} FileMap;
+
+// Returns false if the file can't be opened or mapped.  An empty file maps
+// to no data.
+bool filemap_open(FileMap* map, const char* path);
+void filemap_close(FileMap* map);
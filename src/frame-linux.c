@@ -6,24 +6,177 @@
 
 #if KORE_OS_LINUX
 
-#    include "window.h"
+#    include "frame.h"
 
+#    include <X11/XKBlib.h>
 #    include <X11/Xatom.h>
+#    include <X11/keysym.h>
 #    include <stdlib.h>
+#    include <sys/ipc.h>
+#    include <sys/shm.h>
 
 static Atom g_wm_delete_window = None;
+static bool g_shm_failed       = false;
+
+static Bool frame_is_shm_completion(Display* display,
+                                    XEvent*  event,
+                                    XPointer p)
+{
+    (void)display;
+    return event->type == ((Frame*)p)->shm_completion;
+}
+
+// Wait until the server has finished reading the shared image, so it can be
+// drawn into or freed
+static void frame_wait_shm(Frame* f)
+{
+    if (f->shm_busy) {
+        XEvent event;
+        XIfEvent(f->display, &event, frame_is_shm_completion, (XPointer)f);
+        f->shm_busy = false;
+    }
+}
+
+static void frame_destroy_image(Frame* f)
+{
+    if (!f->image) {
+        return;
+    }
+    if (f->use_shm) {
+        frame_wait_shm(f);
+        XShmDetach(f->display, &f->shm);
+        XSync(f->display, False);
+        shmdt(f->shm.shmaddr);
+        f->use_shm = false;
+    } else {
+        free(f->image->data);
+    }
+    f->image->data = NULL; // Prevent double free
+    XDestroyImage(f->image);
+    f->image = nullptr;
+}
+
+static int frame_shm_error(Display* display, XErrorEvent* error)
+{
+    (void)display;
+    (void)error;
+    g_shm_failed = true;
+    return 0;
+}
+
+// Put the image in shared memory, so presenting it doesn't copy the pixels
+// through the X connection.  Only works with a local server.
+static bool frame_create_shm_image(Frame* f)
+{
+    if (!XShmQueryExtension(f->display)) {
+        return false;
+    }
+
+    int screen_num = DefaultScreen(f->display);
+    f->image       = XShmCreateImage(f->display,
+                               DefaultVisual(f->display, screen_num),
+                               DefaultDepth(f->display, screen_num),
+                               ZPixmap,
+                               NULL,
+                               &f->shm,
+                               f->width,
+                               f->height);
+    if (!f->image) {
+        return false;
+    }
+
+    usize size   = (usize)f->image->bytes_per_line * f->image->height;
+    f->shm.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (f->shm.shmid < 0) {
+        XDestroyImage(f->image);
+        f->image = nullptr;
+        return false;
+    }
+    f->shm.shmaddr  = (char*)shmat(f->shm.shmid, NULL, 0);
+    f->shm.readOnly = False;
+
+    // A remote server can't attach, and only says so with an error later on
+    bool attached = false;
+    if (f->shm.shmaddr != (char*)-1) {
+        g_shm_failed              = false;
+        XErrorHandler old_handler = XSetErrorHandler(frame_shm_error);
+        XShmAttach(f->display, &f->shm);
+        XSync(f->display, False);
+        XSetErrorHandler(old_handler);
+        attached = !g_shm_failed;
+    }
+
+    // The segment is freed once both sides have detached
+    shmctl(f->shm.shmid, IPC_RMID, NULL);
+
+    if (!attached) {
+        if (f->shm.shmaddr != (char*)-1) {
+            shmdt(f->shm.shmaddr);
+        }
+        f->image->data = NULL;
+        XDestroyImage(f->image);
+        f->image = nullptr;
+        return false;
+    }
+
+    f->image->data    = f->shm.shmaddr;
+    f->use_shm        = true;
+    f->shm_busy       = false;
+    f->shm_completion = XShmGetEventBase(f->display) + ShmCompletion;
+    return true;
+}
+
+// The layers are composited and scaled straight into an image the size of the
+// window: in shared memory if possible, or else in our own memory and copied
+// to the server every frame
+static bool frame_create_image(Frame* f)
+{
+    if (!frame_create_shm_image(f)) {
+        int   screen_num = DefaultScreen(f->display);
+        char* pixels     = (char*)malloc((size_t)f->width * f->height * 4);
+        if (!pixels) {
+            fprintf(stderr, "Failed to allocate memory for image pixels\n");
+            return false;
+        }
+        f->image = XCreateImage(f->display,
+                                DefaultVisual(f->display, screen_num),
+                                DefaultDepth(f->display, screen_num),
+                                ZPixmap,
+                                0,
+                                pixels,
+                                f->width,
+                                f->height,
+                                32,
+                                0);
+        if (f->image == NULL) {
+            fprintf(stderr, "Failed to create XImage\n");
+            free(pixels);
+            return false;
+        }
+    }
+
+    gfx_set_target((u32*)f->image->data,
+                   f->width,
+                   f->height,
+                   f->image->bytes_per_line / 4);
+    return true;
+}
 
 static void frame_cleanup(Frame* f)
 {
     if (!f) {
         return;
     }
+
+    // Destroy layers
+    for (u64 i = 0; i < array_length(f->layers); ++i) {
+        gfx_layer_destroy(f->layers[i]);
+    }
+    array_free(f->layers);
+    gfx_shutdown();
+
     if (f->display) {
-        if (f->image) {
-            f->image->data = NULL; // Prevent double free
-            XDestroyImage(f->image);
-            f->image = nullptr;
-        }
+        frame_destroy_image(f);
         if (f->gc) {
             XFreeGC(f->display, f->gc);
             f->gc = nullptr;
@@ -37,117 +190,185 @@ static void frame_cleanup(Frame* f)
     }
 }
 
-void frame_open(Frame* f)
+Frame frame_open(int width, int height, const char* title)
 {
-    f->display = XOpenDisplay(NULL);
-    if (f->display == NULL) {
+    Frame f   = {0};
+    f.title   = title;
+    f.width   = width;
+    f.height  = height;
+
+    f.display = XOpenDisplay(NULL);
+    if (f.display == NULL) {
         fprintf(stderr, "Failed to open X display\n");
         exit(EXIT_FAILURE);
     }
 
-    int screen_num = DefaultScreen(f->display);
-    int win_w      = f->width * f->scale;
-    int win_h      = f->height * f->scale;
-    f->window      = XCreateSimpleWindow(f->display,
-                                    RootWindow(f->display, screen_num),
-                                    0,
-                                    0,
-                                    win_w,
-                                    win_h,
-                                    1,
-                                    BlackPixel(f->display, screen_num),
-                                    WhitePixel(f->display, screen_num));
-
-    XStoreName(f->display, f->window, f->title);
-    XSelectInput(f->display,
-                 f->window,
+    int screen_num = DefaultScreen(f.display);
+    f.window       = XCreateSimpleWindow(f.display,
+                                   RootWindow(f.display, screen_num),
+                                   0,
+                                   0,
+                                   width,
+                                   height,
+                                   1,
+                                   BlackPixel(f.display, screen_num),
+                                   WhitePixel(f.display, screen_num));
+
+    XStoreName(f.display, f.window, title);
+    XSelectInput(f.display,
+                 f.window,
                  ExposureMask | KeyPressMask | KeyReleaseMask |
-                     ButtonPressMask | ButtonReleaseMask | PointerMotionMask);
-    g_wm_delete_window = XInternAtom(f->display, "WM_DELETE_WINDOW", False);
-    XSetWMProtocols(f->display, f->window, &g_wm_delete_window, 1);
+                     ButtonPressMask | ButtonReleaseMask | PointerMotionMask |
+                     StructureNotifyMask);
+    // Report a held key as repeated presses rather than release and press
+    XkbSetDetectableAutoRepeat(f.display, True, NULL);
 
-    XMapWindow(f->display, f->window);
+    g_wm_delete_window = XInternAtom(f.display, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(f.display, f.window, &g_wm_delete_window, 1);
 
-    f->gc = XCreateGC(f->display, f->window, 0, NULL);
-    XSync(f->display, f->window);
+    XMapWindow(f.display, f.window);
 
-    int   img_w  = win_w;
-    int   img_h  = win_h;
-    char* pixels = (char*)malloc((size_t)img_w * img_h * 4);
-    if (!pixels) {
-        fprintf(stderr, "Failed to allocate memory for image pixels\n");
+    f.gc = XCreateGC(f.display, f.window, 0, NULL);
+    XSync(f.display, False);
+
+    // The image is made by the first draw.  XShmCreateImage keeps a pointer
+    // to f.shm, which must be the caller's Frame and not this copy.
+    if (!gfx_init()) {
+        frame_cleanup(&f);
         exit(EXIT_FAILURE);
     }
-    f->image = XCreateImage(f->display,
-                            DefaultVisual(f->display, screen_num),
-                            DefaultDepth(f->display, screen_num),
-                            ZPixmap,
-                            0,
-                            pixels,
-                            img_w,
-                            img_h,
-                            32,
-                            0);
-    if (f->image == NULL) {
-        fprintf(stderr, "Failed to create XImage\n");
-        free(pixels);
-        exit(EXIT_FAILURE);
+
+    XFlush(f.display);
+    frame_time_begin(&f, FramePhase_Frame);
+    return f;
+}
+
+// Send part of the image to the window
+static void frame_put(Frame* f, int x, int y, int width, int height)
+{
+    frame_wait_shm(f);
+    if (f->use_shm) {
+        XShmPutImage(f->display,
+                     f->window,
+                     f->gc,
+                     f->image,
+                     x,
+                     y,
+                     x,
+                     y,
+                     (unsigned)width,
+                     (unsigned)height,
+                     True);
+        f->shm_busy = true;
+    } else {
+        XPutImage(f->display,
+                  f->window,
+                  f->gc,
+                  f->image,
+                  x,
+                  y,
+                  x,
+                  y,
+                  (unsigned)width,
+                  (unsigned)height);
+    }
+}
+
+// Draw the layers and send the rows that changed to the server.  The image
+// is made here if there isn't one, once the Frame is where it will stay.
+static void win_draw(Frame* f)
+{
+    if (!f->image && !frame_create_image(f)) {
+        return;
     }
 
+    frame_time_begin(f, FramePhase_Present);
+    frame_wait_shm(f);
+    frame_time_end(f, FramePhase_Present);
+
+    frame_time_begin(f, FramePhase_Scale);
+    gfx_render(f->layers, array_length(f->layers), f->width, f->height);
+    frame_time_end(f, FramePhase_Scale);
+
+    int y, h;
+    if (!gfx_get_damage(&y, &h)) {
+        return;
+    }
+    frame_time_begin(f, FramePhase_Present);
+    frame_put(f, 0, y, f->width, h);
     XFlush(f->display);
+    frame_time_end(f, FramePhase_Present);
 }
 
-static void win_draw(Frame* f)
+// Follow the window size, redrawing everything at the new scale
+static void win_resize(Frame* f, int width, int height)
 {
-    if (!f->image) {
+    if (width == f->width && height == f->height) {
         return;
     }
+    f->width  = width;
+    f->height = height;
+    frame_destroy_image(f);
+    if (!frame_create_image(f)) {
+        fprintf(stderr, "Failed to resize the window image\n");
+    }
+}
 
-    const int scale = (f->scale <= 0) ? 1 : f->scale;
-    const int src_w = f->width;
-    const int src_h = f->height;
-    const int dst_w = src_w * scale;
-    // const int dst_h = src_h * scale;
-
-    const u32* src  = (const u32*)f->buf;
-    u32*       dst  = (u32*)f->image->data;
-
-    // Nearest-neighbor scale (pixel replication)
-    for (int y = 0; y < src_h; ++y) {
-        const u32* src_row = src + y * src_w;
-        for (int sy = 0; sy < scale; ++sy) {
-            u32* dst_row = dst + (y * scale + sy) * dst_w;
-            for (int x = 0; x < src_w; ++x) {
-                u32 px = src_row[x];
-                for (int sx = 0; sx < scale; ++sx) {
-                    dst_row[x * scale + sx] = px;
-                }
-            }
+// Pass on a key event if it's a key nx uses.  Both shifts are Shift and both
+// controls Control.
+static void frame_key(Frame* f, XKeyEvent* event)
+{
+    KeySym   sym = XLookupKeysym(event, 0);
+    FrameKey key;
+    if (sym >= XK_0 && sym <= XK_9) {
+        key = (FrameKey)(FrameKey_0 + (sym - XK_0));
+    } else if (sym >= XK_a && sym <= XK_z) {
+        key = (FrameKey)(FrameKey_A + (sym - XK_a));
+    } else {
+        switch (sym) {
+        case XK_BackSpace:
+            key = FrameKey_Backspace;
+            break;
+        case XK_Return:
+            key = FrameKey_Enter;
+            break;
+        case XK_space:
+            key = FrameKey_Space;
+            break;
+        case XK_Shift_L:
+        case XK_Shift_R:
+            key = FrameKey_Shift;
+            break;
+        case XK_Control_L:
+        case XK_Control_R:
+            key = FrameKey_Control;
+            break;
+        default:
+            return;
         }
     }
-
-    XPutImage(f->display,
-              f->window,
-              f->gc,
-              f->image,
-              0,
-              0,
-              0,
-              0,
-              f->image->width,
-              f->image->height);
-    XFlush(f->display);
+    frame_key_event(f, key, event->type == KeyPress);
 }
 
 bool frame_loop(Frame* f)
 {
     XEvent event;
     win_draw(f);
+    frame_time_begin(f, FramePhase_Events);
+    f->num_key_events = 0;
     while (XPending(f->display)) {
         XNextEvent(f->display, &event);
         switch (event.type) {
         case Expose:
-            win_draw(f);
+            // The image still holds the last frame
+            if (f->image) {
+                XExposeEvent* e = &event.xexpose;
+                frame_put(f, e->x, e->y, e->width, e->height);
+            }
+            break;
+
+        case ConfigureNotify:
+            win_resize(f, event.xconfigure.width, event.xconfigure.height);
             break;
 
         case ClientMessage:
@@ -163,7 +384,7 @@ bool frame_loop(Frame* f)
 
         case KeyPress:
         case KeyRelease:
-            // Handle key events if needed
+            frame_key(f, &event.xkey);
             break;
 
         case ButtonPress:
@@ -171,11 +392,36 @@ bool frame_loop(Frame* f)
             break;
 
         default:
+            if (f->use_shm && event.type == f->shm_completion) {
+                f->shm_busy = false;
+            }
             break;
         }
     }
+    frame_time_end(f, FramePhase_Events);
 
     return true; // Continue the loop
 }
 
+// XPutImage has no way to wait for the vertical blank
+bool frame_set_vsync(Frame* f, bool vsync)
+{
+    (void)f;
+    (void)vsync;
+    return false;
+}
+
+u32* frame_add_layer(Frame* f, int width, int height)
+{
+    u32*      pixels = KORE_ARRAY_ALLOC(u32, width * height);
+    GfxLayer* layer  = gfx_layer_create(width, height, pixels);
+    if (!layer) {
+        fprintf(stderr, "Failed to create graphics layer\n");
+        KORE_ARRAY_FREE(pixels);
+        return NULL;
+    }
+    array_add(f->layers, layer);
+    return pixels;
+}
+
 #endif // OS_LINUX
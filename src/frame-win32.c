@@ -141,20 +141,60 @@ Frame frame_open(int width, int height, const char* title)
         exit(EXIT_FAILURE);
     }
 
+    frame_time_begin(&f, FramePhase_Frame);
     return f;
 }
 
+// Pass on a key event if it's a key nx uses.  Digits and letters have their
+// ASCII codes as virtual keys.
+static void frame_key(Frame* f, WPARAM vk, bool down)
+{
+    FrameKey key;
+    if (vk >= '0' && vk <= '9') {
+        key = (FrameKey)(FrameKey_0 + (vk - '0'));
+    } else if (vk >= 'A' && vk <= 'Z') {
+        key = (FrameKey)(FrameKey_A + (vk - 'A'));
+    } else {
+        switch (vk) {
+        case VK_BACK:
+            key = FrameKey_Backspace;
+            break;
+        case VK_RETURN:
+            key = FrameKey_Enter;
+            break;
+        case VK_SPACE:
+            key = FrameKey_Space;
+            break;
+        case VK_SHIFT:
+            key = FrameKey_Shift;
+            break;
+        case VK_CONTROL:
+            key = FrameKey_Control;
+            break;
+        default:
+            return;
+        }
+    }
+    frame_key_event(f, key, down);
+}
+
 bool frame_loop(Frame* f)
 {
     MSG msg;
+    frame_time_begin(f, FramePhase_Events);
+    f->num_key_events = 0;
     while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
         if (msg.message == WM_QUIT) {
             frame_cleanup(f);
             return false;
         }
+        if (msg.message == WM_KEYDOWN || msg.message == WM_KEYUP) {
+            frame_key(f, msg.wParam, msg.message == WM_KEYDOWN);
+        }
         TranslateMessage(&msg);
         DispatchMessage(&msg);
     }
+    frame_time_end(f, FramePhase_Events);
 
     if (!f->hwnd) {
         frame_cleanup(f);
@@ -169,11 +209,29 @@ bool frame_loop(Frame* f)
     // Update OpenGL context before rendering
     wglMakeCurrent(f->hdc, f->hglrc);
 
+    frame_time_begin(f, FramePhase_Scale);
     gfx_render(f->layers, array_length(f->layers), win_w, win_h);
+    frame_time_end(f, FramePhase_Scale);
+
+    frame_time_begin(f, FramePhase_Present);
     SwapBuffers(f->hdc);
+    frame_time_end(f, FramePhase_Present);
     return true;
 }
 
+bool frame_set_vsync(Frame* f, bool vsync)
+{
+    typedef BOOL(WINAPI * PFNWGLSWAPINTERVALEXTPROC)(int);
+    PFNWGLSWAPINTERVALEXTPROC wglSwapIntervalEXT =
+        (PFNWGLSWAPINTERVALEXTPROC)wglGetProcAddress("wglSwapIntervalEXT");
+    if (!wglSwapIntervalEXT) {
+        return false;
+    }
+
+    wglMakeCurrent(f->hdc, f->hglrc);
+    return wglSwapIntervalEXT(vsync ? 1 : 0) && vsync;
+}
+
 u32* frame_add_layer(Frame* f, int width, int height)
 {
     u32*      pixels = KORE_ARRAY_ALLOC(u32, width * height);
@@ -4,29 +4,174 @@
 
 #include "frame.h"
 
-f64 frame_fps(Frame* f)
+#include <math.h>
+#include <stdlib.h>
+
+//------------------------------------------------------------------------------
+// Frame timing
+//------------------------------------------------------------------------------
+
+void frame_time_begin(Frame* f, FramePhase phase)
+{
+    f->phase_start[phase] = $.time_now();
+}
+
+void frame_time_end(Frame* f, FramePhase phase)
+{
+    KTimePeriod elapsed = $.time_diff(f->phase_start[phase], $.time_now());
+    f->timing_current[phase] += $.time_secs(elapsed);
+}
+
+void frame_time_next(Frame* f)
+{
+    // The frame interval runs from one call to the next
+    frame_time_end(f, FramePhase_Frame);
+    frame_time_begin(f, FramePhase_Frame);
+
+    for (u32 i = 0; i < FramePhase_COUNT; ++i) {
+        f->timing[f->timing_next][i] = (f32)f->timing_current[i];
+        f->timing_current[i]         = 0.0;
+    }
+    f->timing_next = (f->timing_next + 1) % FRAME_TIMING_HISTORY;
+    if (f->timing_count < FRAME_TIMING_HISTORY) {
+        f->timing_count++;
+    }
+}
+
+static int frame_compare_time(const void* a, const void* b)
 {
-    f->frame_count++;
-    KTimePoint current_time = $.time_now();
+    f32 x = *(const f32*)a;
+    f32 y = *(const f32*)b;
+    return (x > y) - (x < y);
+}
 
-    // Initialize on first call
-    if (f->frame_count == 1) {
-        f->last_time = current_time;
-        f->fps       = 0.0;
-        return f->fps;
+FrameTimingStats frame_timing_stats(const Frame* f, FramePhase phase)
+{
+    FrameTimingStats stats = {.count = f->timing_count};
+    if (f->timing_count == 0) {
+        return stats;
     }
 
-    // Calculate FPS based on elapsed time since last update
-    KTimePeriod elapsed      = $.time_diff(f->last_time, current_time);
-    f64         elapsed_secs = $.time_secs(elapsed);
+    f32 sorted[FRAME_TIMING_HISTORY];
+    f64 total = 0.0;
+    for (u32 i = 0; i < f->timing_count; ++i) {
+        f32 t     = f->timing[i][phase];
+        sorted[i] = t;
+        total += t;
 
-    if (elapsed_secs > 0.0) {
-        // Calculate instantaneous FPS (frames since last call / elapsed time)
-        f->fps = 1.0 / elapsed_secs;
+        // Bucket by the power of two of the time in microseconds
+        f64 us     = (f64)t * 1e6;
+        int bucket = us < 1.0 ? 0 : (int)log2(us);
+        if (bucket >= FRAME_TIMING_BUCKETS) {
+            bucket = FRAME_TIMING_BUCKETS - 1;
+        }
+        stats.histogram[bucket]++;
     }
+    qsort(sorted, f->timing_count, sizeof(f32), frame_compare_time);
 
-    f->last_time = current_time;
-    return f->fps;
+    u32 p99   = (f->timing_count * 99 + 99) / 100 - 1;
+    stats.min = sorted[0];
+    stats.avg = total / f->timing_count;
+    stats.p99 = sorted[p99];
+    stats.max = sorted[f->timing_count - 1];
+    return stats;
+}
+
+// Graph scale: seconds per pixel of bar height
+#define FRAME_GRAPH_SECS_PER_PIXEL 0.0005
+
+static const u32 g_phase_colours[FramePhase_COUNT] = {
+    [FramePhase_Emulate] = 0xe000c000,
+    [FramePhase_Render]  = 0xe0e0e000,
+    [FramePhase_Scale]   = 0xe000a0ff,
+    [FramePhase_Present] = 0xe0ff00ff,
+    [FramePhase_Events]  = 0xe0ffffff,
+    [FramePhase_Frame]   = 0xe0404040, // The rest of the frame, mostly waiting
+};
+
+static void frame_graph_bar(u32* pixels,
+                            int  width,
+                            int  bottom,
+                            int  x,
+                            int* y,
+                            f64  secs,
+                            u32  colour)
+{
+    int h = (int)(secs / FRAME_GRAPH_SECS_PER_PIXEL + 0.5);
+    for (; h > 0 && *y > bottom - FRAME_GRAPH_HEIGHT; --h) {
+        pixels[(*y)-- * width + x] = colour;
+    }
+}
+
+void frame_timing_draw(const Frame* f, u32* pixels, int width, int height)
+{
+    if (height < FRAME_GRAPH_HEIGHT) {
+        return;
+    }
+    int bottom = height - 1;
+    int top    = height - FRAME_GRAPH_HEIGHT;
+    for (int y = top; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            pixels[y * width + x] = 0x80000000;
+        }
+    }
+
+    // Newest frame on the right
+    int columns = (int)f->timing_count < width ? (int)f->timing_count : width;
+    for (int i = 0; i < columns; ++i) {
+        u32 slot = (f->timing_next + FRAME_TIMING_HISTORY - 1 - (u32)i) %
+                   FRAME_TIMING_HISTORY;
+        const f32* t = f->timing[slot];
+        int        x = width - 1 - i;
+        int        y = bottom;
+
+        f64 busy = 0.0;
+        for (u32 p = 0; p < FramePhase_Frame; ++p) {
+            frame_graph_bar(
+                pixels, width, bottom, x, &y, t[p], g_phase_colours[p]);
+            busy += t[p];
+        }
+        if (t[FramePhase_Frame] > busy) {
+            frame_graph_bar(pixels,
+                            width,
+                            bottom,
+                            x,
+                            &y,
+                            t[FramePhase_Frame] - busy,
+                            g_phase_colours[FramePhase_Frame]);
+        }
+    }
+
+    // A line at the time of a 50Hz frame
+    int line = bottom - (int)(0.02 / FRAME_GRAPH_SECS_PER_PIXEL);
+    if (line >= top) {
+        for (int x = 0; x < width; ++x) {
+            pixels[line * width + x] = 0xffff0000;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+GfxLayer* frame_find_layer(Frame* f, const u32* pixels)
+{
+    for (u64 i = 0; i < array_length(f->layers); ++i) {
+        if (gfx_layer_get_pixels(f->layers[i]) == pixels) {
+            return f->layers[i];
+        }
+    }
+    return NULL;
 }
 
 void frame_free_pixels(u32* pixels) { KORE_ARRAY_FREE(pixels); }
+
+//------------------------------------------------------------------------------
+// Keyboard
+//------------------------------------------------------------------------------
+
+void frame_key_event(Frame* f, FrameKey key, bool down)
+{
+    if (f->num_key_events < FRAME_KEY_EVENTS) {
+        f->key_events[f->num_key_events++] = (FrameKeyEvent){key, down};
+    }
+}
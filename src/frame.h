@@ -6,6 +6,107 @@
 
 #include "gfx.h"
 
+#if KORE_OS_LINUX
+#    include <X11/extensions/XShm.h>
+#endif
+
+//------------------------------------------------------------------------------
+// Frame timing
+//
+// Each frame, the time spent in each phase is added up, and frame_time_next
+// stores the totals in a ring buffer of the last FRAME_TIMING_HISTORY frames.
+// FramePhase_Frame is the whole time from one frame_time_next to the next,
+// including any time spent sleeping.
+//------------------------------------------------------------------------------
+
+#define FRAME_TIMING_HISTORY 256
+
+// Histogram bucket i counts times from 2^i to 2^(i+1) microseconds
+#define FRAME_TIMING_BUCKETS 16
+
+typedef enum {
+    FramePhase_Emulate, // Running the CPU
+    FramePhase_Render,  // Drawing the layers' pixels
+    FramePhase_Scale,   // Compositing and scaling the layers for the window
+    FramePhase_Present, // Handing the image to the display
+    FramePhase_Events,  // Handling window events
+    FramePhase_Frame,   // The whole frame
+
+    FramePhase_COUNT,
+} FramePhase;
+
+typedef struct {
+    u32 count; // Frames in the history
+    f64 min;   // Times in seconds
+    f64 avg;
+    f64 p99;
+    f64 max;
+    u32 histogram[FRAME_TIMING_BUCKETS];
+} FrameTimingStats;
+
+//------------------------------------------------------------------------------
+// Keyboard
+//
+// frame_loop collects the presses and releases of the keys nx uses, in the
+// order they happened.  A key held down repeats its press.
+//------------------------------------------------------------------------------
+
+// Most key events kept from one frame_loop to the next; any more are dropped
+#define FRAME_KEY_EVENTS 64
+
+// The digits and letters run in order, so a platform can map a range of its
+// own key codes onto them
+typedef enum {
+    FrameKey_Backspace,
+    FrameKey_0,
+    FrameKey_1,
+    FrameKey_2,
+    FrameKey_3,
+    FrameKey_4,
+    FrameKey_5,
+    FrameKey_6,
+    FrameKey_7,
+    FrameKey_8,
+    FrameKey_9,
+    FrameKey_A,
+    FrameKey_B,
+    FrameKey_C,
+    FrameKey_D,
+    FrameKey_E,
+    FrameKey_F,
+    FrameKey_G,
+    FrameKey_H,
+    FrameKey_I,
+    FrameKey_J,
+    FrameKey_K,
+    FrameKey_L,
+    FrameKey_M,
+    FrameKey_N,
+    FrameKey_O,
+    FrameKey_P,
+    FrameKey_Q,
+    FrameKey_R,
+    FrameKey_S,
+    FrameKey_T,
+    FrameKey_U,
+    FrameKey_V,
+    FrameKey_W,
+    FrameKey_X,
+    FrameKey_Y,
+    FrameKey_Z,
+    FrameKey_Enter,
+    FrameKey_Space,
+    FrameKey_Shift,
+    FrameKey_Control,
+
+    FrameKey_COUNT,
+} FrameKey;
+
+typedef struct {
+    FrameKey key;
+    bool     down;
+} FrameKeyEvent;
+
 //------------------------------------------------------------------------------
 // Window data structure
 //------------------------------------------------------------------------------
@@ -16,10 +117,16 @@ typedef struct {
     int         height;
     KArray(GfxLayer*) layers;
 
-    // FPS tracking
-    KTimePoint last_time;
-    u64        frame_count;
-    f64        fps;
+    // Frame timing
+    f32        timing[FRAME_TIMING_HISTORY][FramePhase_COUNT];
+    u32        timing_next;  // Ring buffer slot for the current frame
+    u32        timing_count; // Frames recorded, up to FRAME_TIMING_HISTORY
+    f64        timing_current[FramePhase_COUNT];
+    KTimePoint phase_start[FramePhase_COUNT];
+
+    // Key events from the last frame_loop, oldest first
+    FrameKeyEvent key_events[FRAME_KEY_EVENTS];
+    u32           num_key_events;
 
 #if KORE_OS_WINDOWS
     HWND  hwnd;
@@ -29,7 +136,13 @@ typedef struct {
     Display* display;
     Window   window;
     GC       gc;
-    XImage*  image;
+    XImage*  image; // Window-sized framebuffer the layers are drawn into
+
+    // MIT-SHM: the image lives in memory shared with a local X server
+    XShmSegmentInfo shm;
+    bool            use_shm;
+    bool            shm_busy;       // The server may still be reading it
+    int             shm_completion; // Event type of ShmCompletion
 #else
 #    error "Unsupported OS"
 #endif
@@ -42,6 +155,31 @@ typedef struct {
 Frame frame_open(int width, int height, const char* title);
 bool  frame_loop(Frame* w);
 u32*  frame_add_layer(Frame* w, int width, int height);
-f64   frame_fps(Frame* w);
+
+// Time a phase of the current frame.  A phase can be timed more than once in
+// a frame, and the times add up.
+void frame_time_begin(Frame* w, FramePhase phase);
+void frame_time_end(Frame* w, FramePhase phase);
+
+// Finish timing the current frame and start the next
+void frame_time_next(Frame* w);
+
+FrameTimingStats frame_timing_stats(const Frame* w, FramePhase phase);
+
+// Draw a graph of the recent frame times along the bottom of a layer,
+// FRAME_GRAPH_HEIGHT pixels high, one column per frame with the phases stacked
+// up.  The line across it is the 50Hz frame time.
+#define FRAME_GRAPH_HEIGHT 64
+void frame_timing_draw(const Frame* w, u32* pixels, int width, int height);
+
+// Wait for the display's vertical blank when presenting.  Returns true if the
+// platform can, so the display can pace the main loop.
+bool frame_set_vsync(Frame* w, bool vsync);
+
+// Record a key event for the caller of frame_loop.  Used by the platform code.
+void frame_key_event(Frame* w, FrameKey key, bool down);
+
+// The layer that owns pixels returned by frame_add_layer
+GfxLayer* frame_find_layer(Frame* w, const u32* pixels);
 
 void frame_free_pixels(u32* pixels);
@@ -0,0 +1,312 @@
+//------------------------------------------------------------------------------
+// Software layer system
+//
+// The X11 frame has no OpenGL context, so layers are composited and scaled on
+// the CPU into a framebuffer in memory that the frame then presents.
+//------------------------------------------------------------------------------
+
+#include "gfx.h"
+
+#if KORE_OS_LINUX
+
+#    include "scale.h"
+
+#    include <stdlib.h>
+#    include <string.h>
+
+struct GfxLayer {
+    int       w, h;
+    bool      enabled;
+    uint32_t* pixels;      // Reference to external pixel buffer
+    bool      track_dirty; // Only redraw the rows marked in dirty
+    uint8_t*  dirty;       // One flag per row
+};
+
+// Framebuffer gfx_render draws into
+static u32* g_target       = NULL;
+static int  g_target_w     = 0;
+static int  g_target_h     = 0;
+static int  g_target_pitch = 0;
+
+// Everything is redrawn when the target or the layer placement changes
+static bool g_redraw_all = true;
+static int  g_scale      = 0;
+
+// Rows of the target changed by the last gfx_render, as [y0, y1)
+static int g_damage_y0 = 0;
+static int g_damage_y1 = 0;
+
+// One row of the layers blended together, before scaling
+static u32* g_row       = NULL;
+static int  g_row_width = 0;
+
+bool gfx_init(void) { return true; }
+
+void gfx_shutdown(void)
+{
+    free(g_row);
+    g_row       = NULL;
+    g_row_width = 0;
+    g_target    = NULL;
+}
+
+void gfx_set_target(u32* pixels, int width, int height, int pitch)
+{
+    g_target       = pixels;
+    g_target_w     = width;
+    g_target_h     = height;
+    g_target_pitch = pitch;
+    g_redraw_all   = true;
+}
+
+bool gfx_get_damage(int* y, int* h)
+{
+    *y = g_damage_y0;
+    *h = g_damage_y1 - g_damage_y0;
+    return *h > 0;
+}
+
+// ---------- Layers ----------
+
+GfxLayer* gfx_layer_create(int width, int height, const uint32_t* rgba_pixels)
+{
+    if (width <= 0 || height <= 0) {
+        return NULL;
+    }
+    GfxLayer* L = (GfxLayer*)calloc(1, sizeof(GfxLayer));
+    if (!L) {
+        return NULL;
+    }
+    L->dirty = (uint8_t*)malloc((size_t)height);
+    if (!L->dirty) {
+        free(L);
+        return NULL;
+    }
+    memset(L->dirty, 1, (size_t)height);
+    L->w       = width;
+    L->h       = height;
+    L->enabled = true;
+    L->pixels  = (uint32_t*)rgba_pixels; // Store reference to pixel buffer
+    return L;
+}
+
+void gfx_layer_destroy(GfxLayer* layer)
+{
+    if (!layer) {
+        return;
+    }
+    free(layer->dirty);
+    free(layer);
+}
+
+void gfx_layer_set_enabled(GfxLayer* layer, bool enabled)
+{
+    if (layer && layer->enabled != enabled) {
+        layer->enabled = enabled;
+        g_redraw_all   = true;
+    }
+}
+
+bool gfx_layer_is_enabled(const GfxLayer* layer)
+{
+    return layer ? layer->enabled : false;
+}
+
+void gfx_layer_set_dirty_tracking(GfxLayer* layer, bool enabled)
+{
+    if (layer) {
+        layer->track_dirty = enabled;
+    }
+}
+
+void gfx_layer_mark_dirty(GfxLayer* layer, int y, int h)
+{
+    if (!layer) {
+        return;
+    }
+    if (y < 0) {
+        h += y;
+        y = 0;
+    }
+    if (y + h > layer->h) {
+        h = layer->h - y;
+    }
+    if (h > 0) {
+        memset(layer->dirty + y, 1, (size_t)h);
+    }
+}
+
+void gfx_layer_update_pixels(GfxLayer* layer, const uint32_t* rgba_pixels)
+{
+    if (!layer || !rgba_pixels) {
+        return;
+    }
+    if (rgba_pixels != layer->pixels) {
+        memcpy(layer->pixels,
+               rgba_pixels,
+               (size_t)layer->w * (size_t)layer->h * sizeof(uint32_t));
+    }
+    memset(layer->dirty, 1, (size_t)layer->h);
+}
+
+bool gfx_layer_resize(GfxLayer*       layer,
+                      int             new_w,
+                      int             new_h,
+                      const uint32_t* rgba_pixels)
+{
+    if (!layer || new_w <= 0 || new_h <= 0) {
+        return false;
+    }
+    uint8_t* dirty = (uint8_t*)malloc((size_t)new_h);
+    if (!dirty) {
+        return false;
+    }
+    memset(dirty, 1, (size_t)new_h);
+    free(layer->dirty);
+    layer->dirty  = dirty;
+    layer->w      = new_w;
+    layer->h      = new_h;
+    layer->pixels = (uint32_t*)rgba_pixels; // Update pixel buffer reference
+    g_redraw_all  = true;
+    return true;
+}
+
+int gfx_layer_get_width(const GfxLayer* layer) { return layer ? layer->w : 0; }
+int gfx_layer_get_height(const GfxLayer* layer) { return layer ? layer->h : 0; }
+const u32* gfx_layer_get_pixels(const GfxLayer* layer)
+{
+    return layer ? layer->pixels : NULL;
+}
+
+// ---------- Rendering ----------
+
+// Blend a row of src over dst using src's alpha
+static void gfx_blend_row(u32* dst, const u32* src, int width)
+{
+    for (int x = 0; x < width; ++x) {
+        u32 s = src[x];
+        u32 a = s >> 24;
+        if (a == 0) {
+            continue;
+        }
+        if (a == 255) {
+            dst[x] = s;
+            continue;
+        }
+
+        // Red and blue, then green, scaled by alpha in parallel
+        u32 d  = dst[x];
+        u32 rb = ((s & 0xff00ff) * a + (d & 0xff00ff) * (255 - a)) >> 8;
+        u32 g  = ((s & 0x00ff00) * a + (d & 0x00ff00) * (255 - a)) >> 8;
+        dst[x] = 0xff000000u | (rb & 0xff00ff) | (g & 0x00ff00);
+    }
+}
+
+static bool gfx_row_dirty(GfxLayer** layers, int layer_count, int y)
+{
+    for (int i = 0; i < layer_count; ++i) {
+        GfxLayer* L = layers[i];
+        if (L && L->enabled && y < L->h &&
+            (!L->track_dirty || L->dirty[y])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Every layer is drawn at the integer scale that makes the first enabled layer
+// fit the target, centred, with the unused regions cleared to black.  Layers
+// are expected to be the same size.
+void gfx_render(GfxLayer** layers,
+                int        layer_count,
+                int        window_width,
+                int        window_height)
+{
+    g_damage_y0 = g_damage_y1 = 0;
+
+    GfxLayer* base = NULL;
+    for (int i = 0; i < layer_count && !base; ++i) {
+        if (layers[i] && layers[i]->enabled && layers[i]->pixels) {
+            base = layers[i];
+        }
+    }
+    if (!g_target || !base) {
+        return;
+    }
+
+    int target_w = window_width < g_target_w ? window_width : g_target_w;
+    int target_h = window_height < g_target_h ? window_height : g_target_h;
+    int scale_w  = target_w / base->w;
+    int scale_h  = target_h / base->h;
+    int scale    = scale_w < scale_h ? scale_w : scale_h;
+    if (scale <= 0) {
+        return;
+    }
+    if (scale != g_scale) {
+        g_scale      = scale;
+        g_redraw_all = true;
+    }
+
+    if (base->w > g_row_width) {
+        free(g_row);
+        g_row       = (u32*)malloc((size_t)base->w * sizeof(u32));
+        g_row_width = g_row ? base->w : 0;
+        if (!g_row) {
+            return;
+        }
+    }
+
+    if (g_redraw_all) {
+        for (int y = 0; y < g_target_h; ++y) {
+            memset(g_target + (size_t)y * g_target_pitch,
+                   0,
+                   (size_t)g_target_w * sizeof(u32));
+        }
+        g_damage_y0 = 0;
+        g_damage_y1 = g_target_h;
+    }
+
+    int ox = (target_w - base->w * scale) / 2;
+    int oy = (target_h - base->h * scale) / 2;
+
+    for (int y = 0; y < base->h; ++y) {
+        if (!g_redraw_all && !gfx_row_dirty(layers, layer_count, y)) {
+            continue;
+        }
+
+        memcpy(g_row, base->pixels + (size_t)y * base->w, base->w * 4);
+        for (int i = 0; i < layer_count; ++i) {
+            GfxLayer* L = layers[i];
+            if (L && L != base && L->enabled && L->pixels && y < L->h) {
+                int w = L->w < base->w ? L->w : base->w;
+                gfx_blend_row(g_row, L->pixels + (size_t)y * L->w, w);
+            }
+        }
+
+        int top = oy + y * scale;
+        scale_image(g_target + (size_t)top * g_target_pitch + ox,
+                    (usize)g_target_pitch,
+                    g_row,
+                    (usize)base->w,
+                    (u32)base->w,
+                    1,
+                    (u32)scale);
+
+        // Rows go top to bottom, so the damage only grows downwards
+        if (!g_redraw_all) {
+            if (g_damage_y0 == g_damage_y1) {
+                g_damage_y0 = top;
+            }
+            g_damage_y1 = top + scale;
+        }
+    }
+
+    for (int i = 0; i < layer_count; ++i) {
+        if (layers[i]) {
+            memset(layers[i]->dirty, 0, (size_t)layers[i]->h);
+        }
+    }
+    g_redraw_all = false;
+}
+
+#endif // KORE_OS_LINUX
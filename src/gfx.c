@@ -1,5 +1,8 @@
 #include "gfx.h"
 
+// Linux uses the software implementation in gfx-soft.c
+#if !KORE_OS_LINUX
+
 // Assumptions / notes:
 // - gfx_init will (on Windows if OS_WINDOWS defined) optionally create a
 // minimal
@@ -15,6 +18,7 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 
 #define APIENTRYP APIENTRY*
 
@@ -24,7 +28,9 @@ struct GfxLayer {
     int       w, h;
     GLuint    tex;
     bool      enabled;
-    uint32_t* pixels; // Reference to external pixel buffer
+    uint32_t* pixels;      // Reference to external pixel buffer
+    bool      track_dirty; // Only upload the rows marked in dirty
+    uint8_t*  dirty;       // One flag per row
 };
 
 // Single shared shader & geometry
@@ -520,6 +526,11 @@ GfxLayer* gfx_layer_create(int width, int height, const uint32_t* rgba_pixels)
     if (!L) {
         return NULL;
     }
+    L->dirty = (uint8_t*)calloc((size_t)height, 1);
+    if (!L->dirty) {
+        free(L);
+        return NULL;
+    }
     L->w       = width;
     L->h       = height;
     L->enabled = true;
@@ -536,6 +547,7 @@ void gfx_layer_destroy(GfxLayer* layer)
     if (layer->tex) {
         glDeleteTextures(1, &layer->tex);
     }
+    free(layer->dirty);
     free(layer);
 }
 
@@ -551,6 +563,57 @@ bool gfx_layer_is_enabled(const GfxLayer* layer)
     return layer ? layer->enabled : false;
 }
 
+void gfx_layer_set_dirty_tracking(GfxLayer* layer, bool enabled)
+{
+    if (layer) {
+        layer->track_dirty = enabled;
+    }
+}
+
+void gfx_layer_mark_dirty(GfxLayer* layer, int y, int h)
+{
+    if (!layer) {
+        return;
+    }
+    if (y < 0) {
+        h += y;
+        y = 0;
+    }
+    if (y + h > layer->h) {
+        h = layer->h - y;
+    }
+    if (h > 0) {
+        memset(layer->dirty + y, 1, (size_t)h);
+    }
+}
+
+// Upload each run of dirty rows with one call.  Rows span the full width, so
+// a run is contiguous in the pixel buffer.
+static void gfx_layer_upload_dirty(GfxLayer* layer)
+{
+    glBindTexture(GL_TEXTURE_2D, layer->tex);
+    int y = 0;
+    while (y < layer->h) {
+        if (!layer->dirty[y]) {
+            ++y;
+            continue;
+        }
+        int start = y;
+        while (y < layer->h && layer->dirty[y]) {
+            layer->dirty[y++] = 0;
+        }
+        glTexSubImage2D(GL_TEXTURE_2D,
+                        0,
+                        0,
+                        start,
+                        layer->w,
+                        y - start,
+                        GL_RGBA,
+                        GL_UNSIGNED_BYTE,
+                        layer->pixels + (size_t)start * (size_t)layer->w);
+    }
+}
+
 void gfx_layer_update_pixels(GfxLayer* layer, const uint32_t* rgba_pixels)
 {
     if (!layer || !rgba_pixels) {
@@ -576,6 +639,13 @@ bool gfx_layer_resize(GfxLayer*       layer,
     if (!layer || new_w <= 0 || new_h <= 0) {
         return false;
     }
+    uint8_t* dirty = (uint8_t*)calloc((size_t)new_h, 1);
+    if (!dirty) {
+        return false;
+    }
+    free(layer->dirty);
+    layer->dirty = dirty;
+
     if (layer->tex) {
         glDeleteTextures(1, &layer->tex);
     }
@@ -588,6 +658,10 @@ bool gfx_layer_resize(GfxLayer*       layer,
 
 int gfx_layer_get_width(const GfxLayer* layer) { return layer ? layer->w : 0; }
 int gfx_layer_get_height(const GfxLayer* layer) { return layer ? layer->h : 0; }
+const u32* gfx_layer_get_pixels(const GfxLayer* layer)
+{
+    return layer ? layer->pixels : NULL;
+}
 
 // ---------- Rendering ----------
 
@@ -624,7 +698,11 @@ void gfx_render(GfxLayer** layers,
 
         // Update texture with current pixel data
         if (L->pixels) {
-            gfx_layer_update_pixels(L, L->pixels);
+            if (L->track_dirty) {
+                gfx_layer_upload_dirty(L);
+            } else {
+                gfx_layer_update_pixels(L, L->pixels);
+            }
         }
 
         float scale_w   = (float)window_width / (float)L->w;
@@ -681,3 +759,5 @@ void gfx_render(GfxLayer** layers,
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     }
 }
+
+#endif // !KORE_OS_LINUX
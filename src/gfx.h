@@ -15,6 +15,9 @@
 //
 // All pixel data is 32-bit RGBA (8 bits per channel) in memory order compatible
 // with GL_RGBA / GL_UNSIGNED_BYTE.
+//
+// On Linux there is no OpenGL: gfx-soft.c implements the same interface on the
+// CPU, compositing into a framebuffer given by gfx_set_target.
 
 typedef struct GfxLayer GfxLayer;
 
@@ -32,6 +35,12 @@ void      gfx_layer_destroy(GfxLayer* layer);
 void gfx_layer_set_enabled(GfxLayer* layer, bool enabled);
 bool gfx_layer_is_enabled(const GfxLayer* layer);
 
+// With dirty tracking enabled, gfx_render only uploads the rows of the layer's
+// pixel buffer marked with gfx_layer_mark_dirty since the last render, instead
+// of the whole buffer.
+void gfx_layer_set_dirty_tracking(GfxLayer* layer, bool enabled);
+void gfx_layer_mark_dirty(GfxLayer* layer, int y, int h);
+
 // Replace all pixels (must supply width*height uint32_t values). Size must
 // match layer.
 void gfx_layer_update_pixels(GfxLayer* layer, const uint32_t* rgba_pixels);
@@ -46,6 +55,7 @@ bool gfx_layer_resize(GfxLayer*  layer,
 // Accessors
 int gfx_layer_get_width(const GfxLayer* layer);
 int gfx_layer_get_height(const GfxLayer* layer);
+const u32* gfx_layer_get_pixels(const GfxLayer* layer);
 
 // Render ordered list of layers (front-most last) to current framebuffer of
 // given window size.
@@ -53,3 +63,13 @@ void gfx_render(GfxLayer** layers,
                 int        layer_count,
                 int        window_width,
                 int        window_height);
+
+#if KORE_OS_LINUX
+// Software rendering only.  gfx_render draws into pixels, a width x height
+// buffer with pitch pixels per row.  Setting a target redraws everything.
+void gfx_set_target(u32* pixels, int width, int height, int pitch);
+
+// The rows of the target changed by the last gfx_render.  Returns false if
+// nothing changed.
+bool gfx_get_damage(int* y, int* h);
+#endif
@@ -0,0 +1,491 @@
+//------------------------------------------------------------------------------
+// Input journal
+//------------------------------------------------------------------------------
+
+#include "journal.h"
+
+#include <string.h>
+
+// The header is the magic, the version and the size of a ChipState, which is
+// written as it is in memory and so only reads back into the same build
+#define JOURNAL_MAGIC "NXJ1"
+#define JOURNAL_VERSION 1
+
+#define JOURNAL_FNV_OFFSET 0xcbf29ce484222325ull
+#define JOURNAL_FNV_PRIME 0x100000001b3ull
+
+// A key record's last byte is the key, with bit 7 set for a press
+#define JOURNAL_KEY_DOWN 0x80
+
+// A keyframe's payload: the hash, the autoload keys, the chips and the banks.
+// A bank of literals costs a control byte every 128.
+#define JOURNAL_STATE_HEADER (8 + JOURNAL_AUTOLOAD + sizeof(ChipState))
+#define JOURNAL_BANK_BOUND (MEM_PAGE_SIZE + MEM_PAGE_SIZE / 128)
+#define JOURNAL_STATE_BOUND                                                    \
+    (JOURNAL_STATE_HEADER + MEM_RAM_BANKS * JOURNAL_BANK_BOUND)
+
+// A record as read from the mapping
+typedef struct {
+    JournalRecord type;
+    u32           frame;
+    JournalEvent  event; // A key
+    const u8*     data;  // The payload of a keyframe, jump or end
+    u32           size;
+    const u8*     next;
+} JournalEntry;
+
+//------------------------------------------------------------------------------
+// PackBits
+//
+// A control byte n, then n + 1 bytes as they are if n < 128, or one byte to
+// repeat 257 - n times if n > 128.  RAM is mostly runs of 0 or of one
+// attribute, and the odd literal costs a byte in 128.
+//------------------------------------------------------------------------------
+
+static usize journal_pack(u8* out, const u8* in, usize size)
+{
+    u8*   start = out;
+    usize i     = 0;
+    while (i < size) {
+        // Runs of 3 or more are worth a control byte of their own
+        usize run = 1;
+        while (i + run < size && run < 128 && in[i + run] == in[i]) {
+            run++;
+        }
+        if (run >= 3) {
+            *out++ = (u8)(257 - run);
+            *out++ = in[i];
+            i += run;
+            continue;
+        }
+
+        usize n = 0;
+        while (i + n < size && n < 128) {
+            if (i + n + 2 < size && in[i + n] == in[i + n + 1] &&
+                in[i + n] == in[i + n + 2]) {
+                break;
+            }
+            n++;
+        }
+        *out++ = (u8)(n - 1);
+        memcpy(out, in + i, n);
+        out += n;
+        i += n;
+    }
+    return (usize)(out - start);
+}
+
+// Unpack exactly size bytes.  Returns the end of the code, or NULL if it
+// runs past end or codes more than size.
+static const u8* journal_unpack(const u8* p, const u8* end, u8* out, usize size)
+{
+    usize i = 0;
+    while (i < size) {
+        if (p >= end) {
+            return NULL;
+        }
+        u8 n = *p++;
+        if (n < 128) {
+            usize len = (usize)n + 1;
+            if (len > size - i || len > (usize)(end - p)) {
+                return NULL;
+            }
+            memcpy(out + i, p, len);
+            p += len;
+            i += len;
+        } else if (n > 128) {
+            usize len = 257 - (usize)n;
+            if (len > size - i || p >= end) {
+                return NULL;
+            }
+            memset(out + i, *p++, len);
+            i += len;
+        }
+    }
+    return p;
+}
+
+//------------------------------------------------------------------------------
+// Recording
+//------------------------------------------------------------------------------
+
+static void journal_write(Journal* j, const void* data, usize size)
+{
+    if (size > 0 && fwrite(data, 1, size, j->file) != size) {
+        j->failed = true;
+    }
+}
+
+static void journal_write_varint(Journal* j, u32 value)
+{
+    u8  bytes[5];
+    u32 n = 0;
+    while (value >= 0x80) {
+        bytes[n++] = (u8)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[n++] = (u8)value;
+    journal_write(j, bytes, n);
+}
+
+// A 16-bit length, the string and a 0, so it can be used in place
+static void journal_write_string(Journal* j, const char* s)
+{
+    usize length = s ? strlen(s) : 0;
+    u16   n      = length > 0xffff ? 0xffff : (u16)length;
+    u8    h[2]   = {(u8)n, (u8)(n >> 8)};
+    journal_write(j, h, sizeof(h));
+    journal_write(j, s, n);
+    journal_write(j, "", 1);
+}
+
+// Start a record before the coming frame
+static void journal_begin(Journal* j, JournalRecord type)
+{
+    u8 byte = (u8)type;
+    journal_write(j, &byte, 1);
+    journal_write_varint(j, j->frame - j->record_frame);
+    j->record_frame = j->frame;
+}
+
+static void journal_write_state(Journal* j, JournalRecord type, Machine* m)
+{
+    ChipState chips;
+    state_save_chips(&chips, m);
+    // The autoload pointer is into main.c's data, so the keys go instead
+    u8  autoload[JOURNAL_AUTOLOAD] = {0};
+    u32 n                          = 0;
+    while (chips.autoload && chips.autoload[n] && n < JOURNAL_AUTOLOAD - 1) {
+        autoload[n] = chips.autoload[n];
+        n++;
+    }
+    chips.autoload = NULL;
+
+    u8* p = j->buffer;
+    memcpy(p, &j->hash, 8);
+    p += 8;
+    memcpy(p, autoload, JOURNAL_AUTOLOAD);
+    p += JOURNAL_AUTOLOAD;
+    memcpy(p, &chips, sizeof(chips));
+    p += sizeof(chips);
+    for (u32 i = 0; i < MEM_RAM_BANKS; ++i) {
+        p += journal_pack(p, m->memory.ram[i], MEM_PAGE_SIZE);
+    }
+
+    u32 size = (u32)(p - j->buffer);
+    journal_begin(j, type);
+    journal_write(j, &size, sizeof(size));
+    journal_write(j, j->buffer, size);
+    fflush(j->file);
+}
+
+bool journal_create(Journal*            j,
+                    const char*         path,
+                    const JournalSetup* setup,
+                    Machine*            m)
+{
+    memset(j, 0, sizeof(*j));
+    j->setup = *setup;
+    j->hash  = JOURNAL_FNV_OFFSET;
+    j->file  = fopen(path, "wb");
+    if (!j->file) {
+        $.eprn("Unable to create %s", path);
+        return false;
+    }
+    j->buffer = KORE_ARRAY_ALLOC(u8, JOURNAL_STATE_BOUND);
+
+    u8 h[8];
+    memcpy(h, JOURNAL_MAGIC, 4);
+    h[4] = JOURNAL_VERSION;
+    h[5] = 0;
+    h[6] = (u8)sizeof(ChipState);
+    h[7] = (u8)(sizeof(ChipState) >> 8);
+    journal_write(j, h, sizeof(h));
+    u8 model[2] = {(u8)setup->model, setup->tape_realtime};
+    journal_write(j, model, sizeof(model));
+    journal_write_string(j, setup->tape_path);
+    journal_write_string(j, setup->roms_path);
+
+    journal_write_state(j, JournalRecord_Keyframe, m);
+    if (j->failed) {
+        $.eprn("Unable to write %s", path);
+    }
+    return !j->failed;
+}
+
+void journal_key(Journal* j, u32 t, KeyboardKey key, bool down)
+{
+    journal_begin(j, JournalRecord_Key);
+    journal_write_varint(j, t);
+    u8 byte = (u8)(key | (down ? JOURNAL_KEY_DOWN : 0));
+    journal_write(j, &byte, 1);
+    fflush(j->file);
+}
+
+void journal_jump(Journal* j, Machine* m)
+{
+    journal_write_state(j, JournalRecord_Jump, m);
+}
+
+void journal_end_frame(Journal* j, Machine* m)
+{
+    u64       hash   = j->hash;
+    const u8* screen = m->memory.screen;
+    for (u32 i = 0; i < MEM_SCREEN_SIZE; ++i) {
+        hash = (hash ^ screen[i]) * JOURNAL_FNV_PRIME;
+    }
+    j->hash = (hash ^ m->ula.border) * JOURNAL_FNV_PRIME;
+    j->frame++;
+
+    if (j->file && j->frame % JOURNAL_KEYFRAME_FRAMES == 0) {
+        journal_write_state(j, JournalRecord_Keyframe, m);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Playback
+//------------------------------------------------------------------------------
+
+static bool journal_read_varint(const u8** p, const u8* end, u32* value)
+{
+    u32 v = 0;
+    for (u32 shift = 0; shift < 35 && *p < end; shift += 7) {
+        u8 byte = *(*p)++;
+        v |= (u32)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char* journal_read_string(const u8** p, const u8* end)
+{
+    if (end - *p < 2) {
+        return NULL;
+    }
+    u16 n = (u16)((*p)[0] | ((*p)[1] << 8));
+    if ((usize)(end - *p) < (usize)n + 3 || (*p)[n + 2] != 0) {
+        *p = end;
+        return NULL;
+    }
+    const char* s = (const char*)*p + 2;
+    *p += n + 3;
+    return n > 0 ? s : NULL;
+}
+
+// Read the record at p, after a record before frame.  Returns false at the
+// end of the file, or at a record cut short by a run that didn't finish.
+static bool journal_read(const Journal* j,
+                         const u8*      p,
+                         u32            frame,
+                         JournalEntry*  e)
+{
+    const u8* end = j->map.data + j->map.size;
+    u32       delta;
+    if (p >= end) {
+        return false;
+    }
+    e->type = (JournalRecord)*p++;
+    if (!journal_read_varint(&p, end, &delta)) {
+        return false;
+    }
+    e->frame = frame + delta;
+
+    switch (e->type) {
+    case JournalRecord_Key: {
+        u32 t;
+        if (!journal_read_varint(&p, end, &t) || p >= end ||
+            (*p & ~JOURNAL_KEY_DOWN) >= KeyboardKey_COUNT) {
+            return false;
+        }
+        e->event = (JournalEvent){
+            .t    = t,
+            .key  = (KeyboardKey)(*p & ~JOURNAL_KEY_DOWN),
+            .down = (*p & JOURNAL_KEY_DOWN) != 0,
+        };
+        p++;
+        break;
+    }
+
+    case JournalRecord_Keyframe:
+    case JournalRecord_Jump:
+        if (end - p < 4) {
+            return false;
+        }
+        memcpy(&e->size, p, 4);
+        p += 4;
+        if ((usize)(end - p) < e->size || e->size < JOURNAL_STATE_HEADER) {
+            return false;
+        }
+        e->data = p;
+        p += e->size;
+        break;
+
+    case JournalRecord_End:
+        if (end - p < 8) {
+            return false;
+        }
+        e->data = p;
+        e->size = 8;
+        p += 8;
+        break;
+
+    default:
+        return false;
+    }
+    e->next = p;
+    return true;
+}
+
+// Note the first keyframe whose hash isn't the one played back
+static void journal_check(Journal* j, const JournalEntry* e)
+{
+    u64 hash;
+    memcpy(&hash, e->data, 8);
+    if (hash != j->hash && j->diverged == 0) {
+        j->diverged = e->frame;
+    }
+}
+
+static bool journal_load_state(Journal* j, Machine* m, const JournalEntry* e)
+{
+    const u8* p   = e->data;
+    const u8* end = p + e->size;
+
+    ChipState chips;
+    memcpy(&j->hash, p, 8);
+    p += 8;
+    memcpy(j->autoload, p, JOURNAL_AUTOLOAD);
+    j->autoload[JOURNAL_AUTOLOAD - 1] = 0;
+    p += JOURNAL_AUTOLOAD;
+    memcpy(&chips, p, sizeof(chips));
+    p += sizeof(chips);
+    for (u32 i = 0; i < MEM_RAM_BANKS; ++i) {
+        p = journal_unpack(p, end, mem_ram_bank(&m->memory, i), MEM_PAGE_SIZE);
+        if (!p) {
+            return false;
+        }
+    }
+
+    chips.autoload = j->autoload[0] ? j->autoload : NULL;
+    state_restore_chips(&chips, m);
+    m->memory.screen_dirty = MEM_SCREEN_ALL_ROWS;
+    j->frame               = e->frame;
+    j->record_frame        = e->frame;
+    return true;
+}
+
+bool journal_open(Journal* j, const char* path)
+{
+    memset(j, 0, sizeof(*j));
+    if (!filemap_open(&j->map, path)) {
+        $.eprn("Unable to read %s", path);
+        return false;
+    }
+
+    const u8* p   = j->map.data;
+    const u8* end = p + j->map.size;
+    if (j->map.size < 10 || memcmp(p, JOURNAL_MAGIC, 4) != 0 ||
+        p[4] != JOURNAL_VERSION || p[5] != 0 ||
+        (u32)(p[6] | (p[7] << 8)) != sizeof(ChipState) ||
+        p[8] >= MemoryModel_COUNT) {
+        $.eprn("%s is not a journal from this build of nx", path);
+        filemap_close(&j->map);
+        return false;
+    }
+    j->setup.model         = (MemoryModel)p[8];
+    j->setup.tape_realtime = p[9] != 0;
+    p += 10;
+    j->setup.tape_path = journal_read_string(&p, end);
+    j->setup.roms_path = journal_read_string(&p, end);
+    if (p >= end) {
+        $.eprn("%s is cut short", path);
+        filemap_close(&j->map);
+        return false;
+    }
+    j->records = p;
+    j->pos     = p;
+    return true;
+}
+
+bool journal_seek(Journal* j, Machine* m, u32 frame)
+{
+    JournalEntry e;
+    JournalEntry found = {0};
+    u32          at    = 0;
+    for (const u8* p = j->records;
+         journal_read(j, p, at, &e) && e.frame <= frame;
+         p = e.next) {
+        at = e.frame;
+        if (e.type == JournalRecord_Keyframe || e.type == JournalRecord_Jump) {
+            found = e;
+        }
+    }
+    if (!found.data || !journal_load_state(j, m, &found)) {
+        $.eprn("The journal has no keyframe to start from");
+        return false;
+    }
+    j->pos      = found.next;
+    j->ended    = false;
+    j->diverged = 0;
+    return true;
+}
+
+bool journal_event(Journal* j, Machine* m, JournalEvent* event)
+{
+    JournalEntry e;
+    while (!j->ended) {
+        if (!journal_read(j, j->pos, j->record_frame, &e)) {
+            j->ended = true;
+            break;
+        }
+        if (e.frame > j->frame) {
+            return false;
+        }
+        j->pos          = e.next;
+        j->record_frame = e.frame;
+
+        switch (e.type) {
+        case JournalRecord_Key:
+            *event = e.event;
+            return true;
+
+        case JournalRecord_Keyframe:
+            journal_check(j, &e);
+            break;
+
+        case JournalRecord_Jump:
+            journal_check(j, &e);
+            if (!journal_load_state(j, m, &e)) {
+                j->ended = true;
+            }
+            break;
+
+        case JournalRecord_End:
+            journal_check(j, &e);
+            j->ended = true;
+            j->clean = true;
+            break;
+        }
+    }
+    return false;
+}
+
+bool journal_close(Journal* j)
+{
+    bool ok = true;
+    if (j->file) {
+        journal_begin(j, JournalRecord_End);
+        journal_write(j, &j->hash, sizeof(j->hash));
+        ok      = fclose(j->file) == 0 && !j->failed;
+        j->file = NULL;
+    }
+    if (j->buffer) {
+        KORE_ARRAY_FREE(j->buffer);
+        j->buffer = NULL;
+    }
+    filemap_close(&j->map);
+    return ok;
+}
@@ -0,0 +1,116 @@
+//------------------------------------------------------------------------------
+// Input journal
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "filemap.h"
+#include "keyboard.h"
+#include "state.h"
+
+// A record of everything that steers a run from outside, to play it back
+// later and get the same run.  The emulation is deterministic, so that is the
+// setup it started from, the keys pressed and released, and the jumps the user
+// made with rewind.  Each record is timed by the frame it comes before, as
+// frames run since the journal began, and the T-state into that frame.
+//
+// The file is a header, then records appended as they happen:
+//
+//   Key       A key pressed or released
+//   Keyframe  The whole machine, every JOURNAL_KEYFRAME_FRAMES frames
+//   Jump      The whole machine, after rewinding took it somewhere else
+//   End       The file was closed cleanly
+//
+// Each is a type byte, then the frames since the record before as a varint.
+// Keyframes are the chips and a PackBits run-length coding of each RAM bank,
+// tens of KB for most programs.  Replay starts from the last keyframe at or
+// before the frame asked for, so seeking costs at most
+// JOURNAL_KEYFRAME_FRAMES frames of emulation.
+//
+// Every frame adds the display file and border to an FNV-1a hash, which each
+// keyframe saves.  Playback checks its own hash against each one it passes,
+// so a run that goes differently is caught within a few seconds of where.
+//
+// The file is flushed after every key and keyframe, so a run that crashes
+// leaves a journal that plays up to its last input.
+
+// Frames between keyframes: 10 seconds
+#define JOURNAL_KEYFRAME_FRAMES 500
+
+// Longest autoload sequence a keyframe can keep, with its 0
+#define JOURNAL_AUTOLOAD 8
+
+// What a run needs that isn't in a keyframe.  Empty paths are NULL.
+typedef struct {
+    MemoryModel model;
+    const char* tape_path;
+    bool        tape_realtime;
+    const char* roms_path; // NULL for the built-in ROMs
+} JournalSetup;
+
+typedef enum {
+    JournalRecord_Key = 1,
+    JournalRecord_Keyframe,
+    JournalRecord_Jump,
+    JournalRecord_End,
+} JournalRecord;
+
+typedef struct {
+    u32         t; // T-state into the frame
+    KeyboardKey key;
+    bool        down;
+} JournalEvent;
+
+typedef struct {
+    JournalSetup setup;
+    FILE*        file; // Recording
+    bool         failed;
+    u8*          buffer; // For coding a keyframe
+
+    FileMap   map;      // Playing back
+    const u8* records;  // The first record, after the header
+    const u8* pos;      // Next record
+    bool      ended;    // No more records
+    bool      clean;    // The last was an End record
+    u32       diverged; // Frame of the first keyframe with another hash, or 0
+
+    u32 frame;        // Frames run since the journal began
+    u32 record_frame; // Frame of the last record written or read
+    u64 hash;         // Of every frame so far
+
+    u8 autoload[JOURNAL_AUTOLOAD]; // Autoload keys left by a played keyframe
+} Journal;
+
+// Start recording to a new file with the machine as it is now, after its
+// setup.  Returns false if the file can't be created.
+bool journal_create(Journal*            j,
+                    const char*         path,
+                    const JournalSetup* setup,
+                    Machine*            m);
+
+// Record a key at time t of the coming frame
+void journal_key(Journal* j, u32 t, KeyboardKey key, bool down);
+
+// Record that the machine has been moved back by rewind before the coming
+// frame
+void journal_jump(Journal* j, Machine* m);
+
+// Count and hash the frame the machine has just finished.  When recording,
+// a keyframe is written every JOURNAL_KEYFRAME_FRAMES frames.
+void journal_end_frame(Journal* j, Machine* m);
+
+// Map a journal to play back and read its setup.  Returns false if it can't be
+// read or isn't a journal from this build of nx.
+bool journal_open(Journal* j, const char* path);
+
+// Load the last keyframe at or before frame into a machine set up as
+// j->setup says, to play on from.  Returns false if the journal has none.
+bool journal_seek(Journal* j, Machine* m, u32 frame);
+
+// The next key due in the coming frame, if any.  Keyframes on the way are
+// checked against the hash, and jumps loaded into the machine.  Once this
+// returns false, j->ended says if the journal has run out.
+bool journal_event(Journal* j, Machine* m, JournalEvent* e);
+
+// Finish recording or playing.  Returns false if a write failed.
+bool journal_close(Journal* j);
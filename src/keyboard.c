@@ -0,0 +1,25 @@
+//------------------------------------------------------------------------------
+// Keyboard
+//------------------------------------------------------------------------------
+
+#include "keyboard.h"
+
+bool keyboard_set(Keyboard* keyboard, KeyboardKey key, bool down)
+{
+    u8  bit = (u8)(1 << (key % 5));
+    u8* row = &keyboard->rows[key / 5];
+    u8  was = *row;
+    *row    = down ? (u8)(was | bit) : (u8)(was & ~bit);
+    return *row != was;
+}
+
+u8 keyboard_read(const Keyboard* keyboard, u8 high)
+{
+    u8 held = 0;
+    for (u32 row = 0; row < 8; ++row) {
+        if (!(high & (1 << row))) {
+            held |= keyboard->rows[row];
+        }
+    }
+    return (u8)~held;
+}
@@ -0,0 +1,73 @@
+//------------------------------------------------------------------------------
+// Keyboard
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "kore.h"
+
+// The Spectrum's 40 keys are wired as 8 half-rows of 5.  A read of port 0xFE
+// selects the half-rows whose address line, A8 to A15, is low, and each key
+// held down in any of them pulls its bit of D0-D4 low.  A key's value is its
+// half-row * 5 + its bit.
+typedef enum {
+    KeyboardKey_CapsShift,
+    KeyboardKey_Z,
+    KeyboardKey_X,
+    KeyboardKey_C,
+    KeyboardKey_V,
+
+    KeyboardKey_A,
+    KeyboardKey_S,
+    KeyboardKey_D,
+    KeyboardKey_F,
+    KeyboardKey_G,
+
+    KeyboardKey_Q,
+    KeyboardKey_W,
+    KeyboardKey_E,
+    KeyboardKey_R,
+    KeyboardKey_T,
+
+    KeyboardKey_1,
+    KeyboardKey_2,
+    KeyboardKey_3,
+    KeyboardKey_4,
+    KeyboardKey_5,
+
+    KeyboardKey_0,
+    KeyboardKey_9,
+    KeyboardKey_8,
+    KeyboardKey_7,
+    KeyboardKey_6,
+
+    KeyboardKey_P,
+    KeyboardKey_O,
+    KeyboardKey_I,
+    KeyboardKey_U,
+    KeyboardKey_Y,
+
+    KeyboardKey_Enter,
+    KeyboardKey_L,
+    KeyboardKey_K,
+    KeyboardKey_J,
+    KeyboardKey_H,
+
+    KeyboardKey_Space,
+    KeyboardKey_SymbolShift,
+    KeyboardKey_M,
+    KeyboardKey_N,
+    KeyboardKey_B,
+
+    KeyboardKey_COUNT,
+} KeyboardKey;
+
+typedef struct {
+    u8 rows[8]; // A set bit for each key held down in each half-row
+} Keyboard;
+
+// Press or release a key.  Returns false if it was already that way.
+bool keyboard_set(Keyboard* keyboard, KeyboardKey key, bool down);
+
+// Bits 0-4 of a read of port 0xFE with high on A8-A15, with bits 5-7 set
+u8 keyboard_read(const Keyboard* keyboard, u8 high);
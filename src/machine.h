@@ -0,0 +1,31 @@
+//------------------------------------------------------------------------------
+// Machine
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "ay.h"
+#include "beeper.h"
+#include "contention.h"
+#include "keyboard.h"
+#include "memory.h"
+#include "tape.h"
+#include "ula.h"
+#include "z80.h"
+
+// Everything in an emulated Spectrum, wired together by main.c
+typedef struct {
+    Memory               memory;
+    Z80                  z80;
+    Ula                  ula;
+    Beeper               beeper;
+    Ay                   ay;
+    bool                 has_ay; // The 128K models
+    Keyboard             keyboard;
+    const MachineTiming* timing;
+    Tape                 tape;
+    const u8*            autoload; // Keys still to type, or NULL
+    u32                  frames;   // Frames run since power on
+
+    u8 breakpoints[8192]; // The tape trap
+} Machine;
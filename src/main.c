@@ -1,21 +1,674 @@
 #define KORE_IMPLEMENTATION
 #include "kore.h"
 
+#include "audio.h"
+#include "ay.h"
+#include "beeper.h"
+#include "capture.h"
 #include "config.h"
+#include "contention.h"
 #include "frame.h"
+#include "journal.h"
+#include "keyboard.h"
+#include "machine.h"
 #include "memory.h"
-
-#include <math.h>
+#include "pacer.h"
+#include "rewind.h"
+#include "roms.h"
+#include "snapshot.h"
+#include "tape.h"
+#include "ula.h"
+#include "z80-test.h"
+#include "z80.h"
 
 #define WINDOW_SCALE 3
 
+// Above 1x, how often to show a frame when running as fast as possible
+#define UNLIMITED_SHOW_NS 20000000
+
+// The audio ring is kept this full by nudging the emulation speed up or down
+// by up to AUDIO_MAX_ADJUST.  Emptier risks running dry; fuller adds latency.
+#define AUDIO_TARGET_FILL 0.375
+#define AUDIO_MAX_ADJUST 0.005
+
+// Seconds of frames kept to step back through in a window, unless --rewind
+// says.  Nothing steps back in a headless run, so it keeps none unless asked.
+#define REWIND_SECONDS 60
+
+// With a tape in, the keys that start it loading are typed once the ROM has
+// had this long to boot
+#define AUTOLOAD_FRAMES 100
+
+// LOAD "" and ENTER on the 48K, and ENTER on the 128K menu's Tape Loader
+static const u8 g_autoload_48[]  = {0xef, '"', '"', 0x0d, 0};
+static const u8 g_autoload_128[] = {0x0d, 0};
+
+// The Spectrum key each host key presses.  Shift is CAPS SHIFT and Control
+// SYMBOL SHIFT.  Backspace rewinds and has no key.
+static const KeyboardKey g_frame_keys[FrameKey_COUNT] = {
+    [FrameKey_0]       = KeyboardKey_0,
+    [FrameKey_1]       = KeyboardKey_1,
+    [FrameKey_2]       = KeyboardKey_2,
+    [FrameKey_3]       = KeyboardKey_3,
+    [FrameKey_4]       = KeyboardKey_4,
+    [FrameKey_5]       = KeyboardKey_5,
+    [FrameKey_6]       = KeyboardKey_6,
+    [FrameKey_7]       = KeyboardKey_7,
+    [FrameKey_8]       = KeyboardKey_8,
+    [FrameKey_9]       = KeyboardKey_9,
+    [FrameKey_A]       = KeyboardKey_A,
+    [FrameKey_B]       = KeyboardKey_B,
+    [FrameKey_C]       = KeyboardKey_C,
+    [FrameKey_D]       = KeyboardKey_D,
+    [FrameKey_E]       = KeyboardKey_E,
+    [FrameKey_F]       = KeyboardKey_F,
+    [FrameKey_G]       = KeyboardKey_G,
+    [FrameKey_H]       = KeyboardKey_H,
+    [FrameKey_I]       = KeyboardKey_I,
+    [FrameKey_J]       = KeyboardKey_J,
+    [FrameKey_K]       = KeyboardKey_K,
+    [FrameKey_L]       = KeyboardKey_L,
+    [FrameKey_M]       = KeyboardKey_M,
+    [FrameKey_N]       = KeyboardKey_N,
+    [FrameKey_O]       = KeyboardKey_O,
+    [FrameKey_P]       = KeyboardKey_P,
+    [FrameKey_Q]       = KeyboardKey_Q,
+    [FrameKey_R]       = KeyboardKey_R,
+    [FrameKey_S]       = KeyboardKey_S,
+    [FrameKey_T]       = KeyboardKey_T,
+    [FrameKey_U]       = KeyboardKey_U,
+    [FrameKey_V]       = KeyboardKey_V,
+    [FrameKey_W]       = KeyboardKey_W,
+    [FrameKey_X]       = KeyboardKey_X,
+    [FrameKey_Y]       = KeyboardKey_Y,
+    [FrameKey_Z]       = KeyboardKey_Z,
+    [FrameKey_Enter]   = KeyboardKey_Enter,
+    [FrameKey_Space]   = KeyboardKey_Space,
+    [FrameKey_Shift]   = KeyboardKey_CapsShift,
+    [FrameKey_Control] = KeyboardKey_SymbolShift,
+};
+
+// The AY on the 128K models, and the keyboard and tape's EAR bit on port
+// 0xFE, answer reads so far
+static u8 port_in(void* user, u16 port)
+{
+    Machine* m = (Machine*)user;
+    if (m->has_ay && (port & 0xc002) == 0xc000) {
+        return ay_read(&m->ay);
+    }
+    if ((port & 1) == 0) {
+        u8 value = keyboard_read(&m->keyboard, (u8)(port >> 8));
+        if (tape_inserted(&m->tape)) {
+            Z80* z = &m->z80;
+            if (!tape_read_ear(&m->tape, z->t, z->pc.w)) {
+                value &= 0xbf;
+            }
+            tape_accelerate(&m->tape, z, value, m->timing->frame_tstates);
+        }
+        return value;
+    }
+    return 0xff;
+}
+
+static void port_out(void* user, u16 port, u8 value)
+{
+    Machine* m = (Machine*)user;
+    if ((port & 1) == 0) {
+        ula_set_border(&m->ula, m->z80.t, value & 7);
+        beeper_write(&m->beeper, m->z80.t, value);
+    }
+    if (m->has_ay && (port & 0x8002) == 0x8000) {
+        // 0xFFFD selects a register and 0xBFFD writes it
+        if (port & 0x4000) {
+            ay_select(&m->ay, value);
+        } else {
+            ay_write(&m->ay, m->z80.t, value);
+        }
+    }
+    mem_port_out(&m->memory, port, value);
+}
+
+// Upload only the lines of the screen the ULA has redrawn
+static void upload_dirty_lines(Ula* ula, GfxLayer* layer)
+{
+    for (u32 y = 0; y < WINDOW_HEIGHT; ++y) {
+        if (ula->dirty[y]) {
+            ula->dirty[y] = false;
+            gfx_layer_mark_dirty(layer, (int)y, 1);
+        }
+    }
+}
+
+// Run the CPU up to time t.  The only breakpoint is the tape trap, so each
+// stop is passed to the tape, which moves the CPU on if it loads a block.
+static void machine_run(Machine* m, u32 t)
+{
+    z80_run(&m->z80, t);
+    while (m->z80.stopped) {
+        tape_trap(&m->tape, &m->z80);
+        z80_run(&m->z80, t);
+    }
+}
+
+// Type the next key of the autoload sequence when the ROM has taken the last
+static void machine_autoload(Machine* m)
+{
+    if (!m->autoload || m->frames < AUTOLOAD_FRAMES) {
+        return;
+    }
+    u8 flags = mem_peek(&m->memory, SYSVAR_FLAGS);
+    if (flags & FLAGS_NEW_KEY) {
+        return;
+    }
+    mem_poke(&m->memory, SYSVAR_LAST_K, *m->autoload);
+    mem_poke(&m->memory, SYSVAR_FLAGS, flags | FLAGS_NEW_KEY);
+    if (*++m->autoload == 0) {
+        m->autoload = NULL;
+    }
+}
+
+// Finish a frame the CPU has run to the end of
+static void machine_end_frame(Machine* m)
+{
+    tape_end_frame(&m->tape, m->timing->frame_tstates);
+    m->frames++;
+    machine_autoload(m);
+}
+
+// Insert a tape, with the LD-BYTES trap unless it is to load in real time,
+// and have the ROM load it
+static bool machine_insert_tape(Machine* m, const char* path, bool realtime)
+{
+    if (!tape_open(&m->tape, path)) {
+        return false;
+    }
+    if (!realtime) {
+        m->breakpoints[TAPE_LD_BYTES >> 3] |= 1 << (TAPE_LD_BYTES & 7);
+        m->z80.breakpoints = m->breakpoints;
+    }
+    m->autoload = m->memory.model == MemoryModel_48K ? g_autoload_48
+                                                      : g_autoload_128;
+    return true;
+}
+
+// Restore a snapshot opened for the machine's model, with the AY's registers
+// and the time into the frame it was taken at
+static bool machine_load_snapshot(Machine* m, Snapshot* snap)
+{
+    if (!snapshot_load(snap, &m->memory, &m->z80)) {
+        return false;
+    }
+    if (snap->has_ay && m->has_ay) {
+        for (u8 reg = 0; reg < 16; ++reg) {
+            ay_select(&m->ay, reg);
+            ay_write(&m->ay, 0, snap->ay_regs[reg]);
+        }
+        ay_select(&m->ay, snap->ay_select);
+    }
+
+    // z80_start_frame takes a frame off before the first one runs
+    m->z80.t    = m->timing->frame_tstates + snap->tstates;
+    m->autoload = NULL;
+    return true;
+}
+
+// Render the frame's sound
+static void machine_end_audio(Machine* m)
+{
+    beeper_end_frame(&m->beeper, m->timing->frame_tstates);
+    if (m->has_ay) {
+        ay_end_frame(&m->ay, m->timing->frame_tstates);
+    }
+}
+
+// Run one frame, drawing the screen as the CPU goes if draw is set.  The time
+// spent in the CPU and the ULA is added to the frame's timings.
+static void machine_frame(Machine* m, Frame* f, bool draw)
+{
+    u32 frame_tstates = m->timing->frame_tstates;
+
+    z80_start_frame(&m->z80, frame_tstates, m->timing->int_length);
+    ula_start_frame(&m->ula, draw);
+    if (!draw) {
+        frame_time_begin(f, FramePhase_Emulate);
+        machine_run(m, frame_tstates);
+        machine_end_audio(m);
+        machine_end_frame(m);
+        frame_time_end(f, FramePhase_Emulate);
+        return;
+    }
+
+    // Run the CPU a line at a time so the ULA sees memory as it was when the
+    // beam passed each line
+    for (u32 y = 0; y < WINDOW_HEIGHT; ++y) {
+        u32 t = ula_line_time(y);
+        frame_time_begin(f, FramePhase_Emulate);
+        machine_run(m, t);
+        frame_time_end(f, FramePhase_Emulate);
+        frame_time_begin(f, FramePhase_Render);
+        ula_update(&m->ula, t);
+        frame_time_end(f, FramePhase_Render);
+    }
+    frame_time_begin(f, FramePhase_Emulate);
+    machine_run(m, frame_tstates);
+    machine_end_audio(m);
+    machine_end_frame(m);
+    frame_time_end(f, FramePhase_Emulate);
+    frame_time_begin(f, FramePhase_Render);
+    ula_update(&m->ula, frame_tstates);
+    frame_time_end(f, FramePhase_Render);
+}
+
+// Go back a frame in place of running one, if there is a frame to go back
+// to.  The screen is redrawn as it was at the end of the frame before, and the
+// frame's sound is silence.  The keys held stay the ones held now.
+static void machine_step_back(Machine* m, Rewind* rewind, bool draw)
+{
+    if (rewind) {
+        Keyboard keyboard = m->keyboard;
+        rewind_step_back(rewind, m);
+        m->keyboard = keyboard;
+    }
+    ula_start_frame(&m->ula, draw);
+    ula_update(&m->ula, m->timing->frame_tstates);
+    memset(m->beeper.samples, 0, sizeof(m->beeper.samples));
+    memset(m->ay.samples, 0, sizeof(m->ay.samples));
+}
+
+static i16 audio_sample(f32 s)
+{
+    s = s < -1.0f ? -1.0f : s > 1.0f ? 1.0f : s;
+    return (i16)(s * 32767.0f);
+}
+
+// Mix the last frame of sound into stereo frames, returning how many.  The
+// beeper and the AY can differ by a sample in a frame; the beeper sets the
+// count.
+static u32 mix_audio(const Machine* m, i16* frames)
+{
+    const Beeper* beeper = &m->beeper;
+    const Ay*     ay     = m->has_ay ? &m->ay : NULL;
+
+    for (u32 i = 0; i < beeper->num_samples; ++i) {
+        f32 left  = beeper->samples[i];
+        f32 right = beeper->samples[i];
+        if (ay && i < ay->num_samples) {
+            left += ay->samples[i * 2];
+            right += ay->samples[i * 2 + 1];
+        }
+        frames[i * 2]     = audio_sample(left);
+        frames[i * 2 + 1] = audio_sample(right);
+    }
+    return beeper->num_samples;
+}
+
+// Queue the last frame of sound for the audio thread
+static void play_audio(Audio* audio, const Machine* m)
+{
+    i16 frames[BEEPER_MAX_SAMPLES * AUDIO_CHANNELS];
+    audio_write(audio, frames, mix_audio(m, frames));
+}
+
+// Speed to run at to bring the audio ring back to its target fill
+static f64 audio_rate(Audio* audio)
+{
+    f64 error = (AUDIO_TARGET_FILL - audio_fill(audio)) / AUDIO_TARGET_FILL;
+    error     = error < -1.0 ? -1.0 : error > 1.0 ? 1.0 : error;
+    return 1.0 + error * AUDIO_MAX_ADJUST;
+}
+
+static void print_timing(const Frame* f)
+{
+    static const char* names[FramePhase_COUNT] = {
+        [FramePhase_Emulate] = "emu",
+        [FramePhase_Render]  = "render",
+        [FramePhase_Scale]   = "scale",
+        [FramePhase_Present] = "present",
+        [FramePhase_Events]  = "events",
+        [FramePhase_Frame]   = "frame",
+    };
+
+    FrameTimingStats total = frame_timing_stats(f, FramePhase_Frame);
+    printf("FPS: %.1f", total.avg > 0.0 ? 1.0 / total.avg : 0.0);
+    for (u32 i = 0; i < FramePhase_COUNT; ++i) {
+        FrameTimingStats ts = frame_timing_stats(f, (FramePhase)i);
+        printf("  %s %.2f/%.2fms", names[i], ts.avg * 1e3, ts.p99 * 1e3);
+    }
+    printf("\n");
+}
+
+static MemoryModel model_from_name(const char* name)
+{
+    static const char* names[] = {
+        [MemoryModel_48K]   = "48",
+        [MemoryModel_128K]  = "128",
+        [MemoryModel_Plus2] = "plus2",
+        [MemoryModel_Plus3] = "plus3",
+    };
+
+    for (u32 i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (strcmp(name, names[i]) == 0) {
+            return (MemoryModel)i;
+        }
+    }
+    $.eprn("Unknown model: %s (use 48, 128, plus2 or plus3)", name);
+    exit(EXIT_FAILURE);
+}
+
+// Run the ROM for a number of frames without a window and report the
+// emulated clock speed.  If capture is given, the sound is rendered into it
+// with no pacing.  If rewind is given, every frame is kept in it, and if
+// journal is, every frame is recorded.
+static int run_headless(Machine* m,
+                        u32      frames,
+                        Capture* capture,
+                        Rewind*  rewind,
+                        Journal* journal)
+{
+    i16 samples[BEEPER_MAX_SAMPLES * AUDIO_CHANNELS];
+
+    u32 frame_tstates = m->timing->frame_tstates;
+
+    KTimePoint start = $.time_now();
+    for (u32 i = 0; i < frames; ++i) {
+        z80_start_frame(&m->z80, frame_tstates, m->timing->int_length);
+        machine_run(m, frame_tstates);
+        machine_end_audio(m);
+        if (capture) {
+            capture_write(capture, samples, mix_audio(m, samples));
+        }
+        machine_end_frame(m);
+        if (rewind) {
+            rewind_push(rewind, m);
+        }
+        if (journal) {
+            journal_end_frame(journal, m);
+        }
+    }
+    f64 secs = $.time_secs($.time_diff(start, $.time_now()));
+
+    f64 mhz  = (f64)frames * frame_tstates / (secs * 1000000.0);
+    $.prn("%u frames in %.3fs: %.1f MHz", frames, secs, mhz);
+    if (rewind) {
+        $.prn("Rewind: %u frames in %.1f MB",
+              rewind->count,
+              (f64)rewind_memory(rewind) / (1024.0 * 1024.0));
+    }
+
+    if (capture) {
+        bool ok = capture_close(capture);
+        $.prn("Audio: %llu samples, hash %016llx",
+              (unsigned long long)capture->frames,
+              (unsigned long long)capture->hash);
+        if (!ok) {
+            $.eprn("Failed to write the audio capture");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Play a journal back without a window, as fast as it will go, from the last
+// keyframe at or before frame.  Reports the speed and the hash of the frames,
+// and fails if they didn't run as they did when recorded.
+static int run_replay(Machine* m, Journal* journal, u32 frame)
+{
+    if (!journal_seek(journal, m, frame)) {
+        return 1;
+    }
+
+    u32 frame_tstates = m->timing->frame_tstates;
+    u32 first         = journal->frame;
+
+    KTimePoint start = $.time_now();
+    for (;;) {
+        // Keyframes and jumps come between frames, so the frame only starts
+        // once a key is due after its first T-state
+        JournalEvent e;
+        bool         started = false;
+        while (journal_event(journal, m, &e)) {
+            if (e.t > 0 && !started) {
+                z80_start_frame(&m->z80, frame_tstates, m->timing->int_length);
+                started = true;
+            }
+            machine_run(m, e.t);
+            keyboard_set(&m->keyboard, e.key, e.down);
+        }
+        if (journal->ended) {
+            break;
+        }
+        if (!started) {
+            z80_start_frame(&m->z80, frame_tstates, m->timing->int_length);
+        }
+        machine_run(m, frame_tstates);
+        machine_end_frame(m);
+        journal_end_frame(journal, m);
+    }
+    f64 secs = $.time_secs($.time_diff(start, $.time_now()));
+
+    u32 frames = journal->frame - first;
+    f64 mhz    = (f64)frames * frame_tstates / (secs * 1000000.0);
+    $.prn("Replayed frames %u to %u in %.3fs: %.1f MHz",
+          first,
+          journal->frame,
+          secs,
+          mhz);
+    $.prn("Frames: hash %016llx", (unsigned long long)journal->hash);
+    if (!journal->clean) {
+        $.prn("The journal stops without an end, as if the run crashed");
+    }
+    if (journal->diverged > 0) {
+        $.eprn("Replay differs from the recording by frame %u",
+               journal->diverged);
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
     $.init();
     $.memory_break_on(5);
 
-    Memory memory = {0};
-    mem_init(&memory);
+    MemoryModel model    = MemoryModel_48K;
+    u32         headless = 0;
+    bool        vsync    = false;
+    bool        timing   = false; // Show a graph of the frame times
+    u32         speed    = 1; // Multiple of real time, or 0 for unlimited
+
+    // Where --headless sends the sound
+    CaptureMode capture_mode = CaptureMode_COUNT;
+    const char* capture_path = NULL;
+
+    const char* tape_path     = NULL;
+    bool        tape_realtime = false; // Load without the LD-BYTES trap
+    const char* snapshot_path = NULL;
+
+    // A folder of ROM files to use instead of the built-in ROMs
+    const char* roms_path = NULL;
+
+    u32  rewind_seconds = 0; // 0 to keep no history
+    bool rewind_given   = false;
+
+    // Where to record the input to, or play it back from
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    u32         seek        = 0; // Frame of the journal to play from
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--test") == 0) {
+            i32 failed = z80_test_run("etc/tests/tests.in",
+                                      "etc/tests/tests.expected");
+            $.done();
+            return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        } else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+            model = model_from_name(argv[++i]);
+        } else if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+            headless = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--vsync") == 0) {
+            vsync = true;
+        } else if (strcmp(argv[i], "--timing") == 0) {
+            timing = true;
+        } else if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc) {
+            capture_mode = CaptureMode_Wav;
+            capture_path = argv[++i];
+        } else if (strcmp(argv[i], "--raw") == 0 && i + 1 < argc) {
+            capture_mode = CaptureMode_Raw;
+            capture_path = argv[++i];
+        } else if (strcmp(argv[i], "--audio-hash") == 0) {
+            capture_mode = CaptureMode_Hash;
+        } else if (strcmp(argv[i], "--tape") == 0 && i + 1 < argc) {
+            tape_path = argv[++i];
+        } else if (strcmp(argv[i], "--tape-realtime") == 0) {
+            tape_realtime = true;
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_path = argv[++i];
+        } else if (strcmp(argv[i], "--roms") == 0 && i + 1 < argc) {
+            roms_path = argv[++i];
+        } else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+            rewind_seconds = (u32)atoi(argv[++i]);
+            rewind_given   = true;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+            seek = (u32)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            const char* value = argv[++i];
+            speed = strcmp(value, "max") == 0 ? 0 : (u32)atoi(value);
+        }
+    }
+    if (!rewind_given && headless == 0) {
+        rewind_seconds = REWIND_SECONDS;
+    }
+
+    // A journal brings its own setup, and its keyframes the rest
+    static Journal journal;
+    if (replay_path) {
+        if (!journal_open(&journal, replay_path)) {
+            $.done();
+            return EXIT_FAILURE;
+        }
+        model          = journal.setup.model;
+        tape_path      = journal.setup.tape_path;
+        tape_realtime  = journal.setup.tape_realtime;
+        roms_path      = journal.setup.roms_path;
+        snapshot_path  = NULL;
+        record_path    = NULL;
+        rewind_seconds = 0;
+    }
+
+    // A snapshot brings its own model
+    Snapshot snap = {0};
+    if (snapshot_path) {
+        if (!snapshot_open(&snap, snapshot_path)) {
+            $.done();
+            return EXIT_FAILURE;
+        }
+        model = snap.model;
+    }
+
+    Machine m = {0};
+    m.timing  = contention_timing(model);
+    u32 clock = m.timing->clock_hz;
+    mem_init(&m.memory, model);
+    if (!roms_load(&m.memory, roms_path)) {
+        snapshot_close(&snap);
+        journal_close(&journal);
+        mem_done(&m.memory);
+        $.done();
+        return EXIT_FAILURE;
+    }
+    beeper_init(&m.beeper, clock, AUDIO_SAMPLE_RATE);
+    m.has_ay = model != MemoryModel_48K;
+    ay_init(&m.ay, clock / 2, clock, AUDIO_SAMPLE_RATE);
+    ula_set_timing(m.timing->display_start, m.timing->line_tstates);
+
+    Z80* z80 = &m.z80;
+    z80_init(z80, &m.memory);
+    z80->port_in  = port_in;
+    z80->port_out = port_out;
+    z80->user     = &m;
+    contention_attach(z80, model);
+
+    if (tape_path && !machine_insert_tape(&m, tape_path, tape_realtime)) {
+        snapshot_close(&snap);
+        journal_close(&journal);
+        mem_done(&m.memory);
+        $.done();
+        return EXIT_FAILURE;
+    }
+
+    u8 border = 7;
+    if (snapshot_path) {
+        bool loaded = machine_load_snapshot(&m, &snap);
+        border      = snap.border;
+        snapshot_close(&snap);
+        if (!loaded) {
+            tape_close(&m.tape);
+            mem_done(&m.memory);
+            $.done();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (replay_path) {
+        int result = run_replay(&m, &journal, seek);
+        journal_close(&journal);
+        tape_close(&m.tape);
+        mem_done(&m.memory);
+        $.done();
+        return result;
+    }
+
+    // A journal records from the machine as it is once set up
+    JournalSetup setup    = {model, tape_path, tape_realtime, roms_path};
+    Journal*     recorder = record_path ? &journal : NULL;
+
+    Rewind  rewind  = {0};
+    Rewind* history = NULL;
+    if (rewind_seconds > 0) {
+        rewind_init(&rewind,
+                    rewind_seconds * clock / m.timing->frame_tstates);
+        history = &rewind;
+    }
+
+    if (headless > 0) {
+        static Capture capture;
+        Capture*       sink = NULL;
+        if (capture_mode != CaptureMode_COUNT) {
+            if (!capture_open(
+                    &capture, capture_mode, capture_path, AUDIO_SAMPLE_RATE)) {
+                rewind_done(&rewind);
+                tape_close(&m.tape);
+                mem_done(&m.memory);
+                $.done();
+                return EXIT_FAILURE;
+            }
+            sink = &capture;
+        }
+        if (history) {
+            rewind_reset(history, &m);
+        }
+        if (recorder && !journal_create(recorder, record_path, &setup, &m)) {
+            journal_close(recorder);
+            rewind_done(&rewind);
+            tape_close(&m.tape);
+            mem_done(&m.memory);
+            $.done();
+            return EXIT_FAILURE;
+        }
+        int result = run_headless(&m, headless, sink, history, recorder);
+        if (recorder && !journal_close(recorder)) {
+            $.eprn("Failed to write the journal");
+            result = 1;
+        }
+        rewind_done(&rewind);
+        tape_close(&m.tape);
+        mem_done(&m.memory);
+        $.done();
+        return result;
+    }
 
     Frame main_window = frame_open(WINDOW_WIDTH * WINDOW_SCALE,
                                    WINDOW_HEIGHT * WINDOW_SCALE,
@@ -24,71 +677,173 @@ int main(int argc, char** argv)
     u32* screen  = frame_add_layer(&main_window, WINDOW_WIDTH, WINDOW_HEIGHT);
     u32* overlay = frame_add_layer(&main_window, WINDOW_WIDTH, WINDOW_HEIGHT);
 
-    mem_load_file(&memory, 0x0000, "etc/roms/48.rom");
-    mem_load_file(&memory, 0x4000, "etc/screens/AticAtac.scr");
+    // The overlay stays transparent until there is something to show on it
+    GfxLayer* overlay_layer = frame_find_layer(&main_window, overlay);
+    memset(overlay, 0, WINDOW_WIDTH * WINDOW_HEIGHT * sizeof(u32));
+    gfx_layer_set_dirty_tracking(overlay_layer, true);
+    gfx_layer_mark_dirty(overlay_layer, 0, WINDOW_HEIGHT);
+
+    GfxLayer* screen_layer = frame_find_layer(&main_window, screen);
+    gfx_layer_set_dirty_tracking(screen_layer, true);
+    ula_init(&m.ula, &m.memory, screen);
+    if (snapshot_path) {
+        ula_set_border(&m.ula, 0, border);
+    } else {
+        mem_load_file(&m.memory, 0x4000, "etc/screens/AticAtac.scr");
+    }
+    if (history) {
+        rewind_reset(history, &m);
+    }
+    if (recorder && !journal_create(recorder, record_path, &setup, &m)) {
+        journal_close(recorder);
+        frame_free_pixels(screen);
+        frame_free_pixels(overlay);
+        rewind_done(&rewind);
+        tape_close(&m.tape);
+        mem_done(&m.memory);
+        $.done();
+        return EXIT_FAILURE;
+    }
+    bool rewinding = false; // Backspace is held down
+    bool rewound   = false; // Frames have been stepped back since the last run
+
+    // Pace by the display's refresh if asked and possible, else by sleeping.
+    // Faster speeds pace a faster clock, and only show some frames: every Nth
+    // at Nx, or 50 a second of real time when unlimited.
+    Pacer pacer;
+    vsync = vsync && speed == 1 && frame_set_vsync(&main_window, true);
+    pacer_init(&pacer,
+               m.timing->frame_tstates,
+               clock * (speed > 0 ? speed : 1),
+               vsync);
+    u32 hidden   = 0;
+    u64 shown_at = pacer_now();
+
+    // Sound only plays at real time
+    Audio audio;
+    bool  sound     = speed == 1 && audio_open(&audio);
+    u64   underruns = 0;
 
     while (frame_loop(&main_window)) {
         static unsigned frame = 0;
 
-        // Background layer: animated color pattern (fully opaque)
-        for (int y = 0; y < WINDOW_HEIGHT; ++y) {
-            u32* row = &screen[y * WINDOW_WIDTH];
-            for (int x = 0; x < WINDOW_WIDTH; ++x) {
-                unsigned r = (x + frame) & 0xFF;
-                unsigned g = (y + frame) & 0xFF;
-                unsigned b = ((x ^ y) + frame) & 0xFF;
-                row[x]     = 0xFF000000u | (r << 16) | (g << 8) |
-                         b; // ARGB - fully opaque
+        // Keys go into the matrix as the next frame starts
+        for (u32 i = 0; i < main_window.num_key_events; ++i) {
+            const FrameKeyEvent* e = &main_window.key_events[i];
+            if (e->key == FrameKey_Backspace) {
+                rewinding = e->down;
+                continue;
+            }
+            KeyboardKey key = g_frame_keys[e->key];
+            if (keyboard_set(&m.keyboard, key, e->down) && recorder) {
+                journal_key(recorder, 0, key, e->down);
             }
         }
 
-        // Overlay layer: test alpha blending with animated circles
-        for (int y = 0; y < WINDOW_HEIGHT; ++y) {
-            u32* row = &overlay[y * WINDOW_WIDTH];
-            for (int x = 0; x < WINDOW_WIDTH; ++x) {
-                // Create animated circles with varying alpha
-                int cx1 = WINDOW_WIDTH / 3 + (int)(30.0 * sin(frame * 0.05));
-                int cy1 = WINDOW_HEIGHT / 3 + (int)(20.0 * cos(frame * 0.03));
-                int cx2 =
-                    2 * WINDOW_WIDTH / 3 + (int)(25.0 * cos(frame * 0.04));
-                int cy2 =
-                    2 * WINDOW_HEIGHT / 3 + (int)(15.0 * sin(frame * 0.06));
-
-                int dx1 = x - cx1, dy1 = y - cy1;
-                int dx2 = x - cx2, dy2 = y - cy2;
-                int dist1 = dx1 * dx1 + dy1 * dy1;
-                int dist2 = dx2 * dx2 + dy2 * dy2;
-
-                u32 alpha = 0x00000000; // Fully transparent by default
-
-                // Red circle with 50% alpha
-                if (dist1 < 40 * 40) {
-                    alpha = 0x80FF0000; // 50% alpha red
+        // Run frames back to back until one is drawn to show
+        bool show = false;
+        for (;;) {
+            u32 due = speed == 0 ? 1 : pacer_frames_due(&pacer);
+            for (u32 i = 0; i < due; ++i) {
+                bool draw = speed == 1 ||
+                            (speed == 0
+                                 ? pacer_now() - shown_at >= UNLIMITED_SHOW_NS
+                                 : ++hidden >= speed);
+                if (rewinding) {
+                    machine_step_back(&m, history, draw);
+                    rewound = true;
+                } else {
+                    if (rewound && recorder) {
+                        journal_jump(recorder, &m);
+                    }
+                    rewound = false;
+                    machine_frame(&m, &main_window, draw);
+                    if (history) {
+                        rewind_push(history, &m);
+                    }
+                    if (recorder) {
+                        journal_end_frame(recorder, &m);
+                    }
                 }
-                // Blue circle with 75% alpha
-                else if (dist2 < 30 * 30) {
-                    alpha = 0xC0000000 | (0x0000FF); // 75% alpha blue
+                if (sound) {
+                    play_audio(&audio, &m);
                 }
-
-                row[x] = alpha;
+                show = show || draw;
+            }
+            if (show || speed == 1) {
+                break;
+            }
+            if (speed > 0) {
+                pacer_wait(&pacer);
             }
         }
+        hidden   = 0;
+        shown_at = pacer_now();
 
-        frame++;
+        frame_time_begin(&main_window, FramePhase_Render);
+        upload_dirty_lines(&m.ula, screen_layer);
+        if (timing) {
+            frame_timing_draw(
+                &main_window, overlay, WINDOW_WIDTH, WINDOW_HEIGHT);
+            gfx_layer_mark_dirty(overlay_layer,
+                                 WINDOW_HEIGHT - FRAME_GRAPH_HEIGHT,
+                                 FRAME_GRAPH_HEIGHT);
+        }
+        frame_time_end(&main_window, FramePhase_Render);
+
+        if (sound) {
+            pacer_set_rate(&pacer, audio_rate(&audio));
+        }
+        if (speed > 0) {
+            pacer_wait(&pacer);
+        }
+        frame_time_next(&main_window);
+
+        // Report the timings every 60 frames, and the pacer if it's struggling
+        if (++frame % 60 == 0) {
+            print_timing(&main_window);
+            PacerStats ps = pacer_stats(&pacer);
+            if (ps.late > 0 || ps.resyncs > 0) {
+                printf("Pacer: overshoot %.0f/%.0fus  jitter %.0f/%.0fus  "
+                       "late %llu  resyncs %llu\n",
+                       ps.overshoot * 1e6,
+                       ps.overshoot_max * 1e6,
+                       ps.jitter * 1e6,
+                       ps.jitter_max * 1e6,
+                       (unsigned long long)ps.late,
+                       (unsigned long long)ps.resyncs);
+            }
+            if (ps.errors > 0) {
+                printf("Pacer: %llu sleeps failed: %s\n",
+                       (unsigned long long)ps.errors,
+                       strerror(ps.error));
+            }
+            pacer_reset_stats(&pacer);
 
-        // Calculate FPS every frame, but display every 60 frames
-        f64 fps = frame_fps(&main_window);
-        if (frame % 60 == 0) {
-            printf("FPS: %.1f\n", fps);
+            u64 now_underruns = sound ? atomic_load(&audio.underruns) : 0;
+            if (now_underruns != underruns) {
+                printf("Audio: fill %.0f%%  underruns %llu\n",
+                       audio_fill(&audio) * 100.0,
+                       (unsigned long long)(now_underruns - underruns));
+                underruns = now_underruns;
+            }
         }
     }
 
     printf("Exiting...\n");
+    if (sound) {
+        audio_close(&audio);
+    }
 
     frame_free_pixels(screen);
     frame_free_pixels(overlay);
 
-    mem_done(&memory);
+    if (recorder && !journal_close(recorder)) {
+        $.eprn("Failed to write the journal");
+    }
+    rewind_done(&rewind);
+    tape_close(&m.tape);
+    mem_done(&m.memory);
     $.done();
     return 0;
 }
@@ -4,48 +4,240 @@
 
 #include "memory.h"
 
-void mem_init(Memory* memory)
+// RAM banks that the ULA contends on each model
+static const u8 g_contended_banks[MemoryModel_COUNT] = {
+    [MemoryModel_48K]   = 0x20, // Bank 5 at 0x4000
+    [MemoryModel_128K]  = 0xaa, // Odd banks
+    [MemoryModel_Plus2] = 0xaa,
+    [MemoryModel_Plus3] = 0xf0, // Banks 4-7
+    [MemoryModel_Ram64] = 0x00,
+};
+
+// RAM banks in each slot for the +3 special paging modes (0x1ffd bit 0)
+static const u8 g_special_banks[4][4] = {
+    {0, 1, 2, 3},
+    {4, 5, 6, 7},
+    {4, 5, 6, 3},
+    {4, 7, 6, 3},
+};
+
+// Set or clear bit n of a mask
+static u8 mem_set_bit(u8 mask, u8 n, bool set)
+{
+    return (u8)((mask & ~(1 << n)) | (set ? 1 << n : 0));
+}
+
+static void mem_map(Memory* memory, u8 slot, u8* bank, bool writable)
+{
+    memory->read[slot]  = bank;
+    memory->write[slot] = writable ? bank : memory->scratch;
+    memory->writable    = mem_set_bit(memory->writable, slot, writable);
+}
+
+static void mem_map_ram(Memory* memory, u8 slot, u8 bank)
+{
+    mem_map(memory, slot, memory->ram[bank], true);
+    memory->slot_bank[slot] = bank;
+    memory->dirty[slot]     = memory->page_dirty[bank];
+
+    bool contended    = (g_contended_banks[memory->model] >> bank) & 1;
+    bool shared       = (memory->banks_shared >> bank) & 1;
+    memory->contended = mem_set_bit(memory->contended, slot, contended);
+    memory->shared    = mem_set_bit(memory->shared, slot, shared);
+}
+
+static void mem_map_rom(Memory* memory, u8 slot, u8 bank)
+{
+    mem_map(memory, slot, memory->rom[bank], false);
+    memory->dirty[slot] = memory->page_dirty[MEM_RAM_BANKS];
+    memory->contended   = mem_set_bit(memory->contended, slot, false);
+    memory->shared      = mem_set_bit(memory->shared, slot, false);
+}
+
+// Rebuild the slot tables from the model and paging ports
+static void mem_update(Memory* memory)
+{
+    u8 p7 = memory->port_7ffd;
+    u8 p1 = memory->port_1ffd;
+
+    switch (memory->model) {
+    case MemoryModel_48K:
+        mem_map_rom(memory, 0, 0);
+        mem_map_ram(memory, 1, 5);
+        mem_map_ram(memory, 2, 2);
+        mem_map_ram(memory, 3, 0);
+        break;
+
+    case MemoryModel_128K:
+    case MemoryModel_Plus2:
+        mem_map_rom(memory, 0, (p7 >> 4) & 1);
+        mem_map_ram(memory, 1, 5);
+        mem_map_ram(memory, 2, 2);
+        mem_map_ram(memory, 3, p7 & 7);
+        break;
+
+    case MemoryModel_Plus3:
+        if (p1 & 1) {
+            const u8* banks = g_special_banks[(p1 >> 1) & 3];
+            for (u8 slot = 0; slot < 4; ++slot) {
+                mem_map_ram(memory, slot, banks[slot]);
+            }
+        } else {
+            mem_map_rom(memory, 0, ((p1 >> 1) & 2) | ((p7 >> 4) & 1));
+            mem_map_ram(memory, 1, 5);
+            mem_map_ram(memory, 2, 2);
+            mem_map_ram(memory, 3, p7 & 7);
+        }
+        break;
+
+    case MemoryModel_Ram64:
+    default:
+        for (u8 slot = 0; slot < 4; ++slot) {
+            mem_map_ram(memory, slot, slot);
+        }
+        break;
+    }
+
+    u8* screen = memory->ram[(p7 & 0x08) ? 7 : 5];
+    if (screen != memory->screen) {
+        memory->screen       = screen;
+        memory->screen_dirty = MEM_SCREEN_ALL_ROWS;
+    }
+}
+
+static MemBank* mem_bank_alloc(void)
+{
+    MemBank* bank = KORE_ARRAY_ALLOC(MemBank, 1);
+    bank->refs    = 1;
+    return bank;
+}
+
+static void mem_bank_release(MemBank* bank)
 {
-    memory->ram = KORE_ARRAY_ALLOC(u8, 65536); // Allocate 64KB of RAM
+    if (--bank->refs == 0) {
+        KORE_ARRAY_FREE(bank);
+    }
+}
 
-    for (u32 i = 0; i < 65536; i++) {
-        memory->ram[i] = 0xff;
+// Point bank n at a new MemBank, keeping the screen pointer on the same bank
+static void mem_set_bank(Memory* memory, u32 n, MemBank* bank)
+{
+    if (memory->screen == memory->ram[n]) {
+        memory->screen = bank->data;
     }
+    memory->banks[n] = bank;
+    memory->ram[n]   = bank->data;
+}
+
+void mem_init(Memory* memory, MemoryModel model)
+{
+    // ROM banks, then the scratch page
+    usize size           = (MEM_ROM_BANKS + 1) * MEM_PAGE_SIZE;
+    memory->data         = KORE_ARRAY_ALLOC(u8, size);
+    memory->model        = model;
+    memory->screen       = NULL;
+    memory->banks_shared = 0;
+
+    for (u32 i = 0; i < MEM_RAM_BANKS; i++) {
+        memory->banks[i] = mem_bank_alloc();
+        memory->ram[i]   = memory->banks[i]->data;
+        memset(memory->ram[i], 0xff, MEM_PAGE_SIZE);
+    }
+    mem_clear_dirty(memory);
+    for (u32 i = 0; i < MEM_ROM_BANKS; i++) {
+        memory->rom[i] = memory->data + i * MEM_PAGE_SIZE;
+        memset(memory->rom[i], 0x00, MEM_PAGE_SIZE);
+    }
+    memory->scratch = memory->data + MEM_ROM_BANKS * MEM_PAGE_SIZE;
+
+    mem_reset(memory);
 }
 
 void mem_done(Memory* memory)
 {
-    KORE_ARRAY_FREE(memory->ram);
-    memory->ram = NULL; // Set pointer to NULL after freeing
+    for (u32 i = 0; i < MEM_RAM_BANKS; i++) {
+        mem_bank_release(memory->banks[i]);
+        memory->banks[i] = NULL;
+    }
+    KORE_ARRAY_FREE(memory->data);
+    memory->data = NULL; // Set pointer to NULL after freeing
+}
+
+void mem_reset(Memory* memory) { mem_set_paging(memory, 0, 0); }
+
+void mem_set_paging(Memory* memory, u8 port_7ffd, u8 port_1ffd)
+{
+    memory->port_7ffd = port_7ffd;
+    memory->port_1ffd = port_1ffd;
+    mem_update(memory);
 }
 
 void mem_poke(Memory* memory, u16 addr, u8 value)
 {
-    if (addr >= 16384) {
-        memory->ram[addr] = value;
-    }
+    mem_write(memory, addr, value);
 }
 
-u8 mem_peek(Memory* memory, u16 addr) { return memory->ram[addr]; }
+u8 mem_peek(Memory* memory, u16 addr) { return mem_read(memory, addr); }
 
 void mem_poke16(Memory* memory, u16 addr, u16 value)
 {
-    mem_poke(memory, addr, (u8)(value & 0xFF));            // Lower byte
-    mem_poke(memory, addr + 1, (u8)((value >> 8) & 0xFF)); // Upper byte
+    mem_write16(memory, addr, value);
 }
 
-u16 mem_peek16(Memory* memory, u16 addr)
+u16 mem_peek16(Memory* memory, u16 addr) { return mem_read16(memory, addr); }
+
+// The Memory's own page for a ROM bank
+static u8* mem_rom_page(Memory* memory, u32 bank)
 {
-    u16 value = 0;
-    value |= (u16)mem_peek(memory, addr);          // Lower byte
-    value |= (u16)mem_peek(memory, addr + 1) << 8; // Upper byte
-    return value;
+    return memory->data + bank * MEM_PAGE_SIZE;
+}
+
+// Before a ROM in a slot is loaded into, make sure the bank is the Memory's
+// own page and not a read-only image
+static void mem_own_rom(Memory* memory, u32 slot)
+{
+    for (u32 i = 0; i < MEM_ROM_BANKS; ++i) {
+        u8* page = mem_rom_page(memory, i);
+        if (memory->rom[i] == memory->read[slot] && memory->rom[i] != page) {
+            memcpy(page, memory->rom[i], MEM_PAGE_SIZE);
+            memory->rom[i] = page;
+            mem_update(memory);
+            return;
+        }
+    }
 }
 
 void mem_load(Memory* memory, u16 addr, const u8* data, u16 size)
 {
-    if (addr + size <= 65536 && data != NULL) {
-        memcpy(memory->ram + addr, data, size);
+    if (addr + size > 65536 || data == NULL) {
+        return;
+    }
+
+    // Bypasses mem_write, so assume the screen has changed
+    memory->screen_dirty = MEM_SCREEN_ALL_ROWS;
+
+    u32 a = addr;
+    u32 n = size;
+    while (n > 0) {
+        u32 offset = a & MEM_PAGE_MASK;
+        u32 chunk  = MEM_PAGE_SIZE - offset;
+        if (chunk > n) {
+            chunk = n;
+        }
+        u32 slot = a >> MEM_PAGE_SHIFT;
+        if (!((memory->writable >> slot) & 1)) {
+            mem_own_rom(memory, slot);
+        } else if ((memory->shared >> slot) & 1) {
+            mem_unshare(memory, slot);
+        }
+        memcpy(memory->read[slot] + offset, data, chunk);
+        memset(memory->dirty[slot] + (offset >> MEM_DIRTY_SHIFT),
+               1,
+               ((offset + chunk - 1) >> MEM_DIRTY_SHIFT) -
+                   (offset >> MEM_DIRTY_SHIFT) + 1);
+        a += chunk;
+        data += chunk;
+        n -= chunk;
     }
 }
 
@@ -60,3 +252,145 @@ void mem_load_file(Memory* memory, u16 addr, const char* filename)
         exit(EXIT_FAILURE);
     }
 }
+
+void mem_set_rom(Memory* memory, u32 bank, const u8* image)
+{
+    memory->rom[bank] = (u8*)image;
+    mem_update(memory);
+}
+
+bool mem_load_rom_file(Memory* memory, u32 bank, const char* filename)
+{
+    KData data = $.data_load(filename);
+    if (!$.is_data_loaded(&data)) {
+        $.eprn("Failed to load ROM: %s", filename);
+        return false;
+    }
+
+    u8*   page = mem_rom_page(memory, bank);
+    usize size = data.size < MEM_PAGE_SIZE ? data.size : MEM_PAGE_SIZE;
+    memcpy(page, data.data, size);
+    $.data_unload(&data);
+
+    memory->rom[bank] = page;
+    mem_update(memory);
+    return true;
+}
+
+bool mem_basic_rom_paged(const Memory* memory)
+{
+    static const i8 basic_rom[MemoryModel_COUNT] = {
+        [MemoryModel_48K]   = 0,
+        [MemoryModel_128K]  = 1,
+        [MemoryModel_Plus2] = 1,
+        [MemoryModel_Plus3] = 3,
+        [MemoryModel_Ram64] = -1,
+    };
+
+    i8 rom = basic_rom[memory->model];
+    return rom >= 0 && memory->read[0] == memory->rom[rom];
+}
+
+void mem_port_out(Memory* memory, u16 port, u8 value)
+{
+    bool port_7ffd = false;
+    bool port_1ffd = false;
+
+    switch (memory->model) {
+    case MemoryModel_128K:
+    case MemoryModel_Plus2:
+        port_7ffd = (port & 0x8002) == 0x0000;
+        break;
+    case MemoryModel_Plus3:
+        port_7ffd = (port & 0xc002) == 0x4000;
+        port_1ffd = (port & 0xf002) == 0x1000;
+        break;
+    default:
+        return;
+    }
+
+    // Bit 5 of 0x7ffd locks the paging until the next reset
+    if (memory->port_7ffd & 0x20) {
+        return;
+    }
+
+    if (port_7ffd) {
+        memory->port_7ffd = value;
+        mem_update(memory);
+    } else if (port_1ffd) {
+        memory->port_1ffd = value;
+        mem_update(memory);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Saved states
+//------------------------------------------------------------------------------
+
+// Copy a bank that a saved state still holds.  If the states have all let go
+// of it, it is the Memory's alone again and can be written as it is.
+static void mem_unshare_bank(Memory* memory, u32 n)
+{
+    MemBank* bank = memory->banks[n];
+    if (bank->refs > 1) {
+        MemBank* copy = mem_bank_alloc();
+        memcpy(copy->data, bank->data, MEM_PAGE_SIZE);
+        mem_bank_release(bank);
+        mem_set_bank(memory, n, copy);
+    }
+    memory->banks_shared &= (u8)~(1 << n);
+    mem_update(memory);
+}
+
+void mem_unshare(Memory* memory, u32 slot)
+{
+    mem_unshare_bank(memory, memory->slot_bank[slot]);
+}
+
+u8* mem_ram_bank(Memory* memory, u32 bank)
+{
+    if ((memory->banks_shared >> bank) & 1) {
+        mem_unshare_bank(memory, bank);
+    }
+    memset(memory->page_dirty[bank], 1, MEM_DIRTY_PAGES);
+    return memory->ram[bank];
+}
+
+void mem_clear_dirty(Memory* memory)
+{
+    memset(memory->page_dirty, 0, sizeof(memory->page_dirty));
+}
+
+void mem_save(Memory* memory, MemoryState* state)
+{
+    for (u32 i = 0; i < MEM_RAM_BANKS; i++) {
+        state->banks[i] = memory->banks[i];
+        state->banks[i]->refs++;
+    }
+    memory->banks_shared = 0xff;
+    mem_update(memory);
+}
+
+void mem_restore(Memory* memory, const MemoryState* state)
+{
+    for (u32 i = 0; i < MEM_RAM_BANKS; i++) {
+        MemBank* bank = state->banks[i];
+        bank->refs++;
+        mem_bank_release(memory->banks[i]);
+        mem_set_bank(memory, i, bank);
+    }
+    memory->banks_shared = 0xff;
+    memory->screen_dirty = MEM_SCREEN_ALL_ROWS;
+    memset(memory->page_dirty, 1, sizeof(memory->page_dirty));
+    mem_update(memory);
+}
+
+void mem_state_free(MemoryState* state)
+{
+    for (u32 i = 0; i < MEM_RAM_BANKS; i++) {
+        if (state->banks[i]) {
+            mem_bank_release(state->banks[i]);
+            state->banks[i] = NULL;
+        }
+    }
+}
@@ -6,18 +6,205 @@
 
 #include "kore.h"
 
+#define MEM_PAGE_SIZE 16384
+#define MEM_PAGE_SHIFT 14
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+
+#define MEM_RAM_BANKS 8
+#define MEM_ROM_BANKS 4
+
+// Writes are tracked in 256-byte pages, 64 to a bank
+#define MEM_DIRTY_SHIFT 8
+#define MEM_DIRTY_SIZE (1 << MEM_DIRTY_SHIFT)
+#define MEM_DIRTY_PAGES (MEM_PAGE_SIZE >> MEM_DIRTY_SHIFT)
+
+// The display file: 6144 bytes of bitmap then 768 of attributes
+#define MEM_SCREEN_SIZE 6912
+#define MEM_SCREEN_BITMAP_SIZE 6144
+#define MEM_SCREEN_ROWS 24
+#define MEM_SCREEN_ALL_ROWS ((1u << MEM_SCREEN_ROWS) - 1)
+
+typedef enum {
+    MemoryModel_48K,
+    MemoryModel_128K,
+    MemoryModel_Plus2,
+    MemoryModel_Plus3,
+    MemoryModel_Ram64, // 64K of RAM and no ROM, as the CPU tests expect
+
+    MemoryModel_COUNT,
+} MemoryModel;
+
+// A RAM bank, shared by a Memory and the states saved from it.  Whoever
+// drops the last reference frees it.
+typedef struct {
+    u8  data[MEM_PAGE_SIZE];
+    u32 refs;
+} MemBank;
+
+// The 64K address space is four 16K slots, each pointing at a ROM or RAM bank.
+// Paging only swaps pointers.  Writes go through a second table in which
+// read-only slots point at a scratch page, so reads never branch and writes
+// only check that the bank isn't shared.
 typedef struct {
-    u8* ram;
+    MemoryModel model;
+
+    u8* read[4];   // Bank mapped into each slot
+    u8* write[4];  // Same as read, or the scratch page if the slot is read-only
+    u8  writable;  // Bit n is set if slot n accepts writes
+    u8  contended; // Bit n is set if slot n is contended by the ULA
+    u8  shared;    // Bit n is set if slot n's bank must be copied before writes
+
+    // The RAM banks, and the one in each slot that holds RAM.  Bit n of
+    // banks_shared is set if bank n may be held by a saved state.
+    MemBank* banks[MEM_RAM_BANKS];
+    u8       slot_bank[4];
+    u8       banks_shared;
+
+    // A flag for each 256-byte page of each RAM bank, set by every write to
+    // it and cleared by whoever is tracking changes.  dirty points each slot
+    // at its bank's flags, or a row nothing reads for ROM, so writes store a
+    // byte without a branch.
+    u8* dirty[4];
+    u8  page_dirty[MEM_RAM_BANKS + 1][MEM_DIRTY_PAGES];
+
+    u8* ram[MEM_RAM_BANKS]; // The data of each bank
+    u8* rom[MEM_ROM_BANKS]; // May point at a read-only image outside data
+
+    // Bank the ULA displays (5, or 7 on the 128K models)
+    u8* screen;
+
+    // Bit n is set if character row n of the display (its 8 bitmap lines or
+    // its attributes) has been written since the ULA last looked.  The ULA
+    // clears it.
+    u32 screen_dirty;
+
+    u8 port_7ffd; // Last value written to the 128K paging port
+    u8 port_1ffd; // Last value written to the +3 paging port
+
+    u8* data;    // Backing store for the ROM banks
+    u8* scratch; // Sink for writes to ROM
 } Memory;
 
-void mem_init(Memory* memory);
+// The RAM of a Memory, with a reference to each bank.  The paging is saved
+// with the ports.
+typedef struct {
+    MemBank* banks[MEM_RAM_BANKS];
+} MemoryState;
+
+void mem_init(Memory* memory, MemoryModel model);
 void mem_done(Memory* memory);
 
+// Restore the power-on paging
+void mem_reset(Memory* memory);
+
+// Set both paging ports at once, as a snapshot restores them, even if the
+// paging is locked
+void mem_set_paging(Memory* memory, u8 port_7ffd, u8 port_1ffd);
+
+// Out-of-line accessors for the debugger and tools
 void mem_poke(Memory* memory, u16 addr, u8 value);
 u8   mem_peek(Memory* memory, u16 addr);
 
 void mem_poke16(Memory* memory, u16 addr, u16 value);
 u16  mem_peek16(Memory* memory, u16 addr);
 
+// Copy data into whatever is mapped at addr, ROM included.  A ROM bank that
+// points at an image is copied into the Memory's own page first.
 void mem_load(Memory* memory, u16 addr, const u8* data, u16 size);
 void mem_load_file(Memory* memory, u16 addr, const char* filename);
+
+// Point a ROM bank at a MEM_PAGE_SIZE image that outlives the Memory, such as
+// one built into nx.  Nothing is copied and nothing writes to it.
+void mem_set_rom(Memory* memory, u32 bank, const u8* image);
+
+// Load a ROM bank from a file into the Memory's own page.  Returns false if
+// the file can't be read.
+bool mem_load_rom_file(Memory* memory, u32 bank, const char* filename);
+
+// A RAM bank to write to directly, copied first if a saved state shares it.
+// Its pages are all flagged dirty.
+u8* mem_ram_bank(Memory* memory, u32 bank);
+
+// Clear the dirty flags of every page
+void mem_clear_dirty(Memory* memory);
+
+// Share the RAM banks with the state, which costs no copying.  Each bank is
+// copied the first time the Memory writes to it after.
+void mem_save(Memory* memory, MemoryState* state);
+
+// Go back to a saved state's RAM, sharing its banks again.  The paging is
+// left as it is, for mem_set_paging.
+void mem_restore(Memory* memory, const MemoryState* state);
+
+// Drop a saved state's references to its banks
+void mem_state_free(MemoryState* state);
+
+// Give a shared bank in a slot its own copy.  mem_write calls this.
+void mem_unshare(Memory* memory, u32 slot);
+
+// True if the ROM with 48 BASIC (and the tape routines) is paged in at 0x0000
+bool mem_basic_rom_paged(const Memory* memory);
+
+// Handle a write to an I/O port.  Writes to the 0x7ffd and 0x1ffd paging ports
+// remap the slots; anything else is ignored.
+void mem_port_out(Memory* memory, u16 port, u8 value);
+
+//------------------------------------------------------------------------------
+// Inline accessors
+//
+// The CPU core makes several accesses per instruction, so these are defined
+// here to be inlined into it.  They behave exactly like mem_peek and friends.
+//------------------------------------------------------------------------------
+
+static inline u8 mem_read(const Memory* memory, u16 addr)
+{
+    return memory->read[addr >> MEM_PAGE_SHIFT][addr & MEM_PAGE_MASK];
+}
+
+// Character row (0-23) of an offset into the display file
+static inline u32 mem_screen_row(u32 offset)
+{
+    // Bitmap addresses are 010T TLLL RRRC CCCC: third T, line L, row R
+    return offset < MEM_SCREEN_BITMAP_SIZE
+               ? ((offset >> 8) & 0x18) | ((offset >> 5) & 0x07)
+               : (offset - MEM_SCREEN_BITMAP_SIZE) >> 5;
+}
+
+static inline void mem_write(Memory* memory, u16 addr, u8 value)
+{
+    // Only the first write to a bank after a save copies it; telling the
+    // compiler so keeps the call out of the CPU core's fast path
+    u32 slot = addr >> MEM_PAGE_SHIFT;
+    if (__builtin_expect((memory->shared >> slot) & 1, 0)) {
+        mem_unshare(memory, slot);
+    }
+    u32 offset = addr & MEM_PAGE_MASK;
+    u8* p      = memory->write[slot] + offset;
+    *p         = value;
+    memory->dirty[slot][offset >> MEM_DIRTY_SHIFT] = 1;
+
+    // The display file starts its bank, so this is a single unsigned compare
+    // for "inside the displayed screen"
+    usize screen = (usize)(p - memory->screen);
+    if (screen < MEM_SCREEN_SIZE) {
+        memory->screen_dirty |= 1u << mem_screen_row((u32)screen);
+    }
+}
+
+static inline u16 mem_read16(const Memory* memory, u16 addr)
+{
+    return (u16)(mem_read(memory, addr) |
+                 (mem_read(memory, (u16)(addr + 1)) << 8));
+}
+
+static inline void mem_write16(Memory* memory, u16 addr, u16 value)
+{
+    mem_write(memory, addr, (u8)value);
+    mem_write(memory, (u16)(addr + 1), (u8)(value >> 8));
+}
+
+// True if the ULA contends accesses to addr
+static inline bool mem_contended(const Memory* memory, u16 addr)
+{
+    return (memory->contended >> (addr >> MEM_PAGE_SHIFT)) & 1;
+}
@@ -0,0 +1,191 @@
+//------------------------------------------------------------------------------
+// Frame pacing
+//------------------------------------------------------------------------------
+
+#include "pacer.h"
+
+#include <math.h>
+
+#if KORE_OS_WINDOWS
+// Sleep() is only good to a millisecond or so; spin for the rest
+#    define PACER_SPIN_NS 2000000
+#else
+#    include <errno.h>
+#    include <time.h>
+#endif
+
+u64 pacer_now(void)
+{
+#if KORE_OS_WINDOWS
+    static LARGE_INTEGER freq = {0};
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    LARGE_INTEGER count;
+    QueryPerformanceCounter(&count);
+    u64 secs = (u64)(count.QuadPart / freq.QuadPart);
+    u64 rest = (u64)(count.QuadPart % freq.QuadPart);
+    return secs * 1000000000ull + rest * 1000000000ull / (u64)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+#endif
+}
+
+// Sleep until the monotonic clock reaches deadline.  Returns 0, or the error
+// the sleep failed with, in which case it returns early.
+static int pacer_sleep_until(u64 deadline)
+{
+#if KORE_OS_LINUX
+    struct timespec ts = {
+        .tv_sec  = (time_t)(deadline / 1000000000ull),
+        .tv_nsec = (long)(deadline % 1000000000ull),
+    };
+    // A signal can cut the sleep short; the deadline is absolute, so go again
+    int error;
+    do {
+        error = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    } while (error == EINTR);
+    return error;
+#elif KORE_OS_WINDOWS
+    u64 now = pacer_now();
+    if (deadline > now + PACER_SPIN_NS) {
+        Sleep((DWORD)((deadline - now - PACER_SPIN_NS) / 1000000));
+    }
+    while (pacer_now() < deadline) {
+        YieldProcessor();
+    }
+    return 0;
+#else
+    // No absolute sleep, so sleep for what's left, again after a signal
+    for (u64 now = pacer_now(); now < deadline; now = pacer_now()) {
+        u64             left = deadline - now;
+        struct timespec ts   = {
+              .tv_sec  = (time_t)(left / 1000000000ull),
+              .tv_nsec = (long)(left % 1000000000ull),
+        };
+        if (nanosleep(&ts, NULL) != 0 && errno != EINTR) {
+            return errno;
+        }
+    }
+    return 0;
+#endif
+}
+
+static u64 pacer_deadline(const Pacer* pacer, u64 frame)
+{
+    return pacer->origin + (u64)((f64)frame * pacer->period_ns);
+}
+
+void pacer_init(Pacer* pacer, u32 frame_tstates, u32 clock_hz, bool vsync)
+{
+    *pacer           = (Pacer){0};
+    pacer->base_ns   = (f64)frame_tstates * 1e9 / (f64)clock_hz;
+    pacer->period_ns = pacer->base_ns;
+    pacer->vsync     = vsync;
+    pacer->origin    = pacer_now();
+    pacer->last_wake = pacer->origin;
+}
+
+u32 pacer_frames_due(Pacer* pacer)
+{
+    u64 now = pacer_now();
+
+    // Frames whose start time has passed and haven't been handed out
+    u64 elapsed = now - pacer->origin;
+    u64 started = (u64)((f64)elapsed / pacer->period_ns) + 1;
+    u64 due     = started > pacer->frames ? started - pacer->frames : 0;
+
+    if (due > PACER_MAX_CATCH_UP) {
+        // Too far behind to catch up, so start again from now
+        pacer->skipped += due - 1;
+        pacer->resyncs++;
+        pacer->frames     = 0;
+        pacer->origin     = now;
+        pacer->last_wake  = now;
+        pacer->wake_frame = 0;
+        due               = 1;
+    }
+
+    pacer->frames += due;
+    return (u32)due;
+}
+
+void pacer_wait(Pacer* pacer)
+{
+    if (pacer->vsync) {
+        return;
+    }
+
+    u64 deadline = pacer_deadline(pacer, pacer->frames);
+    int error    = pacer_sleep_until(deadline);
+    if (error != 0) {
+        pacer->errors++;
+        pacer->error = error;
+    }
+    u64 now = pacer_now();
+
+    // A failed sleep wakes before the deadline, which isn't an overshoot
+    u64 late_ns = now > deadline ? now - deadline : 0;
+
+    // Compare the time since the last wake-up with the frames run in it
+    f64 overshoot     = (f64)late_ns * 1e-9;
+    f64 interval      = (f64)(now - pacer->last_wake);
+    f64 frames_run    = (f64)(pacer->frames - pacer->wake_frame);
+    f64 jitter        = fabs(interval - frames_run * pacer->period_ns) * 1e-9;
+    pacer->last_wake  = now;
+    pacer->wake_frame = pacer->frames;
+
+    pacer->waits++;
+    if (late_ns > PACER_LATE_NS) {
+        pacer->late++;
+    }
+    pacer->overshoot_sum += overshoot;
+    pacer->jitter_sum += jitter;
+    if (overshoot > pacer->overshoot_max) {
+        pacer->overshoot_max = overshoot;
+    }
+    if (jitter > pacer->jitter_max) {
+        pacer->jitter_max = jitter;
+    }
+}
+
+void pacer_set_rate(Pacer* pacer, f64 rate)
+{
+    // Keep the next deadline where it is and space the rest at the new period
+    u64 next         = pacer_deadline(pacer, pacer->frames);
+    pacer->period_ns = pacer->base_ns / rate;
+    pacer->origin    = next - (u64)((f64)pacer->frames * pacer->period_ns);
+}
+
+PacerStats pacer_stats(const Pacer* pacer)
+{
+    f64 waits = pacer->waits > 0 ? (f64)pacer->waits : 1.0;
+    return (PacerStats){
+        .waits         = pacer->waits,
+        .late          = pacer->late,
+        .resyncs       = pacer->resyncs,
+        .skipped       = pacer->skipped,
+        .errors        = pacer->errors,
+        .error         = pacer->error,
+        .overshoot     = pacer->overshoot_sum / waits,
+        .overshoot_max = pacer->overshoot_max,
+        .jitter        = pacer->jitter_sum / waits,
+        .jitter_max    = pacer->jitter_max,
+    };
+}
+
+void pacer_reset_stats(Pacer* pacer)
+{
+    pacer->waits         = 0;
+    pacer->late          = 0;
+    pacer->resyncs       = 0;
+    pacer->skipped       = 0;
+    pacer->errors        = 0;
+    pacer->error         = 0;
+    pacer->overshoot_sum = 0;
+    pacer->overshoot_max = 0;
+    pacer->jitter_sum    = 0;
+    pacer->jitter_max    = 0;
+}
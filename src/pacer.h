@@ -0,0 +1,78 @@
+//------------------------------------------------------------------------------
+// Frame pacing
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "kore.h"
+
+// Ties emulated frames to the wall clock.  Frame n is due at origin + n
+// periods, so sleeping to absolute deadlines never accumulates drift.  Each
+// host frame, pacer_frames_due says how many emulated frames to run, and
+// pacer_wait sleeps until the last of them should have finished.
+//
+// When sleeping, pacer_frames_due is normally 1, but it catches up after a
+// short hiccup.  In vsync mode the display paces the loop instead, so
+// pacer_wait doesn't sleep and pacer_frames_due is 0 or more, whatever keeps
+// emulation on time at the display's refresh rate.
+//
+// If emulation falls more than PACER_MAX_CATCH_UP frames behind (a stall,
+// the debugger, a dragged window), the schedule is restarted from now instead
+// of running a burst of frames.
+#define PACER_MAX_CATCH_UP 4
+
+// A wake-up more than this after the deadline counts as late
+#define PACER_LATE_NS 1000000
+
+typedef struct {
+    u64 waits;       // Calls to pacer_wait that slept
+    u64 late;        // Wake-ups more than PACER_LATE_NS after the deadline
+    u64 resyncs;     // Times the schedule was restarted
+    u64 skipped;     // Frames dropped by resyncs
+    u64 errors;      // Sleeps that failed and returned early
+    int error;       // The error the last of them failed with
+    f64 overshoot;   // Average time woken after the deadline, in seconds
+    f64 overshoot_max;
+    f64 jitter;      // Average difference of wake-up intervals from the period
+    f64 jitter_max;
+} PacerStats;
+
+typedef struct {
+    f64  base_ns;    // Host time per emulated frame at the nominal rate
+    f64  period_ns;  // Host time per emulated frame
+    bool vsync;      // The display paces frames; don't sleep
+    u64  origin;     // Time frame 0 was due, in nanoseconds
+    u64  frames;     // Frames handed out by pacer_frames_due since origin
+    u64  last_wake;  // Time the last wait finished
+    u64  wake_frame; // Value of frames at the last wake-up
+
+    // Running totals for pacer_stats
+    u64 waits;
+    u64 late;
+    u64 resyncs;
+    u64 skipped;
+    u64 errors;
+    int error;
+    f64 overshoot_sum;
+    f64 overshoot_max;
+    f64 jitter_sum;
+    f64 jitter_max;
+} Pacer;
+
+// Frames last frame_tstates T-states of a clock_hz clock
+void pacer_init(Pacer* pacer, u32 frame_tstates, u32 clock_hz, bool vsync);
+
+u32  pacer_frames_due(Pacer* pacer);
+void pacer_wait(Pacer* pacer);
+
+// Run slightly faster (rate > 1) or slower than the nominal rate, from the
+// next frame on.  Used to keep the audio buffer at a steady fill level, as the
+// sound card's clock never quite matches the host's.
+void pacer_set_rate(Pacer* pacer, f64 rate);
+
+// Statistics since the last pacer_reset_stats
+PacerStats pacer_stats(const Pacer* pacer);
+void       pacer_reset_stats(Pacer* pacer);
+
+// Monotonic time in nanoseconds
+u64 pacer_now(void);
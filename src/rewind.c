@@ -0,0 +1,225 @@
+//------------------------------------------------------------------------------
+// Rewind
+//------------------------------------------------------------------------------
+
+#include "rewind.h"
+
+#include <string.h>
+
+#define REWIND_SHADOW_SIZE (MEM_RAM_BANKS * MEM_PAGE_SIZE)
+#define REWIND_PAGES (MEM_RAM_BANKS * MEM_DIRTY_PAGES)
+
+// A changed page is its 16-bit index, then pairs of a count of unchanged
+// bytes to skip and a count of changed bytes that follow it, until the page
+// is covered.  Fewer than REWIND_MIN_SKIP unchanged bytes are cheaper left in
+// with the changes.
+#define REWIND_MIN_SKIP 3
+
+// Most bytes a page can code to, and a whole machine's worth
+#define REWIND_PAGE_BOUND (2 + 2 * MEM_DIRTY_SIZE)
+#define REWIND_MAX_DIFF (REWIND_PAGES * REWIND_PAGE_BOUND)
+
+void rewind_init(Rewind* r, u32 frames)
+{
+    memset(r, 0, sizeof(*r));
+    r->capacity  = frames > 2 ? frames : 2;
+    r->frames    = KORE_ARRAY_ALLOC(RewindFrame, r->capacity);
+    r->data_size = r->capacity * REWIND_FRAME_BYTES;
+    if (r->data_size < REWIND_MAX_DIFF) {
+        r->data_size = REWIND_MAX_DIFF;
+    }
+    r->data   = KORE_ARRAY_ALLOC(u8, r->data_size);
+    r->shadow = KORE_ARRAY_ALLOC(u8, REWIND_SHADOW_SIZE);
+}
+
+void rewind_done(Rewind* r)
+{
+    if (!r->frames) {
+        return;
+    }
+    KORE_ARRAY_FREE(r->frames);
+    KORE_ARRAY_FREE(r->data);
+    KORE_ARRAY_FREE(r->shadow);
+    memset(r, 0, sizeof(*r));
+}
+
+static RewindFrame* rewind_frame(Rewind* r, u32 i)
+{
+    return &r->frames[(r->first + i) % r->capacity];
+}
+
+static void rewind_drop_oldest(Rewind* r)
+{
+    r->first = (r->first + 1) % r->capacity;
+    r->count--;
+}
+
+// Move write to size free bytes, dropping the oldest frames until there are.
+// Live data runs from the oldest frame's offset round to write, so when it
+// has wrapped, write must stay short of that offset for the two to be told
+// apart.
+static void rewind_make_room(Rewind* r, u32 size)
+{
+    for (; r->count > 0; rewind_drop_oldest(r)) {
+        u32 head = rewind_frame(r, 0)->offset;
+        if (r->write >= head) {
+            if (r->data_size - r->write >= size) {
+                return;
+            }
+            if (head > size) {
+                r->write = 0;
+                return;
+            }
+        } else if (head - r->write > size) {
+            return;
+        }
+    }
+    r->write = 0;
+}
+
+// Code the difference between a page of RAM and the shadow, and bring the
+// shadow up to date.  Returns the end of the code, which is out if the page
+// is unchanged.
+static u8* rewind_code_page(u8* out, u32 index, u8* shadow, const u8* ram)
+{
+    u8 diff[MEM_DIRTY_SIZE];
+    u8 any = 0;
+    for (u32 i = 0; i < MEM_DIRTY_SIZE; ++i) {
+        diff[i] = ram[i] ^ shadow[i];
+        any |= diff[i];
+    }
+    if (!any) {
+        return out;
+    }
+    memcpy(shadow, ram, MEM_DIRTY_SIZE);
+
+    *out++ = (u8)index;
+    *out++ = (u8)(index >> 8);
+    for (u32 i = 0; i < MEM_DIRTY_SIZE;) {
+        u32 skip = 0;
+        while (i < MEM_DIRTY_SIZE && diff[i] == 0 && skip < 255) {
+            i++;
+            skip++;
+        }
+
+        // Changes run on to the end of the page or the next long enough gap
+        u32 start = i;
+        while (i < MEM_DIRTY_SIZE && i - start < 255) {
+            u32 gap = 0;
+            while (gap < REWIND_MIN_SKIP && i + gap < MEM_DIRTY_SIZE &&
+                   diff[i + gap] == 0) {
+                gap++;
+            }
+            if (gap == REWIND_MIN_SKIP || i + gap == MEM_DIRTY_SIZE) {
+                break;
+            }
+            i++;
+        }
+
+        *out++ = (u8)skip;
+        *out++ = (u8)(i - start);
+        memcpy(out, diff + start, i - start);
+        out += i - start;
+    }
+    return out;
+}
+
+// Apply a frame's difference to RAM and the shadow
+static void rewind_apply(Rewind* r, Memory* memory, const RewindFrame* frame)
+{
+    const u8* p   = r->data + frame->offset;
+    const u8* end = p + frame->size;
+    while (p < end) {
+        u32 index = (u32)(p[0] | (p[1] << 8));
+        u32 bank  = index / MEM_DIRTY_PAGES;
+        u32 page  = index % MEM_DIRTY_PAGES;
+        p += 2;
+
+        u8* shadow = r->shadow + index * MEM_DIRTY_SIZE;
+        for (u32 i = 0; i < MEM_DIRTY_SIZE;) {
+            i += *p++;
+            u32 n = *p++;
+            for (u32 j = 0; j < n; ++j) {
+                shadow[i++] ^= *p++;
+            }
+        }
+
+        u8* ram = mem_ram_bank(memory, bank) + page * MEM_DIRTY_SIZE;
+        memcpy(ram, shadow, MEM_DIRTY_SIZE);
+    }
+}
+
+void rewind_reset(Rewind* r, Machine* m)
+{
+    r->first = 0;
+    r->count = 0;
+    r->write = 0;
+    for (u32 i = 0; i < MEM_RAM_BANKS; ++i) {
+        memcpy(r->shadow + i * MEM_PAGE_SIZE, m->memory.ram[i], MEM_PAGE_SIZE);
+    }
+    mem_clear_dirty(&m->memory);
+    rewind_push(r, m);
+}
+
+void rewind_push(Rewind* r, Machine* m)
+{
+    Memory* memory = &m->memory;
+    if (r->count == r->capacity) {
+        rewind_drop_oldest(r);
+    }
+
+    // The flags are 0 or 1, so they are read 8 at a time and counted by a
+    // multiply that adds a word's bytes into its top byte
+    const u8* flags = memory->page_dirty[0];
+    u32       dirty = 0;
+    for (u32 i = 0; i < REWIND_PAGES; i += 8) {
+        u64 word;
+        memcpy(&word, flags + i, sizeof(word));
+        dirty += (u32)((word * 0x0101010101010101ull) >> 56);
+    }
+    rewind_make_room(r, dirty * REWIND_PAGE_BOUND);
+
+    u8* start = r->data + r->write;
+    u8* out   = start;
+    for (u32 i = 0; dirty > 0; ++i) {
+        if (flags[i]) {
+            out = rewind_code_page(out,
+                                   i,
+                                   r->shadow + i * MEM_DIRTY_SIZE,
+                                   memory->ram[i / MEM_DIRTY_PAGES] +
+                                       (i % MEM_DIRTY_PAGES) * MEM_DIRTY_SIZE);
+            dirty--;
+        }
+    }
+    mem_clear_dirty(memory);
+
+    // The oldest frame has nothing before it to differ from
+    RewindFrame* frame = rewind_frame(r, r->count);
+    frame->offset      = r->write;
+    frame->size        = r->count > 0 ? (u32)(out - start) : 0;
+    state_save_chips(&frame->chips, m);
+    r->write += frame->size;
+    r->count++;
+}
+
+bool rewind_step_back(Rewind* r, Machine* m)
+{
+    if (r->count < 2) {
+        return false;
+    }
+
+    RewindFrame* newest = rewind_frame(r, r->count - 1);
+    rewind_apply(r, &m->memory, newest);
+    r->write = newest->offset;
+    r->count--;
+
+    state_restore_chips(&rewind_frame(r, r->count - 1)->chips, m);
+    mem_clear_dirty(&m->memory);
+    return true;
+}
+
+usize rewind_memory(const Rewind* r)
+{
+    return r->capacity * sizeof(RewindFrame) + r->data_size +
+           REWIND_SHADOW_SIZE;
+}
@@ -0,0 +1,64 @@
+//------------------------------------------------------------------------------
+// Rewind
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "state.h"
+
+// The last few seconds of a machine, a state per frame, to step back through
+// one frame at a time.
+//
+// Each frame keeps the CPU and chips as they were at its end, and the RAM as
+// the difference from the frame before: the 256-byte pages written during the
+// frame, XORed with a shadow copy of RAM at the end of the last one and
+// run-length coded.  A page written back with what it held costs nothing.
+// Since XOR undoes itself, stepping back applies the newest frame's
+// difference to RAM and the shadow alike and restores the frame before's
+// chips, which takes as long as the frame's few pages of changes.
+//
+// The differences share a ring of bytes sized for the frames asked for at
+// REWIND_FRAME_BYTES each.  A run of busier frames pushes the oldest out
+// early, so the ring can hold less time than that but never more memory.
+
+// Bytes set aside per frame for its RAM difference
+#define REWIND_FRAME_BYTES 4096
+
+typedef struct {
+    ChipState chips;
+    u32       offset; // Of its difference from the frame before in data
+    u32       size;
+} RewindFrame;
+
+typedef struct {
+    RewindFrame* frames; // Ring of capacity frames, oldest at first
+    u32          capacity;
+    u32          first;
+    u32          count;
+
+    u8* data; // Ring of differences, next written at write
+    u32 data_size;
+    u32 write;
+
+    u8* shadow; // Every RAM bank as at the end of the newest frame
+} Rewind;
+
+// Make room for frames of history.  rewind_done is safe on a zeroed Rewind
+// that was never initialised.
+void rewind_init(Rewind* r, u32 frames);
+void rewind_done(Rewind* r);
+
+// Forget the history and start it again from the machine as it is now, as
+// after loading a snapshot
+void rewind_reset(Rewind* r, Machine* m);
+
+// Add the frame the machine has just finished, dropping the oldest if the
+// history is full.  Clears the memory's dirty flags.
+void rewind_push(Rewind* r, Machine* m);
+
+// Put the machine back to the end of the frame before the newest and forget
+// the newest.  Returns false if there is no older frame.
+bool rewind_step_back(Rewind* r, Machine* m);
+
+// Bytes held for the history
+usize rewind_memory(const Rewind* r);
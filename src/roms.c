@@ -0,0 +1,75 @@
+//------------------------------------------------------------------------------
+// Built-in ROMs
+//------------------------------------------------------------------------------
+
+#include "roms.h"
+
+#include <stdio.h>
+
+// The files are found relative to this one.  A short ROM is padded out with
+// zeroes.
+static const u8 g_rom_48[MEM_PAGE_SIZE] = {
+#embed "../etc/roms/48.rom"
+};
+static const u8 g_rom_128_0[MEM_PAGE_SIZE] = {
+#embed "../etc/roms/128-0.rom"
+};
+static const u8 g_rom_128_1[MEM_PAGE_SIZE] = {
+#embed "../etc/roms/128-1.rom"
+};
+static const u8 g_rom_plus2_0[MEM_PAGE_SIZE] = {
+#embed "../etc/roms/plus2-0.rom"
+};
+static const u8 g_rom_plus2_1[MEM_PAGE_SIZE] = {
+#embed "../etc/roms/plus2-1.rom"
+};
+static const u8 g_rom_plus3_0[MEM_PAGE_SIZE] = {
+#embed "../etc/roms/plus3-0.rom"
+};
+static const u8 g_rom_plus3_1[MEM_PAGE_SIZE] = {
+#embed "../etc/roms/plus3-1.rom"
+};
+static const u8 g_rom_plus3_2[MEM_PAGE_SIZE] = {
+#embed "../etc/roms/plus3-2.rom"
+};
+static const u8 g_rom_plus3_3[MEM_PAGE_SIZE] = {
+#embed "../etc/roms/plus3-3.rom"
+};
+
+typedef struct {
+    const char* name; // File in etc/roms
+    const u8*   image;
+} Rom;
+
+static const Rom g_roms[MemoryModel_COUNT][MEM_ROM_BANKS] = {
+    [MemoryModel_48K]   = {{"48.rom", g_rom_48}},
+    [MemoryModel_128K]  = {{"128-0.rom", g_rom_128_0},
+                           {"128-1.rom", g_rom_128_1}},
+    [MemoryModel_Plus2] = {{"plus2-0.rom", g_rom_plus2_0},
+                           {"plus2-1.rom", g_rom_plus2_1}},
+    [MemoryModel_Plus3] = {{"plus3-0.rom", g_rom_plus3_0},
+                           {"plus3-1.rom", g_rom_plus3_1},
+                           {"plus3-2.rom", g_rom_plus3_2},
+                           {"plus3-3.rom", g_rom_plus3_3}},
+};
+
+bool roms_load(Memory* memory, const char* folder)
+{
+    for (u32 i = 0; i < MEM_ROM_BANKS; i++) {
+        const Rom* rom = &g_roms[memory->model][i];
+        if (!rom->name) {
+            continue;
+        }
+        if (!folder) {
+            mem_set_rom(memory, i, rom->image);
+            continue;
+        }
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", folder, rom->name);
+        if (!mem_load_rom_file(memory, i, path)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,16 @@
+//------------------------------------------------------------------------------
+// Built-in ROMs
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "memory.h"
+
+// Every ROM in etc/roms is compiled into nx, so a machine starts without
+// opening a file, wherever it is run from.  The ROM banks point straight at
+// the images in read-only data.
+
+// Give memory the ROMs for its model: the built-in images, or if folder is
+// given, the files of the same names in it.  Returns false if a file can't
+// be read.
+bool roms_load(Memory* memory, const char* folder);
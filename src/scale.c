@@ -0,0 +1,277 @@
+//------------------------------------------------------------------------------
+// Integer pixel-replication scaling
+//------------------------------------------------------------------------------
+
+#include "scale.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#    define SCALE_X86 1
+#    include <immintrin.h>
+#elif defined(__ARM_NEON)
+#    define SCALE_NEON 1
+#    include <arm_neon.h>
+#endif
+
+typedef void (*ScaleRowFn)(u32* dst, const u32* src, u32 width, u32 scale);
+
+//------------------------------------------------------------------------------
+// Kernels
+//
+// Each kernel handles as many pixels as it can in vector registers and leaves
+// the rest of the row to the scalar kernel.
+//------------------------------------------------------------------------------
+
+static void scale_row_scalar(u32* dst, const u32* src, u32 width, u32 scale)
+{
+    for (u32 x = 0; x < width; ++x) {
+        u32 px = src[x];
+        for (u32 i = 0; i < scale; ++i) {
+            *dst++ = px;
+        }
+    }
+}
+
+#if SCALE_X86
+
+static void scale_row_sse2(u32* dst, const u32* src, u32 width, u32 scale)
+{
+    u32 x = 0;
+
+    switch (scale) {
+    case 2:
+        for (; x + 4 <= width; x += 4, dst += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+            _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi32(v, v));
+        }
+        break;
+
+    case 3:
+        // abcd -> aaab bbcc cddd
+        for (; x + 4 <= width; x += 4, dst += 12) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+            _mm_storeu_si128((__m128i*)dst,
+                             _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+            _mm_storeu_si128((__m128i*)(dst + 4),
+                             _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+            _mm_storeu_si128((__m128i*)(dst + 8),
+                             _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+        }
+        break;
+
+    case 4:
+        for (; x + 4 <= width; x += 4, dst += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+            _mm_storeu_si128((__m128i*)dst,
+                             _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 0, 0, 0)));
+            _mm_storeu_si128((__m128i*)(dst + 4),
+                             _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 1, 1, 1)));
+            _mm_storeu_si128((__m128i*)(dst + 8),
+                             _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 2, 2)));
+            _mm_storeu_si128((__m128i*)(dst + 12),
+                             _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)));
+        }
+        break;
+
+    default:
+        // Broadcast each pixel.  The last store of a pixel may overlap the
+        // one before it when scale isn't a multiple of 4.
+        if (scale < 4) {
+            break;
+        }
+        for (; x < width; ++x, dst += scale) {
+            __m128i v = _mm_set1_epi32((int)src[x]);
+            u32     i = 0;
+            for (; i + 4 <= scale; i += 4) {
+                _mm_storeu_si128((__m128i*)(dst + i), v);
+            }
+            if (i < scale) {
+                _mm_storeu_si128((__m128i*)(dst + scale - 4), v);
+            }
+        }
+        break;
+    }
+
+    scale_row_scalar(dst, src + x, width - x, scale);
+}
+
+__attribute__((target("avx2"))) static void scale_row_avx2(u32*       dst,
+                                                           const u32* src,
+                                                           u32        width,
+                                                           u32        scale)
+{
+    u32 x = 0;
+
+    if (scale <= 8) {
+        // 8 source pixels make scale vectors of output.  Lane j of vector k
+        // is source pixel (8k + j) / scale.
+        __m256i index[8];
+        for (u32 k = 0; k < scale; ++k) {
+            i32 lanes[8];
+            for (u32 j = 0; j < 8; ++j) {
+                lanes[j] = (i32)((k * 8 + j) / scale);
+            }
+            index[k] = _mm256_loadu_si256((const __m256i*)lanes);
+        }
+
+        for (; x + 8 <= width; x += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(src + x));
+            for (u32 k = 0; k < scale; ++k, dst += 8) {
+                _mm256_storeu_si256((__m256i*)dst,
+                                    _mm256_permutevar8x32_epi32(v, index[k]));
+            }
+        }
+    } else {
+        for (; x < width; ++x, dst += scale) {
+            __m256i v = _mm256_set1_epi32((int)src[x]);
+            u32     i = 0;
+            for (; i + 8 <= scale; i += 8) {
+                _mm256_storeu_si256((__m256i*)(dst + i), v);
+            }
+            if (i < scale) {
+                _mm256_storeu_si256((__m256i*)(dst + scale - 8), v);
+            }
+        }
+    }
+
+    scale_row_scalar(dst, src + x, width - x, scale);
+}
+
+#endif // SCALE_X86
+
+#if SCALE_NEON
+
+static void scale_row_neon(u32* dst, const u32* src, u32 width, u32 scale)
+{
+    u32 x = 0;
+
+    // The interleaving stores write each lane of v scale times in a row
+    switch (scale) {
+    case 2:
+        for (; x + 4 <= width; x += 4, dst += 8) {
+            uint32x4_t v = vld1q_u32(src + x);
+            vst2q_u32(dst, (uint32x4x2_t){{v, v}});
+        }
+        break;
+
+    case 3:
+        for (; x + 4 <= width; x += 4, dst += 12) {
+            uint32x4_t v = vld1q_u32(src + x);
+            vst3q_u32(dst, (uint32x4x3_t){{v, v, v}});
+        }
+        break;
+
+    case 4:
+        for (; x + 4 <= width; x += 4, dst += 16) {
+            uint32x4_t v = vld1q_u32(src + x);
+            vst4q_u32(dst, (uint32x4x4_t){{v, v, v, v}});
+        }
+        break;
+
+    default:
+        if (scale < 4) {
+            break;
+        }
+        for (; x < width; ++x, dst += scale) {
+            uint32x4_t v = vdupq_n_u32(src[x]);
+            u32        i = 0;
+            for (; i + 4 <= scale; i += 4) {
+                vst1q_u32(dst + i, v);
+            }
+            if (i < scale) {
+                vst1q_u32(dst + scale - 4, v);
+            }
+        }
+        break;
+    }
+
+    scale_row_scalar(dst, src + x, width - x, scale);
+}
+
+#endif // SCALE_NEON
+
+//------------------------------------------------------------------------------
+// Dispatch
+//------------------------------------------------------------------------------
+
+static const ScaleRowFn g_kernels[ScaleKernel_COUNT] = {
+    [ScaleKernel_Scalar] = scale_row_scalar,
+#if SCALE_X86
+    [ScaleKernel_SSE2] = scale_row_sse2,
+    [ScaleKernel_AVX2] = scale_row_avx2,
+#endif
+#if SCALE_NEON
+    [ScaleKernel_NEON] = scale_row_neon,
+#endif
+};
+
+static ScaleRowFn g_scale_row = NULL;
+
+bool scale_kernel_supported(ScaleKernel kernel)
+{
+    if (kernel >= ScaleKernel_COUNT || !g_kernels[kernel]) {
+        return false;
+    }
+#if SCALE_X86
+    if (kernel == ScaleKernel_AVX2) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return true;
+}
+
+const char* scale_kernel_name(ScaleKernel kernel)
+{
+    static const char* names[ScaleKernel_COUNT] = {
+        [ScaleKernel_Scalar] = "scalar",
+        [ScaleKernel_SSE2]   = "sse2",
+        [ScaleKernel_AVX2]   = "avx2",
+        [ScaleKernel_NEON]   = "neon",
+    };
+    return kernel < ScaleKernel_COUNT ? names[kernel] : "unknown";
+}
+
+bool scale_select(ScaleKernel kernel)
+{
+    if (!scale_kernel_supported(kernel)) {
+        return false;
+    }
+    g_scale_row = g_kernels[kernel];
+    return true;
+}
+
+void scale_row(u32* dst, const u32* src, u32 width, u32 scale)
+{
+    if (scale == 1) {
+        memcpy(dst, src, width * sizeof(u32));
+        return;
+    }
+
+    if (!g_scale_row) {
+        // The best kernel is the last one supported
+        for (i32 k = ScaleKernel_COUNT - 1; k >= 0; --k) {
+            if (scale_select((ScaleKernel)k)) {
+                break;
+            }
+        }
+    }
+    g_scale_row(dst, src, width, scale);
+}
+
+void scale_image(u32*       dst,
+                 usize      dst_pitch,
+                 const u32* src,
+                 usize      src_pitch,
+                 u32        width,
+                 u32        height,
+                 u32        scale)
+{
+    usize row_bytes = (usize)width * scale * sizeof(u32);
+    for (u32 y = 0; y < height; ++y) {
+        u32* out = dst + (usize)y * scale * dst_pitch;
+        scale_row(out, src + (usize)y * src_pitch, width, scale);
+        for (u32 i = 1; i < scale; ++i) {
+            memcpy(out + i * dst_pitch, out, row_bytes);
+        }
+    }
+}
@@ -0,0 +1,37 @@
+//------------------------------------------------------------------------------
+// Integer pixel-replication scaling
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "kore.h"
+
+// Each source row is expanded once into the first of its output rows by a
+// kernel, and the other scale-1 output rows are copies of it.  The fastest
+// kernel the CPU supports is used unless another is selected.
+typedef enum {
+    ScaleKernel_Scalar,
+    ScaleKernel_SSE2,
+    ScaleKernel_AVX2,
+    ScaleKernel_NEON,
+
+    ScaleKernel_COUNT,
+} ScaleKernel;
+
+bool        scale_kernel_supported(ScaleKernel kernel);
+const char* scale_kernel_name(ScaleKernel kernel);
+
+// Use a particular kernel.  Returns false if it isn't supported.
+bool scale_select(ScaleKernel kernel);
+
+// Write width*scale pixels to dst, each source pixel repeated scale times
+void scale_row(u32* dst, const u32* src, u32 width, u32 scale);
+
+// Scale a width x height image.  Pitches are in pixels.
+void scale_image(u32*       dst,
+                 usize      dst_pitch,
+                 const u32* src,
+                 usize      src_pitch,
+                 u32        width,
+                 u32        height,
+                 u32        scale);
@@ -0,0 +1,425 @@
+//------------------------------------------------------------------------------
+// Snapshots
+//------------------------------------------------------------------------------
+
+#include "snapshot.h"
+#include "contention.h"
+
+#include <string.h>
+
+// An SNA file is a 27-byte header and the 48K of RAM from 0x4000.  The 128K
+// layout adds PC, the paging port and the banks not already saved.
+#define SNA_HEADER 27
+#define SNA_48K (SNA_HEADER + 3 * MEM_PAGE_SIZE)
+#define SNA_128K_HEADER 4
+#define SNA_128K (SNA_48K + SNA_128K_HEADER + 5 * MEM_PAGE_SIZE)
+#define SNA_128K_LONG (SNA_128K + MEM_PAGE_SIZE) // Paged bank saved twice
+
+// A Z80 file starts with a 30-byte header.  If its PC is 0, an extra header
+// of 23 (version 2) or 54 or 55 bytes (version 3) follows, then the pages,
+// each a 3-byte header and its data.
+#define Z80_HEADER 30
+#define Z80_PAGE_HEADER 3
+#define Z80_PAGE_RAW 0xffff // Page length of an uncompressed page
+
+// Bit 5 of byte 12 is set if a version 1 file is compressed
+#define Z80_V1_COMPRESSED 0x20
+
+// Bit 7 of byte 37 marks modified hardware, which turns a 128K into a +2
+#define Z80_MODIFIED 0x80
+
+// RAM banks at 0x4000, 0x8000 and 0xc000 on the 48K
+static const u8 g_banks_48k[3] = {5, 2, 0};
+
+static u16 snapshot_u16(const u8* p) { return (u16)(p[0] | (p[1] << 8)); }
+
+static bool snapshot_has_extension(const char* path, const char* ext)
+{
+    const char* dot = strrchr(path, '.');
+    if (!dot) {
+        return false;
+    }
+    for (++dot; *dot && *ext; ++dot, ++ext) {
+        char c = *dot >= 'A' && *dot <= 'Z' ? (char)(*dot + 32) : *dot;
+        if (c != *ext) {
+            return false;
+        }
+    }
+    return *dot == 0 && *ext == 0;
+}
+
+//------------------------------------------------------------------------------
+// Opening
+//------------------------------------------------------------------------------
+
+static bool snapshot_open_sna(Snapshot* snap)
+{
+    usize size = snap->file.size;
+    if (size == SNA_48K) {
+        snap->model = MemoryModel_48K;
+        return true;
+    }
+    if (size == SNA_128K || size == SNA_128K_LONG) {
+        snap->model = MemoryModel_128K;
+        return true;
+    }
+    return false;
+}
+
+// The model for a version 2 or 3 hardware mode, or MemoryModel_COUNT if nx
+// doesn't emulate it.  Modes with Interface 1 or the MGT are taken as the
+// bare machine.
+static MemoryModel snapshot_z80_model(u32 version, u8 mode, u8 flags)
+{
+    static const u8 v2[] = {
+        [0] = MemoryModel_48K,
+        [1] = MemoryModel_48K,
+        [2] = MemoryModel_COUNT, // SamRam
+        [3] = MemoryModel_128K,
+        [4] = MemoryModel_128K,
+    };
+    static const u8 v3[] = {
+        [0]  = MemoryModel_48K,
+        [1]  = MemoryModel_48K,
+        [2]  = MemoryModel_COUNT, // SamRam
+        [3]  = MemoryModel_48K,
+        [4]  = MemoryModel_128K,
+        [5]  = MemoryModel_128K,
+        [6]  = MemoryModel_128K,
+        [7]  = MemoryModel_Plus3,
+        [8]  = MemoryModel_Plus3,
+        [9]  = MemoryModel_COUNT, // Pentagon
+        [10] = MemoryModel_COUNT, // Scorpion
+        [11] = MemoryModel_COUNT, // Didaktik
+        [12] = MemoryModel_Plus2,
+        [13] = MemoryModel_Plus3, // +2A
+    };
+
+    const u8* modes = version == 2 ? v2 : v3;
+    u32       count = version == 2 ? sizeof(v2) : sizeof(v3);
+    if (mode >= count) {
+        return MemoryModel_COUNT;
+    }
+
+    MemoryModel model = (MemoryModel)modes[mode];
+    if (model == MemoryModel_128K && (flags & Z80_MODIFIED)) {
+        model = MemoryModel_Plus2;
+    }
+    return model;
+}
+
+static bool snapshot_open_z80(Snapshot* snap)
+{
+    const u8* h    = snap->file.data;
+    usize     size = snap->file.size;
+    if (size < Z80_HEADER) {
+        return false;
+    }
+    if (snapshot_u16(h + 6) != 0) {
+        snap->version = 1;
+        snap->model   = MemoryModel_48K;
+        return true;
+    }
+
+    if (size < Z80_HEADER + 2) {
+        return false;
+    }
+    u16 extra = snapshot_u16(h + Z80_HEADER);
+    if (extra != 23 && extra != 54 && extra != 55) {
+        return false;
+    }
+    if (size < Z80_HEADER + 2 + (usize)extra) {
+        return false;
+    }
+    snap->version = extra == 23 ? 2 : 3;
+    snap->model   = snapshot_z80_model(snap->version, h[34], h[37]);
+    return snap->model != MemoryModel_COUNT;
+}
+
+bool snapshot_open(Snapshot* snap, const char* path)
+{
+    memset(snap, 0, sizeof(*snap));
+    if (!filemap_open(&snap->file, path)) {
+        $.eprn("Unable to open %s", path);
+        return false;
+    }
+    snap->path = path;
+
+    bool ok = false;
+    if (snapshot_has_extension(path, "sna")) {
+        snap->format = SnapshotFormat_Sna;
+        ok           = snapshot_open_sna(snap);
+    } else if (snapshot_has_extension(path, "z80")) {
+        snap->format = SnapshotFormat_Z80;
+        ok           = snapshot_open_z80(snap);
+    }
+
+    if (!ok) {
+        $.eprn("%s is not a snapshot nx can load", path);
+        snapshot_close(snap);
+        return false;
+    }
+    return true;
+}
+
+void snapshot_close(Snapshot* snap)
+{
+    filemap_close(&snap->file);
+    memset(snap, 0, sizeof(*snap));
+}
+
+//------------------------------------------------------------------------------
+// Loading
+//------------------------------------------------------------------------------
+
+// Unpack runs of ED ED count byte from src into count banks in turn, until
+// they are full.  Everything else is copied as it is.  A run may carry on
+// into the next bank.  Returns the bytes of src used, or 0 if it runs out
+// first or the last run overflows the banks.
+static usize snapshot_unpack(const u8*  src,
+                             usize      size,
+                             u8* const* banks,
+                             u32        count)
+{
+    const u8* p     = src;
+    const u8* end   = src + size;
+    u32       run   = 0;
+    u8        value = 0;
+
+    for (u32 i = 0; i < count; ++i) {
+        u8* out     = banks[i];
+        u8* out_end = out + MEM_PAGE_SIZE;
+        while (out < out_end) {
+            usize room = (usize)(out_end - out);
+            if (run > 0) {
+                usize n = run < room ? run : room;
+                memset(out, value, n);
+                out += n;
+                run -= (u32)n;
+                continue;
+            }
+            if (p == end) {
+                return 0;
+            }
+            if (end - p >= 4 && p[0] == 0xed && p[1] == 0xed) {
+                run   = p[2];
+                value = p[3];
+                p += 4;
+                continue;
+            }
+
+            // Copy up to the next ED, or a lone ED by itself
+            usize n = (usize)(end - p) < room ? (usize)(end - p) : room;
+            if (p[0] == 0xed) {
+                n = 1;
+            } else {
+                const u8* ed = memchr(p, 0xed, n);
+                if (ed) {
+                    n = (usize)(ed - p);
+                }
+            }
+            memcpy(out, p, n);
+            out += n;
+            p += n;
+        }
+    }
+    return run == 0 ? (usize)(p - src) : 0;
+}
+
+static bool snapshot_load_sna(Snapshot* snap, Memory* memory, Z80* z)
+{
+    const u8* h    = snap->file.data;
+    const u8* data = h + SNA_HEADER;
+
+    z->i     = h[0];
+    z->hl_.w = snapshot_u16(h + 1);
+    z->de_.w = snapshot_u16(h + 3);
+    z->bc_.w = snapshot_u16(h + 5);
+    z->af_.w = snapshot_u16(h + 7);
+    z->hl.w  = snapshot_u16(h + 9);
+    z->de.w  = snapshot_u16(h + 11);
+    z->bc.w  = snapshot_u16(h + 13);
+    z->iy.w  = snapshot_u16(h + 15);
+    z->ix.w  = snapshot_u16(h + 17);
+    z->iff1  = (h[19] >> 2) & 1;
+    z->iff2  = z->iff1;
+    z->af.w  = snapshot_u16(h + 21);
+    z->sp.w  = snapshot_u16(h + 23);
+    z->im    = h[25] & 3;
+    z80_set_r(z, h[20]);
+    snap->border = h[26] & 7;
+
+    if (snap->model == MemoryModel_48K) {
+        for (u32 i = 0; i < 3; ++i) {
+            memcpy(mem_ram_bank(memory, g_banks_48k[i]),
+                   data + i * MEM_PAGE_SIZE,
+                   MEM_PAGE_SIZE);
+        }
+        mem_set_paging(memory, 0, 0);
+
+        // The snapshot was taken in an interrupt, with PC pushed: RETN
+        z->pc.w = mem_read16(memory, z->sp.w);
+        z->sp.w += 2;
+        return true;
+    }
+
+    // 128K: banks 5, 2 and the paged bank, then the rest in order.  If the
+    // paged bank is 5 or 2 it is saved twice, so the file is longer.
+    const u8* extra = data + 3 * MEM_PAGE_SIZE;
+    u8        paged = extra[2] & 7;
+    bool      twice = paged == 5 || paged == 2;
+    if (snap->file.size != (twice ? SNA_128K_LONG : SNA_128K)) {
+        return false;
+    }
+
+    const u8 banks[3] = {5, 2, paged};
+    for (u32 i = 0; i < 3; ++i) {
+        memcpy(mem_ram_bank(memory, banks[i]),
+               data + i * MEM_PAGE_SIZE,
+               MEM_PAGE_SIZE);
+    }
+    const u8* p = extra + SNA_128K_HEADER;
+    for (u8 bank = 0; bank < MEM_RAM_BANKS; ++bank) {
+        if (bank != 5 && bank != 2 && bank != paged) {
+            memcpy(mem_ram_bank(memory, bank), p, MEM_PAGE_SIZE);
+            p += MEM_PAGE_SIZE;
+        }
+    }
+
+    z->pc.w = snapshot_u16(extra);
+    mem_set_paging(memory, extra[2], 0);
+    return true;
+}
+
+// The RAM bank a Z80 page number holds, or -1 for ROM and pages the model
+// doesn't have
+static i32 snapshot_z80_bank(MemoryModel model, u8 page)
+{
+    if (model == MemoryModel_48K) {
+        return page == 8 ? 5 : page == 4 ? 2 : page == 5 ? 0 : -1;
+    }
+    return page >= 3 && page < 3 + MEM_RAM_BANKS ? page - 3 : -1;
+}
+
+// Version 3 counts T-states down from each quarter of the frame, with the
+// quarter in the high byte
+static u32 snapshot_z80_tstates(const u8* h, MemoryModel model)
+{
+    u32 frame   = contention_timing(model)->frame_tstates;
+    u32 quarter = frame / 4;
+    u32 low     = snapshot_u16(h + 55);
+    u32 high    = h[57];
+    u32 t       = (((high + 1) % 4) + 1) * quarter;
+    return t > low && t - low - 1 < frame ? t - low - 1 : 0;
+}
+
+static bool snapshot_load_z80(Snapshot* snap, Memory* memory, Z80* z)
+{
+    const u8* h    = snap->file.data;
+    const u8* end  = h + snap->file.size;
+    u8        bits = h[12] == 0xff ? 1 : h[12];
+
+    z->af.h  = h[0];
+    z->af.l  = h[1];
+    z->bc.w  = snapshot_u16(h + 2);
+    z->hl.w  = snapshot_u16(h + 4);
+    z->pc.w  = snapshot_u16(h + 6);
+    z->sp.w  = snapshot_u16(h + 8);
+    z->i     = h[10];
+    z->de.w  = snapshot_u16(h + 13);
+    z->bc_.w = snapshot_u16(h + 15);
+    z->de_.w = snapshot_u16(h + 17);
+    z->hl_.w = snapshot_u16(h + 19);
+    z->af_.h = h[21];
+    z->af_.l = h[22];
+    z->iy.w  = snapshot_u16(h + 23);
+    z->ix.w  = snapshot_u16(h + 25);
+    z->iff1  = h[27] ? 1 : 0;
+    z->iff2  = h[28] ? 1 : 0;
+    z->im    = h[29] & 3;
+    z80_set_r(z, (u8)((h[11] & 0x7f) | ((bits & 1) << 7)));
+    snap->border = (bits >> 1) & 7;
+
+    // Version 1: the 48K in one block, compressed or not
+    if (snap->version == 1) {
+        const u8* data = h + Z80_HEADER;
+        usize     size = (usize)(end - data);
+        u8*       banks[3];
+        for (u32 i = 0; i < 3; ++i) {
+            banks[i] = mem_ram_bank(memory, g_banks_48k[i]);
+        }
+
+        mem_set_paging(memory, 0, 0);
+        if (bits & Z80_V1_COMPRESSED) {
+            return snapshot_unpack(data, size, banks, 3) != 0;
+        }
+        if (size < 3 * MEM_PAGE_SIZE) {
+            return false;
+        }
+        for (u32 i = 0; i < 3; ++i) {
+            memcpy(banks[i], data + i * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+        }
+        return true;
+    }
+
+    u16 extra = snapshot_u16(h + Z80_HEADER);
+    z->pc.w   = snapshot_u16(h + 32);
+    if (snap->model != MemoryModel_48K) {
+        u8 port_1ffd = extra == 55 ? h[86] : 0;
+        mem_set_paging(memory, h[35], port_1ffd);
+        snap->has_ay    = true;
+        snap->ay_select = h[38] & 0x0f;
+        memcpy(snap->ay_regs, h + 39, sizeof(snap->ay_regs));
+    } else {
+        mem_set_paging(memory, 0, 0);
+    }
+    if (snap->version == 3) {
+        snap->tstates = snapshot_z80_tstates(h, snap->model);
+    }
+
+    // The pages, in any order
+    const u8* p = h + Z80_HEADER + 2 + extra;
+    while (p < end) {
+        if (end - p < Z80_PAGE_HEADER) {
+            return false;
+        }
+        u16 length = snapshot_u16(p);
+        i32 bank   = snapshot_z80_bank(snap->model, p[2]);
+        p += Z80_PAGE_HEADER;
+
+        usize size = length == Z80_PAGE_RAW ? MEM_PAGE_SIZE : length;
+        if ((usize)(end - p) < size) {
+            return false;
+        }
+        if (bank >= 0) {
+            u8* dest = mem_ram_bank(memory, (u32)bank);
+            if (length == Z80_PAGE_RAW) {
+                memcpy(dest, p, MEM_PAGE_SIZE);
+            } else if (snapshot_unpack(p, size, &dest, 1) != size) {
+                return false;
+            }
+        }
+        p += size;
+    }
+    return true;
+}
+
+bool snapshot_load(Snapshot* snap, Memory* memory, Z80* z)
+{
+    if (memory->model != snap->model) {
+        $.eprn("%s is for a different model", snap->path);
+        return false;
+    }
+
+    z80_reset(z);
+    bool ok = snap->format == SnapshotFormat_Sna
+                  ? snapshot_load_sna(snap, memory, z)
+                  : snapshot_load_z80(snap, memory, z);
+
+    // The banks were written behind the ULA's back
+    memory->screen_dirty = MEM_SCREEN_ALL_ROWS;
+    if (!ok) {
+        $.eprn("%s is truncated or corrupt", snap->path);
+    }
+    return ok;
+}
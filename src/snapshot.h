@@ -0,0 +1,46 @@
+//------------------------------------------------------------------------------
+// Snapshots
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "filemap.h"
+#include "z80.h"
+
+// SNA and Z80 snapshots: a machine's CPU registers, paging and RAM as saved
+// by another emulator.  The file is mapped and checked when opened, which
+// also settles the model it needs.  Loading copies, or unpacks, each bank
+// straight from the mapping into the Memory's banks in one pass.
+//
+// SNA files are the 48K or 128K layout, told apart by their size.  Z80 files
+// are versions 1 to 3, with pages compressed as runs of ED ED count byte.
+
+typedef enum {
+    SnapshotFormat_Sna,
+    SnapshotFormat_Z80,
+} SnapshotFormat;
+
+typedef struct {
+    FileMap        file;
+    const char*    path;
+    SnapshotFormat format;
+    MemoryModel    model;   // The model the snapshot was saved from
+    u32            version; // Of a Z80 file
+
+    // Set by snapshot_load for the rest of the machine
+    u8   border;
+    u32  tstates;   // Time into the frame, if the snapshot says
+    bool has_ay;    // The AY registers are saved
+    u8   ay_select; // The AY register last selected
+    u8   ay_regs[16];
+} Snapshot;
+
+// Map a snapshot and check its header.  Returns false if it can't be read or
+// isn't a snapshot for a model nx emulates.
+bool snapshot_open(Snapshot* snap, const char* path);
+void snapshot_close(Snapshot* snap);
+
+// Restore the snapshot into memory, which must be of snap->model, and the
+// CPU.  Returns false, with memory and the CPU partly loaded, if the data is
+// truncated or corrupt.
+bool snapshot_load(Snapshot* snap, Memory* memory, Z80* z);
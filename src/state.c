@@ -0,0 +1,59 @@
+//------------------------------------------------------------------------------
+// Saved states
+//------------------------------------------------------------------------------
+
+#include "state.h"
+
+void state_save_chips(ChipState* chips, const Machine* m)
+{
+    chips->z80       = m->z80;
+    chips->port_7ffd = m->memory.port_7ffd;
+    chips->port_1ffd = m->memory.port_1ffd;
+    ula_save(&m->ula, &chips->ula);
+    beeper_save(&m->beeper, &chips->beeper);
+    ay_save(&m->ay, &chips->ay);
+    tape_save(&m->tape, &chips->tape);
+    chips->keyboard = m->keyboard;
+    chips->autoload = m->autoload;
+    chips->frames   = m->frames;
+}
+
+void state_restore_chips(const ChipState* chips, Machine* m)
+{
+    // Everything the CPU is wired to stays as it is
+    Z80 hooks = m->z80;
+    m->z80    = chips->z80;
+
+    m->z80.memory        = hooks.memory;
+    m->z80.port_in       = hooks.port_in;
+    m->z80.port_out      = hooks.port_out;
+    m->z80.user          = hooks.user;
+    m->z80.trace         = hooks.trace;
+    m->z80.contention    = hooks.contention;
+    m->z80.io_contention = hooks.io_contention;
+    m->z80.breakpoints   = hooks.breakpoints;
+    m->z80.xy            = &m->z80.ix;
+
+    mem_set_paging(&m->memory, chips->port_7ffd, chips->port_1ffd);
+    ula_restore(&m->ula, &chips->ula);
+    beeper_restore(&m->beeper, &chips->beeper);
+    ay_restore(&m->ay, &chips->ay);
+    tape_restore(&m->tape, &chips->tape);
+    m->keyboard = chips->keyboard;
+    m->autoload = chips->autoload;
+    m->frames   = chips->frames;
+}
+
+void state_save(State* state, Machine* m)
+{
+    state_save_chips(&state->chips, m);
+    mem_save(&m->memory, &state->memory);
+}
+
+void state_restore(const State* state, Machine* m)
+{
+    mem_restore(&m->memory, &state->memory);
+    state_restore_chips(&state->chips, m);
+}
+
+void state_free(State* state) { mem_state_free(&state->memory); }
@@ -0,0 +1,44 @@
+//------------------------------------------------------------------------------
+// Saved states
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "machine.h"
+
+// Everything in a machine between two frames but its RAM: the CPU, the chips,
+// the paging, the keys held and the tape position.  A few hundred bytes.
+typedef struct {
+    Z80         z80; // Registers only; the hooks are the machine's
+    u8          port_7ffd;
+    u8          port_1ffd;
+    UlaState    ula;
+    BeeperState beeper;
+    AyState     ay;
+    TapeState   tape;
+    Keyboard    keyboard;
+    const u8*   autoload;
+    u32         frames;
+} ChipState;
+
+// A machine as it was between two frames, to go back to any number of times.
+// RAM isn't copied: the state shares the machine's banks, and the machine
+// copies a bank only when it first writes to it after.  Saving then restoring
+// a state costs a little more than the banks written in between.
+//
+// The ROMs, the model and the inserted tape are not part of the state.  They
+// must be the same when it is restored.
+typedef struct {
+    ChipState   chips;
+    MemoryState memory;
+} State;
+
+void state_save(State* state, Machine* m);
+void state_restore(const State* state, Machine* m);
+
+// Let go of the RAM a state shares
+void state_free(State* state);
+
+// Save or restore all but the RAM, for callers that keep it themselves
+void state_save_chips(ChipState* chips, const Machine* m);
+void state_restore_chips(const ChipState* chips, Machine* m);
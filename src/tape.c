@@ -0,0 +1,377 @@
+//------------------------------------------------------------------------------
+// Tape
+//------------------------------------------------------------------------------
+
+#include "tape.h"
+
+#include <string.h>
+
+// Pulse lengths in T-states of the ROM's save routine
+#define TAPE_PILOT 2168
+#define TAPE_SYNC1 667
+#define TAPE_SYNC2 735
+#define TAPE_ZERO 855
+#define TAPE_ONE 1710
+
+// Pilot pulses before a header and before data
+#define TAPE_PILOT_HEADER 8063
+#define TAPE_PILOT_DATA 3223
+
+// A second of silence between blocks
+#define TAPE_PAUSE 3500000
+
+// How the ROM saves a block
+static const TapeTiming g_rom_timing = {
+    .pilot        = TAPE_PILOT,
+    .pilot_pulses = TAPE_PILOT_DATA,
+    .sync1        = TAPE_SYNC1,
+    .sync2        = TAPE_SYNC2,
+    .zero         = TAPE_ZERO,
+    .one          = TAPE_ONE,
+    .last_bits    = 8,
+    .pause        = TAPE_PAUSE,
+};
+
+// The ROM's edge sampling routines, LD-EDGE-2 and LD-EDGE-1
+#define TAPE_LD_EDGE_START 0x05e3
+#define TAPE_LD_EDGE_END 0x0604
+
+#define TAPE_FLAG_C 0x01
+
+bool tape_open(Tape* tape, const char* path)
+{
+    memset(tape, 0, sizeof(*tape));
+    if (!filemap_open(&tape->file, path)) {
+        $.eprn("Unable to open %s", path);
+        return false;
+    }
+
+    const u8* p   = tape->file.data;
+    const u8* end = p + tape->file.size;
+    while (p < end) {
+        if (end - p < 2) {
+            break;
+        }
+        u32 size = (u32)(p[0] | (p[1] << 8));
+        p += 2;
+        if ((usize)(end - p) < size) {
+            break;
+        }
+        if (size > 0) {
+            TapeBlock block = {.data = p, .size = size, .timing = g_rom_timing};
+            if (p[0] < 0x80) {
+                block.timing.pilot_pulses = TAPE_PILOT_HEADER;
+            }
+            array_add(tape->blocks, block);
+        }
+        p += size;
+    }
+
+    if (p != end) {
+        $.eprn("%s is not a TAP file", path);
+        tape_close(tape);
+        return false;
+    }
+    tape->stage = TapeStage_Stopped;
+    return true;
+}
+
+void tape_close(Tape* tape)
+{
+    array_free(tape->blocks);
+    filemap_close(&tape->file);
+    memset(tape, 0, sizeof(*tape));
+}
+
+bool tape_inserted(const Tape* tape) { return tape->file.data != NULL; }
+
+void tape_play(Tape* tape, u32 t)
+{
+    tape->playing = true;
+    tape->stage   = TapeStage_Block;
+    tape->edge_t  = t;
+}
+
+void tape_save(const Tape* tape, TapeState* state)
+{
+    state->block   = tape->block;
+    state->playing = tape->playing;
+    state->ear     = tape->ear;
+    state->edge_t  = tape->edge_t;
+    state->stage   = tape->stage;
+    state->pulses  = tape->pulses;
+    state->pos     = tape->pos;
+    state->mask    = tape->mask;
+    state->half    = tape->half;
+}
+
+void tape_restore(Tape* tape, const TapeState* state)
+{
+    tape->block   = state->block;
+    tape->playing = state->playing;
+    tape->ear     = state->ear;
+    tape->edge_t  = state->edge_t;
+    tape->stage   = state->stage;
+    tape->pulses  = state->pulses;
+    tape->pos     = state->pos;
+    tape->mask    = state->mask;
+    tape->half    = state->half;
+}
+
+//------------------------------------------------------------------------------
+// Real-time playback
+//------------------------------------------------------------------------------
+
+// Move on to the next period of the signal and set the EAR level during it.
+// Returns its length in T-states, or 0 at the end of the tape.
+static u32 tape_next_period(Tape* tape)
+{
+    for (;;) {
+        const TapeBlock*  block  = &tape->blocks[tape->block];
+        const TapeTiming* timing = &block->timing;
+
+        switch (tape->stage) {
+        case TapeStage_Block:
+            if (tape->block >= array_length(tape->blocks)) {
+                tape->stage = TapeStage_Stopped;
+                continue;
+            }
+            tape->stage  = TapeStage_Pilot;
+            tape->pulses = timing->pilot_pulses;
+            continue;
+
+        case TapeStage_Pilot:
+            if (tape->pulses == 0) {
+                tape->stage = TapeStage_Sync1;
+                continue;
+            }
+            tape->ear = !tape->ear;
+            tape->pulses--;
+            return timing->pilot;
+
+        case TapeStage_Sync1:
+            tape->ear   = !tape->ear;
+            tape->stage = TapeStage_Sync2;
+            return timing->sync1;
+
+        case TapeStage_Sync2:
+            tape->ear   = !tape->ear;
+            tape->stage = TapeStage_Data;
+            tape->pos   = 0;
+            tape->mask  = 0x80;
+            tape->half  = false;
+            return timing->sync2;
+
+        case TapeStage_Data: {
+            bool one = (block->data[tape->pos] & tape->mask) != 0;
+
+            // Each bit is two pulses of the same length
+            tape->ear = !tape->ear;
+            if (tape->half) {
+                tape->mask >>= 1;
+                bool last = tape->pos + 1 == block->size;
+                if (tape->mask == 0 ||
+                    (last && tape->mask == (0x80 >> timing->last_bits))) {
+                    tape->mask = 0x80;
+                    if (++tape->pos == block->size) {
+                        tape->stage = TapeStage_Pause;
+                    }
+                }
+            }
+            tape->half = !tape->half;
+            return one ? timing->one : timing->zero;
+        }
+
+        case TapeStage_Pause:
+            tape->ear   = false;
+            tape->stage = TapeStage_Block;
+            tape->block++;
+            if (timing->pause == 0) {
+                continue;
+            }
+            return timing->pause;
+
+        case TapeStage_Stopped:
+        default:
+            tape->playing = false;
+            tape->ear     = false;
+            return 0;
+        }
+    }
+}
+
+// Work the signal out as far as time t
+static void tape_advance(Tape* tape, u32 t)
+{
+    while (tape->playing && t >= tape->edge_t) {
+        tape->edge_t += tape_next_period(tape);
+    }
+}
+
+void tape_end_frame(Tape* tape, u32 frame_tstates)
+{
+    if (tape->playing) {
+        tape_advance(tape, frame_tstates);
+        tape->edge_t -= frame_tstates;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Edge loop acceleration
+//------------------------------------------------------------------------------
+
+// The ROM's LD-SAMPLE loop, which most custom loaders copy with their own
+// constants.  TAPE_ANY bytes may be anything.
+//
+//      INC B           04
+//      RET Z           C8
+//      LD A,n          3E n
+//      IN A,(n)        DB n
+//      RRA             1F
+//      RET NC          D0
+//      XOR C           A9
+//      AND n           E6 n
+//      JR Z,loop       28 F3
+#define TAPE_ANY 0x100
+
+static const u16 g_sample_loop[] = {
+    0x04, 0xc8, 0x3e, TAPE_ANY, 0xdb, TAPE_ANY, 0x1f,
+    0xd0, 0xa9, 0xe6, TAPE_ANY, 0x28, 0xf3,
+};
+
+// Offset of the byte after IN A,(n), and of the AND mask
+#define TAPE_SAMPLE_AFTER_IN 6
+#define TAPE_SAMPLE_MASK 10
+
+// T-states and instructions per pass
+#define TAPE_SAMPLE_TSTATES 59
+#define TAPE_SAMPLE_INSTRUCTIONS 9
+
+static bool tape_in_sample_loop(const Memory* memory, u16 pc)
+{
+    u16 loop = (u16)(pc - TAPE_SAMPLE_AFTER_IN);
+    for (u32 i = 0; i < sizeof(g_sample_loop) / sizeof(g_sample_loop[0]); ++i) {
+        u8 byte = mem_read(memory, (u16)(loop + i));
+        if (g_sample_loop[i] != TAPE_ANY && g_sample_loop[i] != byte) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Called as the loop's IN reads value, before the edge due at tape->edge_t.
+// Earlier passes would have read the same, so pretend that as many as fit
+// before the edge already have: each counted one on B, took its T-states and
+// fetched its instructions.
+static void tape_skip_sample_loop(Tape* tape, Z80* z, u8 value, u32 t_limit)
+{
+    // RRA moves the EAR bit to bit 5 and the lowest key into carry.  This pass
+    // ends the loop unless carry is set and the masked level matches C.  The
+    // AND that ended the last pass cleared carry, so nothing comes into bit 7.
+    u16 loop = (u16)(z->pc.w - TAPE_SAMPLE_AFTER_IN);
+    u8  mask = mem_read(z->memory, (u16)(loop + TAPE_SAMPLE_MASK));
+    if (!(value & 1) || (((value >> 1) ^ z->bc.l) & mask) != 0) {
+        return;
+    }
+
+    // Passes that fit before the edge, the time limit and B running out
+    u32 t      = z->t;
+    u32 end    = tape->edge_t < t_limit ? tape->edge_t : t_limit;
+    u32 passes = end > t ? (end - t - 1) / TAPE_SAMPLE_TSTATES : 0;
+    u32 left   = 0xffu - z->bc.h;
+    if (passes > left) {
+        passes = left;
+    }
+
+    z->t += passes * TAPE_SAMPLE_TSTATES;
+    z->bc.h += (u8)passes;
+    z->r += (u8)(passes * TAPE_SAMPLE_INSTRUCTIONS);
+    z->instructions += (u64)passes * TAPE_SAMPLE_INSTRUCTIONS;
+}
+
+//------------------------------------------------------------------------------
+// Port reads
+//------------------------------------------------------------------------------
+
+// True if code at pc reading the EAR bit is a loader.  The ROM's keyboard and
+// BREAK checks read it too, and mustn't start the tape.
+static bool tape_loader_at(u16 pc)
+{
+    return pc >= 0x4000 || (pc >= TAPE_LD_EDGE_START && pc < TAPE_LD_EDGE_END);
+}
+
+bool tape_read_ear(Tape* tape, u32 t, u16 pc)
+{
+    if (!tape->playing && tape->block < array_length(tape->blocks) &&
+        tape_loader_at(pc)) {
+        tape_play(tape, t);
+    }
+    tape_advance(tape, t);
+    return tape->ear;
+}
+
+void tape_accelerate(Tape* tape, Z80* z, u8 value, u32 t_limit)
+{
+    if (tape->playing && !z->iff1 && tape_in_sample_loop(z->memory, z->pc.w)) {
+        tape_skip_sample_loop(tape, z, value, t_limit);
+    }
+}
+
+//------------------------------------------------------------------------------
+// LD-BYTES trap
+//------------------------------------------------------------------------------
+
+// On entry to LD-BYTES, A is the flag byte expected, carry is set to load
+// rather than verify, IX is the address and DE the length.  It returns with
+// carry set if the block matched and its checksum was good.
+bool tape_trap(Tape* tape, Z80* z)
+{
+    if (!mem_basic_rom_paged(z->memory) ||
+        tape->block >= array_length(tape->blocks)) {
+        return false;
+    }
+
+    const TapeBlock* block = &tape->blocks[tape->block++];
+    bool             load  = (z->af.l & TAPE_FLAG_C) != 0;
+    u8               flag  = block->data[0];
+    u8               check = flag;
+    bool             ok    = flag == z->af.h;
+
+    if (ok) {
+        // The bytes after the flag: the payload, then the checksum
+        const u8* data  = block->data + 1;
+        u32       avail = block->size - 1;
+        u32       want  = z->de.w;
+        u32       n     = 0;
+        for (; n < want && n < avail; ++n) {
+            u16 addr = (u16)(z->ix.w + n);
+            if (load) {
+                mem_write(z->memory, addr, data[n]);
+            } else if (mem_read(z->memory, addr) != data[n]) {
+                break;
+            }
+            check ^= data[n];
+        }
+        z->ix.w = (u16)(z->ix.w + n);
+        z->de.w = (u16)(want - n);
+
+        // The byte after the last one wanted is taken as the checksum
+        ok = n == want && n < avail && (check ^ data[n]) == 0;
+        if (n < avail) {
+            z->hl.l = data[n];
+        }
+    }
+
+    z->af.h = check;
+    z->af.l = (u8)(ok ? z->af.l | TAPE_FLAG_C : z->af.l & ~TAPE_FLAG_C);
+
+    // RET
+    z->pc.w = mem_read16(z->memory, z->sp.w);
+    z->sp.w += 2;
+
+    // A loader that reads on from here hears the block after this one
+    if (tape->playing) {
+        tape_play(tape, z->t);
+    }
+    return true;
+}
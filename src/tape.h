@@ -0,0 +1,120 @@
+//------------------------------------------------------------------------------
+// Tape
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "filemap.h"
+#include "z80.h"
+
+// A TAP file is a list of blocks, each a 16-bit length and then that many
+// bytes: a flag (0x00 for a header, 0xff for data), the payload and an XOR
+// checksum of the lot.  The file is mapped and the blocks indexed in place.
+//
+// Blocks get into memory one of two ways.  The ROM's LD-BYTES routine at
+// 0x0556 is trapped and a whole block copied in at once, which loads anything
+// saved from BASIC in no time.  Loaders that don't use the ROM hear the tape
+// played in real time instead: the blocks become the pulses the ROM would
+// have saved, read through the EAR bit of port 0xFE.  Both move through the
+// same list, so a game loaded by the trap can go on to play its protected
+// blocks.
+
+// Address of the ROM's LD-BYTES routine
+#define TAPE_LD_BYTES 0x0556
+
+// How a block is played.  TAP blocks all use the ROM's timings; other formats
+// can give each block its own.
+typedef struct {
+    u16 pilot;        // Length of a pilot pulse
+    u16 pilot_pulses; // Pulses of pilot tone
+    u16 sync1;        // The two sync pulses
+    u16 sync2;
+    u16 zero;         // Length of both pulses of a 0 bit
+    u16 one;          // Length of both pulses of a 1 bit
+    u8  last_bits;    // Bits played from the last byte
+    u32 pause;        // Silence after the block
+} TapeTiming;
+
+typedef struct {
+    const u8*  data; // Flag, payload and checksum
+    u32        size;
+    TapeTiming timing;
+} TapeBlock;
+
+typedef enum {
+    TapeStage_Block, // About to start the next block
+    TapeStage_Pilot,
+    TapeStage_Sync1,
+    TapeStage_Sync2,
+    TapeStage_Data,
+    TapeStage_Pause, // Silence after a block
+    TapeStage_Stopped,
+} TapeStage;
+
+typedef struct {
+    FileMap file;
+    KArray(TapeBlock) blocks;
+    u32 block; // Next block to play or load
+
+    // Real-time playback.  The signal is worked out lazily, a period between
+    // edges at a time, as far as the last time it was read.
+    bool      playing;
+    bool      ear;    // Level on the EAR input
+    u32       edge_t; // When the current period ends, in frame T-states
+    TapeStage stage;
+    u32       pulses; // Pilot pulses left
+    u32       pos;    // Byte of the block being played
+    u8        mask;   // Bit of the byte being played
+    bool      half;   // Playing the second pulse of the bit
+} Tape;
+
+// Where a saved state left the tape
+typedef struct {
+    u32       block;
+    bool      playing;
+    bool      ear;
+    u32       edge_t;
+    TapeStage stage;
+    u32       pulses;
+    u32       pos;
+    u8        mask;
+    bool      half;
+} TapeState;
+
+// Map a TAP file and index its blocks.  Returns false if it can't be read or
+// is malformed.
+bool tape_open(Tape* tape, const char* path);
+void tape_close(Tape* tape);
+
+bool tape_inserted(const Tape* tape);
+
+// Start playing from the next block at time t
+void tape_play(Tape* tape, u32 t);
+
+// The EAR level at time t, for a read of port 0xFE by code at pc.  A stopped
+// tape starts playing when a loader other than the trapped ROM routine
+// listens: code in RAM or the ROM's own edge sampling.
+bool tape_read_ear(Tape* tape, u32 t, u16 pc);
+
+// Called as the CPU's read of port 0xFE returns value.  A loader waiting for
+// an edge spends almost all its time in a loop like the ROM's LD-SAMPLE,
+// which reads the port, checks for a change and counts.  If the read comes
+// from such a loop, the CPU is moved on to its last pass before the next
+// edge, up to t_limit, with the counter, T-states and R as if it had gone
+// round that many times.  Contention during the skipped passes isn't
+// counted, which loaders tolerate as they would a slightly fast tape.
+void tape_accelerate(Tape* tape, Z80* z, u8 value, u32 t_limit);
+
+// Called with the CPU stopped at TAPE_LD_BYTES.  If the BASIC ROM is paged in
+// and there is a block left, load or verify it as LD-BYTES would and return
+// to the caller.  Returns false, leaving the CPU alone, otherwise.
+bool tape_trap(Tape* tape, Z80* z);
+
+// Play on to the end of a frame of frame_tstates T-states and rebase the
+// playback time to the next frame
+void tape_end_frame(Tape* tape, u32 frame_tstates);
+
+// Save or go back to the position in the tape.  The state applies to
+// whichever tape is inserted, which should be the one it was saved with.
+void tape_save(const Tape* tape, TapeState* state);
+void tape_restore(Tape* tape, const TapeState* state);
@@ -0,0 +1,235 @@
+//------------------------------------------------------------------------------
+// ULA display emulation
+//------------------------------------------------------------------------------
+
+#include "ula.h"
+#include "config.h"
+
+#define CELL_WIDTH 8
+#define CELLS_PER_LINE (WINDOW_WIDTH / CELL_WIDTH)
+#define BORDER_CELLS (BORDER_WIDTH / CELL_WIDTH)
+#define DISPLAY_CELLS (SCREEN_WIDTH / CELL_WIDTH)
+#define NUM_CELLS (CELLS_PER_LINE * WINDOW_HEIGHT)
+
+// Each cell of 8 pixels takes 4 T-states
+#define CELL_TSTATES 4
+
+// The time each cell is drawn, from the model's display timing
+static u32 g_cell_time[NUM_CELLS];
+static u32 g_display_start = DISPLAY_START;
+static u32 g_line_tstates  = TSTATES_PER_LINE;
+
+// The 16 colours, as 0xAARRGGBB
+static u32 g_palette[16];
+
+// For every attribute and FLASH phase, the ink and paper colours
+static u32 g_ink[2][256];
+static u32 g_paper[2][256];
+
+// For every bitmap byte, a mask of all ones for each ink pixel
+static u32 g_mask[256][8];
+
+static void ula_tables_init(void)
+{
+    for (u32 i = 0; i < 16; ++i) {
+        u32 level    = (i & 8) ? 0xff : 0xd7;
+        u32 r        = (i & 2) ? level : 0;
+        u32 g        = (i & 4) ? level : 0;
+        u32 b        = (i & 1) ? level : 0;
+        g_palette[i] = 0xff000000u | (r << 16) | (g << 8) | b;
+    }
+
+    for (u32 attr = 0; attr < 256; ++attr) {
+        u32 bright = (attr & 0x40) >> 3;
+        u32 ink    = g_palette[(attr & 0x07) | bright];
+        u32 paper  = g_palette[((attr >> 3) & 0x07) | bright];
+        bool flash = (attr & 0x80) != 0;
+
+        g_ink[0][attr]   = ink;
+        g_paper[0][attr] = paper;
+        g_ink[1][attr]   = flash ? paper : ink;
+        g_paper[1][attr] = flash ? ink : paper;
+    }
+
+    for (u32 byte = 0; byte < 256; ++byte) {
+        for (u32 bit = 0; bit < 8; ++bit) {
+            g_mask[byte][bit] = (byte & (0x80 >> bit)) ? 0xffffffffu : 0;
+        }
+    }
+
+    ula_set_timing(g_display_start, g_line_tstates);
+}
+
+void ula_init(Ula* ula, Memory* memory, u32* pixels)
+{
+    static bool tables_ready = false;
+    if (!tables_ready) {
+        ula_tables_init();
+        tables_ready = true;
+    }
+
+    *ula        = (Ula){0};
+    ula->memory = memory;
+    ula->pixels = pixels;
+    ula->border = 7;
+    ula_invalidate(ula);
+}
+
+void ula_invalidate(Ula* ula)
+{
+    for (u32 i = 0; i < 8; ++i) {
+        ula->line_dirty[i] = MEM_SCREEN_ALL_ROWS;
+    }
+    ula->border_frames = 2;
+}
+
+void ula_set_timing(u32 display_start, u32 line_tstates)
+{
+    g_display_start = display_start;
+    g_line_tstates  = line_tstates;
+
+    for (u32 y = 0; y < WINDOW_HEIGHT; ++y) {
+        u32  t     = ula_line_time(y);
+        u32* times = &g_cell_time[y * CELLS_PER_LINE];
+        for (u32 c = 0; c < BORDER_CELLS; ++c) {
+            times[c] = t - (BORDER_CELLS - c) * CELL_TSTATES;
+        }
+        for (u32 c = 0; c < DISPLAY_CELLS; ++c) {
+            times[BORDER_CELLS + c] = t;
+        }
+        for (u32 c = 0; c < BORDER_CELLS; ++c) {
+            times[BORDER_CELLS + DISPLAY_CELLS + c] =
+                t + (DISPLAY_CELLS + c) * CELL_TSTATES;
+        }
+    }
+}
+
+u32 ula_line_time(u32 y)
+{
+    i32 line = (i32)y - BORDER_HEIGHT;
+    return (u32)((i32)g_display_start + line * (i32)g_line_tstates);
+}
+
+void ula_start_frame(Ula* ula, bool draw)
+{
+    // The border only counts as drawn in frames that were
+    if (!ula->skip) {
+        ula_update(ula, ~0u);
+        if (ula->border_frames > 0) {
+            ula->border_frames--;
+        }
+    }
+    ula->cell = 0;
+    ula->skip = !draw;
+    ula->frame++;
+
+    // FLASH swaps ink and paper every 16 frames
+    bool flash = (ula->frame & 16) != 0;
+    if (flash != ula->flash) {
+        ula->flash = flash;
+        for (u32 i = 0; i < 8; ++i) {
+            ula->line_dirty[i] = MEM_SCREEN_ALL_ROWS;
+        }
+    }
+}
+
+static void ula_draw_border(Ula* ula, u32* out)
+{
+    u32 colour = g_palette[ula->border];
+    for (u32 i = 0; i < CELL_WIDTH; ++i) {
+        out[i] = colour;
+    }
+}
+
+static void ula_draw_display(Ula* ula, u32 y, u32* out)
+{
+    // The bitmap address interleaves the line bits: 010T TLLL RRRC CCCC
+    const u8* screen = ula->memory->screen;
+    const u8* bitmap =
+        screen + (((y & 0xc0) << 5) | ((y & 0x07) << 8) | ((y & 0x38) << 2));
+    const u8* attrs  = screen + 0x1800 + (y >> 3) * 32;
+    const u32* ink   = g_ink[ula->flash];
+    const u32* paper = g_paper[ula->flash];
+
+    for (u32 x = 0; x < DISPLAY_CELLS; ++x) {
+        u8         attr = attrs[x];
+        u32        i    = ink[attr];
+        u32        p    = paper[attr];
+        u32        diff = i ^ p;
+        const u32* mask = g_mask[bitmap[x]];
+        for (u32 bit = 0; bit < CELL_WIDTH; ++bit) {
+            out[bit] = p ^ (diff & mask[bit]);
+        }
+        out += CELL_WIDTH;
+    }
+}
+
+void ula_update(Ula* ula, u32 t)
+{
+    // Nothing to draw into when running headless or skipping the frame
+    if (!ula->pixels || ula->skip) {
+        return;
+    }
+
+    // Pick up the rows written since the last update.  Each line of a row
+    // has its own copy, so lines already drawn this frame are redrawn next.
+    u32 written = ula->memory->screen_dirty;
+    if (written) {
+        ula->memory->screen_dirty = 0;
+        for (u32 i = 0; i < 8; ++i) {
+            ula->line_dirty[i] |= written;
+        }
+    }
+
+    while (ula->cell < NUM_CELLS && g_cell_time[ula->cell] <= t) {
+        u32  y   = ula->cell / CELLS_PER_LINE;
+        u32  c   = ula->cell % CELLS_PER_LINE;
+        u32* out = ula->pixels + ula->cell * CELL_WIDTH;
+
+        bool display_line =
+            y >= BORDER_HEIGHT && y < BORDER_HEIGHT + SCREEN_HEIGHT;
+        if (display_line && c == BORDER_CELLS) {
+            u32  line = y - BORDER_HEIGHT;
+            u32  row  = 1u << (line >> 3);
+            u32* mask = &ula->line_dirty[line & 7];
+            if (*mask & row) {
+                *mask &= ~row;
+                ula_draw_display(ula, line, out);
+                ula->dirty[y] = true;
+            }
+            ula->cell += DISPLAY_CELLS;
+        } else {
+            if (ula->border_frames > 0) {
+                ula_draw_border(ula, out);
+                ula->dirty[y] = true;
+            }
+            ula->cell++;
+        }
+    }
+}
+
+void ula_set_border(Ula* ula, u32 t, u8 colour)
+{
+    ula_update(ula, t);
+    if ((colour & 7) != ula->border) {
+        ula->border = colour & 7;
+
+        // Cells before the change keep the old colour until next frame
+        ula->border_frames = 2;
+    }
+}
+
+void ula_save(const Ula* ula, UlaState* state)
+{
+    state->border = ula->border;
+    state->frame  = ula->frame;
+    state->flash  = ula->flash;
+}
+
+void ula_restore(Ula* ula, const UlaState* state)
+{
+    ula->border = state->border;
+    ula->frame  = state->frame;
+    ula->flash  = state->flash;
+    ula_invalidate(ula);
+}
@@ -0,0 +1,75 @@
+//------------------------------------------------------------------------------
+// ULA display emulation
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "config.h"
+#include "memory.h"
+
+// The ULA draws into a WINDOW_WIDTH x WINDOW_HEIGHT layer: the 256x192 display
+// surrounded by 32 pixels of border on each side.
+//
+// Each line of the layer is 40 cells of 8 pixels.  Every cell has a time in
+// T-states at which it is drawn, and ula_update draws all the cells whose time
+// has passed.  Border cells are drawn at the time the beam reaches them, so
+// border effects are accurate to 8 pixels.  All 32 display cells of a line are
+// drawn at the time the line's first pixel is fetched, which is when the CPU
+// must have finished changing it for multicolour effects to work.
+//
+// Only what has changed is drawn.  Display lines are redrawn when the memory
+// behind them has been written since they were last drawn, and the border
+// while its colour has changed within the last two frames.  Every line of the
+// layer that is drawn is flagged in dirty, for the caller to upload and clear.
+typedef struct {
+    Memory* memory;
+    u32*    pixels;
+
+    u8   border; // Current border colour (0-7)
+    u32  cell;   // Next cell to draw
+    u32  frame;  // Frames drawn, for FLASH
+    bool flash;  // FLASH attributes are currently inverted
+    bool skip;   // This frame isn't being drawn
+
+    u32  line_dirty[8];        // Character rows to redraw, by line in the row
+    u8   border_frames;        // Frames for which the border needs drawing
+    bool dirty[WINDOW_HEIGHT]; // Lines of the layer drawn since last cleared
+} Ula;
+
+// What a saved state keeps of the ULA, between frames
+typedef struct {
+    u8   border;
+    u32  frame;
+    bool flash;
+} UlaState;
+
+void ula_init(Ula* ula, Memory* memory, u32* pixels);
+
+// Redraw the whole layer over the next frame
+void ula_invalidate(Ula* ula);
+
+// Start a new frame.  Any cells not yet drawn in the last frame are finished.
+// If draw is false nothing is drawn this frame, though changes to memory and
+// the border are remembered for the next frame that is.
+void ula_start_frame(Ula* ula, bool draw);
+
+// Draw every cell whose time is at or before t
+void ula_update(Ula* ula, u32 t);
+
+// Change the border colour at time t
+void ula_set_border(Ula* ula, u32 t, u8 colour);
+
+// Time the display to a model whose top-left pixel is fetched at display_start
+// with line_tstates T-states a line.  Every Ula shares the timing, which is
+// 48K until this is called.
+void ula_set_timing(u32 display_start, u32 line_tstates);
+
+// The T-state at which line y (0 to WINDOW_HEIGHT-1) of the layer starts
+// drawing its display cells.  Running the CPU up to this point and then calling
+// ula_update renders the frame line by line.
+u32 ula_line_time(u32 y);
+
+void ula_save(const Ula* ula, UlaState* state);
+
+// Go back to a saved state and redraw everything
+void ula_restore(Ula* ula, const UlaState* state);
@@ -0,0 +1,1726 @@
+//------------------------------------------------------------------------------
+// Z80 instruction handlers
+//
+// This file has no include guard: z80.c includes it once per core variant.
+// Before each inclusion it defines these to 0 or 1:
+//
+//      Z80_CONTEND     Apply ULA contention from Z80.contention.
+//      Z80_TRACE       Report every bus cycle through Z80.trace.
+//      Z80_BREAK       Stop before executing an address in Z80.breakpoints.
+//
+// and this file undefines them again at the end.  Every symbol generated here
+// gets a suffix naming the combination, e.g. run_v010 for the traced core.
+//
+// Each prefix page is a 256-entry table of handlers.  The DD and FD pages share
+// one table (and DDCB/FDCB another) with z->xy pointing at IX or IY.  Timings
+// and the order of bus cycles follow the FUSE core, which the test data in
+// etc/tests was generated from.
+//------------------------------------------------------------------------------
+
+#define OP(name) static void Z80_FN(name)(Z80* z)
+#define SET(page, n, name) Z80_FN(ops_##page)[n] = Z80_FN(name)
+
+static Z80Op Z80_FN(ops_base)[256];
+static Z80Op Z80_FN(ops_cb)[256];
+static Z80Op Z80_FN(ops_ed)[256];
+static Z80Op Z80_FN(ops_xy)[256];
+static Z80Op Z80_FN(ops_xycb)[256];
+
+//------------------------------------------------------------------------------
+// Bus cycles
+//------------------------------------------------------------------------------
+
+// Stall until the ULA lets the CPU onto the bus
+Z80_BUS void Z80_FN(ula_delay)(Z80* z)
+{
+#if Z80_CONTEND
+    z->t += z->contention[z->t];
+#else
+    (void)z;
+#endif
+}
+
+Z80_BUS void Z80_FN(contend)(Z80* z, u16 addr, u32 cycles)
+{
+#if Z80_CONTEND
+    if (mem_contended(z->memory, addr)) {
+        Z80_FN(ula_delay)(z);
+    }
+#endif
+#if Z80_TRACE
+    z->trace(z->user, Z80Event_MemoryContend, z->t, addr, 0);
+#endif
+    (void)addr;
+    z->t += cycles;
+}
+
+// Internal cycles that leave addr on the bus, one T-state each.  Untraced,
+// the page only needs checking once.
+Z80_BUS void Z80_FN(nomreq)(Z80* z, u16 addr, u32 cycles)
+{
+#if Z80_TRACE
+    for (u32 i = 0; i < cycles; ++i) {
+        Z80_FN(contend)(z, addr, 1);
+    }
+#elif Z80_CONTEND
+    if (mem_contended(z->memory, addr)) {
+        for (u32 i = 0; i < cycles; ++i) {
+            Z80_FN(ula_delay)(z);
+            z->t += 1;
+        }
+    } else {
+        z->t += cycles;
+    }
+#else
+    (void)addr;
+    z->t += cycles;
+#endif
+}
+
+Z80_BUS u8 Z80_FN(read)(Z80* z, u16 addr)
+{
+    Z80_FN(contend)(z, addr, 3);
+    u8 value = mem_read(z->memory, addr);
+#if Z80_TRACE
+    z->trace(z->user, Z80Event_MemoryRead, z->t, addr, value);
+#endif
+    return value;
+}
+
+Z80_BUS void Z80_FN(write)(Z80* z, u16 addr, u8 value)
+{
+    Z80_FN(contend)(z, addr, 3);
+#if Z80_TRACE
+    z->trace(z->user, Z80Event_MemoryWrite, z->t, addr, value);
+#endif
+    mem_write(z->memory, addr, value);
+}
+
+// M1 cycle
+Z80_BUS u8 Z80_FN(fetch)(Z80* z)
+{
+    Z80_FN(contend)(z, PC, 4);
+    u8 op = mem_read(z->memory, PC);
+#if Z80_TRACE
+    z->trace(z->user, Z80Event_MemoryRead, z->t, PC, op);
+#endif
+    PC++;
+    z->r++;
+    return op;
+}
+
+// The ULA contends I/O on even ports and on ports that look like addresses in
+// contended memory.  The cycle before the access is one T-state and the cycles
+// after it three.
+static inline void Z80_FN(port_contend)(Z80* z, u16 port, u32 cycles)
+{
+#if Z80_CONTEND
+    z->t += z->io_contention[z->t];
+#endif
+#if Z80_TRACE
+    z->trace(z->user, Z80Event_PortContend, z->t, port, 0);
+#endif
+    (void)port;
+    z->t += cycles;
+}
+
+// True if port looks like an address in contended memory.  The uncontended
+// cores only trace the cycles, so they keep the 48K's map, which the FUSE
+// tests expect.
+static inline bool Z80_FN(port_high_contended)(Z80* z, u16 port)
+{
+#if Z80_CONTEND
+    return mem_contended(z->memory, port);
+#else
+    (void)z;
+    return (port & 0xc000) == 0x4000;
+#endif
+}
+
+static inline void Z80_FN(port_pre)(Z80* z, u16 port)
+{
+    if (Z80_FN(port_high_contended)(z, port)) {
+        Z80_FN(port_contend)(z, port, 1);
+    } else {
+        z->t += 1;
+    }
+}
+
+static inline void Z80_FN(port_post)(Z80* z, u16 port)
+{
+    if (port & 0x0001) {
+        if (Z80_FN(port_high_contended)(z, port)) {
+            Z80_FN(port_contend)(z, port, 1);
+            Z80_FN(port_contend)(z, port, 1);
+            Z80_FN(port_contend)(z, port, 1);
+        } else {
+            z->t += 3;
+        }
+    } else {
+        Z80_FN(port_contend)(z, port, 3);
+    }
+}
+
+static inline u8 Z80_FN(port_in)(Z80* z, u16 port)
+{
+    Z80_FN(port_pre)(z, port);
+    u8 value = z->port_in(z->user, port);
+#if Z80_TRACE
+    z->trace(z->user, Z80Event_PortRead, z->t, port, value);
+#endif
+    Z80_FN(port_post)(z, port);
+    return value;
+}
+
+static inline void Z80_FN(port_out)(Z80* z, u16 port, u8 value)
+{
+    Z80_FN(port_pre)(z, port);
+#if Z80_TRACE
+    z->trace(z->user, Z80Event_PortWrite, z->t, port, value);
+#endif
+    z->port_out(z->user, port, value);
+    Z80_FN(port_post)(z, port);
+}
+
+#define FETCH() Z80_FN(fetch)(z)
+#define RD(addr) Z80_FN(read)(z, (u16)(addr))
+#define WR(addr, v) Z80_FN(write)(z, (u16)(addr), (v))
+#define CONTEND(addr, n) Z80_FN(contend)(z, (u16)(addr), (n))
+#define NOMREQ(addr, n) Z80_FN(nomreq)(z, (u16)(addr), (n))
+#define IN(port) Z80_FN(port_in)(z, (port))
+#define OUT(port, v) Z80_FN(port_out)(z, (port), (v))
+
+//------------------------------------------------------------------------------
+// Common sequences
+//------------------------------------------------------------------------------
+
+static inline u16 Z80_FN(read_pc16)(Z80* z)
+{
+    u8 lo = RD(PC++);
+    u8 hi = RD(PC++);
+    return (u16)(lo | (hi << 8));
+}
+
+static inline void Z80_FN(push)(Z80* z, u16 v)
+{
+    WR(--SP, (u8)(v >> 8));
+    WR(--SP, (u8)v);
+}
+
+static inline u16 Z80_FN(pop)(Z80* z)
+{
+    u8 lo = RD(SP++);
+    u8 hi = RD(SP++);
+    return (u16)(lo | (hi << 8));
+}
+
+static inline void Z80_FN(jr_taken)(Z80* z)
+{
+    i8 offset = (i8)RD(PC);
+    NOMREQ(PC, 5);
+    PC += offset + 1;
+    WZ = PC;
+}
+
+static inline void Z80_FN(ret_taken)(Z80* z)
+{
+    PC = Z80_FN(pop)(z);
+    WZ = PC;
+}
+
+// Address of (XY+d) for instructions with no further operand
+static inline u16 Z80_FN(xy_addr)(Z80* z)
+{
+    i8 d = (i8)RD(PC);
+    NOMREQ(PC, 5);
+    PC++;
+    WZ = (u16)(XY + d);
+    return WZ;
+}
+
+//------------------------------------------------------------------------------
+// Unprefixed page
+//------------------------------------------------------------------------------
+
+OP(nop) {}
+
+OP(halt)
+{
+    z->halted = true;
+    PC--;
+#if !Z80_TRACE
+    // Rather than refetch HALT every 4T, skip straight to the end of the run.
+    // R still counts the M1 cycles that would have happened.  A HALT in
+    // contended memory has to be stepped so each refetch is delayed.
+#    if Z80_CONTEND
+    bool skip = !mem_contended(z->memory, PC);
+#    else
+    bool skip = true;
+#    endif
+    if (skip && z->t < z->t_end && (z->t >= z->irq_end || !z->iff1)) {
+        u32 n = (z->t_end - z->t + 3) / 4;
+        z->t += n * 4;
+        z->r += (u8)n;
+    }
+#endif
+}
+
+// 8-bit loads
+
+#define LD_R_R(d, s)                                                           \
+    OP(ld_##d##_##s) { d = s; }
+#define LD_R_MEM(r)                                                            \
+    OP(ld_##r##_HL) { r = RD(HL); }                                            \
+    OP(ld_HL_##r) { WR(HL, r); }                                               \
+    OP(ld_##r##_n) { r = RD(PC++); }
+
+LD_R_R(B, B)
+LD_R_R(B, C)
+LD_R_R(B, D)
+LD_R_R(B, E)
+LD_R_R(B, H)
+LD_R_R(B, L)
+LD_R_R(B, A)
+
+LD_R_R(C, B)
+LD_R_R(C, C)
+LD_R_R(C, D)
+LD_R_R(C, E)
+LD_R_R(C, H)
+LD_R_R(C, L)
+LD_R_R(C, A)
+
+LD_R_R(D, B)
+LD_R_R(D, C)
+LD_R_R(D, D)
+LD_R_R(D, E)
+LD_R_R(D, H)
+LD_R_R(D, L)
+LD_R_R(D, A)
+
+LD_R_R(E, B)
+LD_R_R(E, C)
+LD_R_R(E, D)
+LD_R_R(E, E)
+LD_R_R(E, H)
+LD_R_R(E, L)
+LD_R_R(E, A)
+
+LD_R_R(H, B)
+LD_R_R(H, C)
+LD_R_R(H, D)
+LD_R_R(H, E)
+LD_R_R(H, H)
+LD_R_R(H, L)
+LD_R_R(H, A)
+
+LD_R_R(L, B)
+LD_R_R(L, C)
+LD_R_R(L, D)
+LD_R_R(L, E)
+LD_R_R(L, H)
+LD_R_R(L, L)
+LD_R_R(L, A)
+
+LD_R_R(A, B)
+LD_R_R(A, C)
+LD_R_R(A, D)
+LD_R_R(A, E)
+LD_R_R(A, H)
+LD_R_R(A, L)
+LD_R_R(A, A)
+
+LD_R_MEM(B)
+LD_R_MEM(C)
+LD_R_MEM(D)
+LD_R_MEM(E)
+LD_R_MEM(H)
+LD_R_MEM(L)
+LD_R_MEM(A)
+
+OP(ld_HL_n)
+{
+    u8 v = RD(PC++);
+    WR(HL, v);
+}
+
+OP(ld_BC_A)
+{
+    WR(BC, A);
+    WZ = (u16)(((BC + 1) & 0xff) | (A << 8));
+}
+
+OP(ld_DE_A)
+{
+    WR(DE, A);
+    WZ = (u16)(((DE + 1) & 0xff) | (A << 8));
+}
+
+OP(ld_A_BC)
+{
+    WZ = BC + 1;
+    A  = RD(BC);
+}
+
+OP(ld_A_DE)
+{
+    WZ = DE + 1;
+    A  = RD(DE);
+}
+
+OP(ld_nn_A)
+{
+    u16 addr = Z80_FN(read_pc16)(z);
+    WR(addr, A);
+    WZ = (u16)(((addr + 1) & 0xff) | (A << 8));
+}
+
+OP(ld_A_nni)
+{
+    u16 addr = Z80_FN(read_pc16)(z);
+    WZ       = addr + 1;
+    A        = RD(addr);
+}
+
+// 16-bit loads and arithmetic
+
+#define LD16(rr, reg)                                                          \
+    OP(ld_##rr##_nn) { reg = Z80_FN(read_pc16)(z); }                           \
+    OP(ld_nn_##rr)                                                             \
+    {                                                                          \
+        u16 addr = Z80_FN(read_pc16)(z);                                       \
+        WR(addr, (u8)reg);                                                     \
+        WR(addr + 1, (u8)(reg >> 8));                                          \
+        WZ = addr + 1;                                                         \
+    }                                                                          \
+    OP(ld_##rr##_nni)                                                          \
+    {                                                                          \
+        u16 addr = Z80_FN(read_pc16)(z);                                       \
+        u8  lo   = RD(addr);                                                   \
+        u8  hi   = RD(addr + 1);                                               \
+        reg      = (u16)(lo | (hi << 8));                                      \
+        WZ       = addr + 1;                                                   \
+    }                                                                          \
+    OP(inc_##rr)                                                               \
+    {                                                                          \
+        NOMREQ(IR, 2);                                                         \
+        reg++;                                                                 \
+    }                                                                          \
+    OP(dec_##rr)                                                               \
+    {                                                                          \
+        NOMREQ(IR, 2);                                                         \
+        reg--;                                                                 \
+    }
+
+LD16(bc, BC)
+LD16(de, DE)
+LD16(hl, HL)
+LD16(sp, SP)
+LD16(xy, XY)
+
+#define ADD16(dst, dreg, rr, reg)                                              \
+    OP(add_##dst##_##rr)                                                       \
+    {                                                                          \
+        NOMREQ(IR, 7);                                                         \
+        dreg = alu_add16(z, dreg, reg);                                        \
+    }
+
+ADD16(hl, HL, bc, BC)
+ADD16(hl, HL, de, DE)
+ADD16(hl, HL, hl, HL)
+ADD16(hl, HL, sp, SP)
+ADD16(xy, XY, bc, BC)
+ADD16(xy, XY, de, DE)
+ADD16(xy, XY, xy, XY)
+ADD16(xy, XY, sp, SP)
+
+#define ADC_SBC16(rr, reg)                                                     \
+    OP(adc_hl_##rr)                                                            \
+    {                                                                          \
+        NOMREQ(IR, 7);                                                         \
+        alu_adc16(z, reg);                                                     \
+    }                                                                          \
+    OP(sbc_hl_##rr)                                                            \
+    {                                                                          \
+        NOMREQ(IR, 7);                                                         \
+        alu_sbc16(z, reg);                                                     \
+    }
+
+ADC_SBC16(bc, BC)
+ADC_SBC16(de, DE)
+ADC_SBC16(hl, HL)
+ADC_SBC16(sp, SP)
+
+#define PUSH_POP(rr, reg)                                                      \
+    OP(push_##rr)                                                              \
+    {                                                                          \
+        NOMREQ(IR, 1);                                                         \
+        Z80_FN(push)(z, reg);                                                  \
+    }                                                                          \
+    OP(pop_##rr) { reg = Z80_FN(pop)(z); }
+
+PUSH_POP(bc, BC)
+PUSH_POP(de, DE)
+PUSH_POP(hl, HL)
+PUSH_POP(af, AF)
+PUSH_POP(xy, XY)
+
+OP(ld_sp_hl)
+{
+    NOMREQ(IR, 2);
+    SP = HL;
+}
+
+OP(ld_sp_xy)
+{
+    NOMREQ(IR, 2);
+    SP = XY;
+}
+
+// 8-bit arithmetic
+
+#define INC_DEC(r)                                                             \
+    OP(inc_##r) { r = alu_inc(z, r); }                                         \
+    OP(dec_##r) { r = alu_dec(z, r); }
+
+INC_DEC(B)
+INC_DEC(C)
+INC_DEC(D)
+INC_DEC(E)
+INC_DEC(H)
+INC_DEC(L)
+INC_DEC(A)
+INC_DEC(XYH)
+INC_DEC(XYL)
+
+OP(inc_HL)
+{
+    u8 v = RD(HL);
+    NOMREQ(HL, 1);
+    WR(HL, alu_inc(z, v));
+}
+
+OP(dec_HL)
+{
+    u8 v = RD(HL);
+    NOMREQ(HL, 1);
+    WR(HL, alu_dec(z, v));
+}
+
+#define ALU_ALL(op)                                                            \
+    OP(op##_B) { alu_##op(z, B); }                                             \
+    OP(op##_C) { alu_##op(z, C); }                                             \
+    OP(op##_D) { alu_##op(z, D); }                                             \
+    OP(op##_E) { alu_##op(z, E); }                                             \
+    OP(op##_H) { alu_##op(z, H); }                                             \
+    OP(op##_L) { alu_##op(z, L); }                                             \
+    OP(op##_HL) { alu_##op(z, RD(HL)); }                                       \
+    OP(op##_A) { alu_##op(z, A); }                                             \
+    OP(op##_n) { alu_##op(z, RD(PC++)); }                                      \
+    OP(op##_XYH) { alu_##op(z, XYH); }                                         \
+    OP(op##_XYL) { alu_##op(z, XYL); }                                         \
+    OP(op##_XYd)                                                               \
+    {                                                                          \
+        u16 addr = Z80_FN(xy_addr)(z);                                         \
+        alu_##op(z, RD(addr));                                                 \
+    }
+
+ALU_ALL(add)
+ALU_ALL(adc)
+ALU_ALL(sub)
+ALU_ALL(sbc)
+ALU_ALL(and)
+ALU_ALL(xor)
+ALU_ALL(or)
+ALU_ALL(cp)
+
+OP(rlca) { alu_rlca(z); }
+OP(rrca) { alu_rrca(z); }
+OP(rla) { alu_rla(z); }
+OP(rra) { alu_rra(z); }
+OP(daa) { alu_daa(z); }
+OP(cpl) { alu_cpl(z); }
+OP(scf) { alu_scf(z); }
+OP(ccf) { alu_ccf(z); }
+
+// Exchanges
+
+OP(ex_af)
+{
+    u16 t  = AF;
+    AF     = z->af_.w;
+    z->af_.w = t;
+}
+
+OP(exx)
+{
+    u16 t;
+    t        = BC;
+    BC       = z->bc_.w;
+    z->bc_.w = t;
+    t        = DE;
+    DE       = z->de_.w;
+    z->de_.w = t;
+    t        = HL;
+    HL       = z->hl_.w;
+    z->hl_.w = t;
+}
+
+OP(ex_de_hl)
+{
+    u16 t = DE;
+    DE    = HL;
+    HL    = t;
+}
+
+#define EX_SP(rr, reg)                                                         \
+    OP(ex_sp_##rr)                                                             \
+    {                                                                          \
+        u8 lo = RD(SP);                                                        \
+        u8 hi = RD(SP + 1);                                                    \
+        NOMREQ(SP + 1, 1);                                                     \
+        WR(SP + 1, (u8)(reg >> 8));                                            \
+        WR(SP, (u8)reg);                                                       \
+        NOMREQ(SP, 2);                                                         \
+        reg = (u16)(lo | (hi << 8));                                           \
+        WZ  = reg;                                                             \
+    }
+
+EX_SP(hl, HL)
+EX_SP(xy, XY)
+
+// Jumps, calls and returns
+
+#define COND_NZ (!(F & FLAG_Z))
+#define COND_Z (F & FLAG_Z)
+#define COND_NC (!(F & FLAG_C))
+#define COND_C (F & FLAG_C)
+#define COND_PO (!(F & FLAG_P))
+#define COND_PE (F & FLAG_P)
+#define COND_P (!(F & FLAG_S))
+#define COND_M (F & FLAG_S)
+
+#define JR_CC(cc)                                                              \
+    OP(jr_##cc)                                                                \
+    {                                                                          \
+        if (COND_##cc) {                                                       \
+            Z80_FN(jr_taken)(z);                                                     \
+        } else {                                                               \
+            CONTEND(PC, 3);                                                    \
+            PC++;                                                              \
+        }                                                                      \
+    }
+
+#define JP_CC(cc)                                                              \
+    OP(jp_##cc)                                                                \
+    {                                                                          \
+        if (COND_##cc) {                                                       \
+            PC = WZ = Z80_FN(read_pc16)(z);                                    \
+        } else {                                                               \
+            CONTEND(PC, 3);                                                    \
+            CONTEND(PC + 1, 3);                                                \
+            PC += 2;                                                           \
+        }                                                                      \
+    }
+
+#define CALL_CC(cc)                                                            \
+    OP(call_##cc)                                                              \
+    {                                                                          \
+        if (COND_##cc) {                                                       \
+            Z80_FN(call)(z);                                                   \
+        } else {                                                               \
+            CONTEND(PC, 3);                                                    \
+            CONTEND(PC + 1, 3);                                                \
+            PC += 2;                                                           \
+        }                                                                      \
+    }
+
+#define RET_CC(cc)                                                             \
+    OP(ret_##cc)                                                               \
+    {                                                                          \
+        NOMREQ(IR, 1);                                                         \
+        if (COND_##cc) {                                                       \
+            Z80_FN(ret_taken)(z);                                                    \
+        }                                                                      \
+    }
+
+OP(call)
+{
+    u8 lo = RD(PC++);
+    u8 hi = RD(PC);
+    NOMREQ(PC, 1);
+    PC++;
+    WZ = (u16)(lo | (hi << 8));
+    Z80_FN(push)(z, PC);
+    PC = WZ;
+}
+
+OP(jr) { Z80_FN(jr_taken)(z); }
+OP(jp) { PC = WZ = Z80_FN(read_pc16)(z); }
+OP(ret) { Z80_FN(ret_taken)(z); }
+OP(jp_hl) { PC = HL; }
+OP(jp_xy) { PC = XY; }
+
+JR_CC(NZ)
+JR_CC(Z)
+JR_CC(NC)
+JR_CC(C)
+
+JP_CC(NZ)
+JP_CC(Z)
+JP_CC(NC)
+JP_CC(C)
+JP_CC(PO)
+JP_CC(PE)
+JP_CC(P)
+JP_CC(M)
+
+CALL_CC(NZ)
+CALL_CC(Z)
+CALL_CC(NC)
+CALL_CC(C)
+CALL_CC(PO)
+CALL_CC(PE)
+CALL_CC(P)
+CALL_CC(M)
+
+RET_CC(NZ)
+RET_CC(Z)
+RET_CC(NC)
+RET_CC(C)
+RET_CC(PO)
+RET_CC(PE)
+RET_CC(P)
+RET_CC(M)
+
+OP(djnz)
+{
+    NOMREQ(IR, 1);
+    if (--B) {
+        Z80_FN(jr_taken)(z);
+    } else {
+        CONTEND(PC, 3);
+        PC++;
+    }
+}
+
+#define RST(n)                                                                 \
+    OP(rst_##n)                                                                \
+    {                                                                          \
+        NOMREQ(IR, 1);                                                         \
+        Z80_FN(push)(z, PC);                                                   \
+        PC = WZ = 0x##n;                                                       \
+    }
+
+RST(00)
+RST(08)
+RST(10)
+RST(18)
+RST(20)
+RST(28)
+RST(30)
+RST(38)
+
+// Input and output
+
+OP(out_n_A)
+{
+    u8 n = RD(PC++);
+    OUT((u16)(n | (A << 8)), A);
+    WZ = (u16)(((n + 1) & 0xff) | (A << 8));
+}
+
+OP(in_A_n)
+{
+    u16 port = (u16)(RD(PC++) | (A << 8));
+    A        = IN(port);
+    WZ       = port + 1;
+}
+
+// Interrupt control
+
+OP(di) { z->iff1 = z->iff2 = 0; }
+
+OP(ei)
+{
+    z->iff1 = z->iff2 = 1;
+    z->ei_t = z->t;
+}
+
+// Prefixes
+
+OP(prefix_cb) { Z80_FN(ops_cb)[FETCH()](z); }
+OP(prefix_ed) { Z80_FN(ops_ed)[FETCH()](z); }
+
+OP(prefix_dd)
+{
+    z->xy = &z->ix;
+    Z80_FN(ops_xy)[FETCH()](z);
+}
+
+OP(prefix_fd)
+{
+    z->xy = &z->iy;
+    Z80_FN(ops_xy)[FETCH()](z);
+}
+
+//------------------------------------------------------------------------------
+// CB page
+//------------------------------------------------------------------------------
+
+#define CB_SHIFT(op)                                                           \
+    OP(op##_B) { B = alu_##op(z, B); }                                         \
+    OP(op##_C) { C = alu_##op(z, C); }                                         \
+    OP(op##_D) { D = alu_##op(z, D); }                                         \
+    OP(op##_E) { E = alu_##op(z, E); }                                         \
+    OP(op##_H) { H = alu_##op(z, H); }                                         \
+    OP(op##_L) { L = alu_##op(z, L); }                                         \
+    OP(op##_A) { A = alu_##op(z, A); }                                         \
+    OP(op##_HL)                                                                \
+    {                                                                          \
+        u8 v = RD(HL);                                                         \
+        NOMREQ(HL, 1);                                                         \
+        WR(HL, alu_##op(z, v));                                                \
+    }
+
+CB_SHIFT(rlc)
+CB_SHIFT(rrc)
+CB_SHIFT(rl)
+CB_SHIFT(rr)
+CB_SHIFT(sla)
+CB_SHIFT(sra)
+CB_SHIFT(sll)
+CB_SHIFT(srl)
+
+#define CB_BIT(n)                                                              \
+    OP(bit_##n##_B) { alu_bit(z, n, B, B); }                                   \
+    OP(bit_##n##_C) { alu_bit(z, n, C, C); }                                   \
+    OP(bit_##n##_D) { alu_bit(z, n, D, D); }                                   \
+    OP(bit_##n##_E) { alu_bit(z, n, E, E); }                                   \
+    OP(bit_##n##_H) { alu_bit(z, n, H, H); }                                   \
+    OP(bit_##n##_L) { alu_bit(z, n, L, L); }                                   \
+    OP(bit_##n##_A) { alu_bit(z, n, A, A); }                                   \
+    OP(bit_##n##_HL)                                                           \
+    {                                                                          \
+        u8 v = RD(HL);                                                         \
+        NOMREQ(HL, 1);                                                         \
+        /* Flags 3 and 5 come from the value, as in the FUSE test data */      \
+        alu_bit(z, n, v, v);                                                   \
+    }                                                                          \
+    OP(res_##n##_B) { B &= ~(1 << n); }                                        \
+    OP(res_##n##_C) { C &= ~(1 << n); }                                        \
+    OP(res_##n##_D) { D &= ~(1 << n); }                                        \
+    OP(res_##n##_E) { E &= ~(1 << n); }                                        \
+    OP(res_##n##_H) { H &= ~(1 << n); }                                        \
+    OP(res_##n##_L) { L &= ~(1 << n); }                                        \
+    OP(res_##n##_A) { A &= ~(1 << n); }                                        \
+    OP(res_##n##_HL)                                                           \
+    {                                                                          \
+        u8 v = RD(HL);                                                         \
+        NOMREQ(HL, 1);                                                         \
+        WR(HL, v & ~(1 << n));                                                 \
+    }                                                                          \
+    OP(set_##n##_B) { B |= (1 << n); }                                         \
+    OP(set_##n##_C) { C |= (1 << n); }                                         \
+    OP(set_##n##_D) { D |= (1 << n); }                                         \
+    OP(set_##n##_E) { E |= (1 << n); }                                         \
+    OP(set_##n##_H) { H |= (1 << n); }                                         \
+    OP(set_##n##_L) { L |= (1 << n); }                                         \
+    OP(set_##n##_A) { A |= (1 << n); }                                         \
+    OP(set_##n##_HL)                                                           \
+    {                                                                          \
+        u8 v = RD(HL);                                                         \
+        NOMREQ(HL, 1);                                                         \
+        WR(HL, v | (1 << n));                                                  \
+    }
+
+CB_BIT(0)
+CB_BIT(1)
+CB_BIT(2)
+CB_BIT(3)
+CB_BIT(4)
+CB_BIT(5)
+CB_BIT(6)
+CB_BIT(7)
+
+//------------------------------------------------------------------------------
+// ED page
+//------------------------------------------------------------------------------
+
+#define IN_OUT_C(r)                                                            \
+    OP(in_##r##_C)                                                             \
+    {                                                                          \
+        WZ = BC + 1;                                                           \
+        r  = IN(BC);                                                           \
+        F  = (F & FLAG_C) | g_sz53p[r];                                        \
+    }                                                                          \
+    OP(out_C_##r)                                                              \
+    {                                                                          \
+        OUT(BC, r);                                                            \
+        WZ = BC + 1;                                                           \
+    }
+
+IN_OUT_C(B)
+IN_OUT_C(C)
+IN_OUT_C(D)
+IN_OUT_C(E)
+IN_OUT_C(H)
+IN_OUT_C(L)
+IN_OUT_C(A)
+
+// IN F,(C) only sets the flags
+OP(in_F_C)
+{
+    WZ   = BC + 1;
+    u8 v = IN(BC);
+    F    = (F & FLAG_C) | g_sz53p[v];
+}
+
+OP(out_C_0)
+{
+    OUT(BC, 0);
+    WZ = BC + 1;
+}
+
+OP(neg) { alu_neg(z); }
+
+// RETI behaves like RETN, copying IFF2 back to IFF1
+OP(retn)
+{
+    z->iff1 = z->iff2;
+    Z80_FN(ret_taken)(z);
+}
+
+OP(im_0) { z->im = 0; }
+OP(im_1) { z->im = 1; }
+OP(im_2) { z->im = 2; }
+
+OP(ld_I_A)
+{
+    NOMREQ(IR, 1);
+    z->i = A;
+}
+
+OP(ld_R_A)
+{
+    NOMREQ(IR, 1);
+    z80_set_r(z, A);
+}
+
+OP(ld_A_I)
+{
+    NOMREQ(IR, 1);
+    A = z->i;
+    F = (F & FLAG_C) | g_sz53[A] | (z->iff2 ? FLAG_V : 0);
+}
+
+OP(ld_A_R)
+{
+    NOMREQ(IR, 1);
+    A = z80_get_r(z);
+    F = (F & FLAG_C) | g_sz53[A] | (z->iff2 ? FLAG_V : 0);
+}
+
+OP(rrd)
+{
+    u8 v = RD(HL);
+    NOMREQ(HL, 4);
+    WR(HL, (u8)((A << 4) | (v >> 4)));
+    A  = (A & 0xf0) | (v & 0x0f);
+    F  = (F & FLAG_C) | g_sz53p[A];
+    WZ = HL + 1;
+}
+
+OP(rld)
+{
+    u8 v = RD(HL);
+    NOMREQ(HL, 4);
+    WR(HL, (u8)((v << 4) | (A & 0x0f)));
+    A  = (A & 0xf0) | (v >> 4);
+    F  = (F & FLAG_C) | g_sz53p[A];
+    WZ = HL + 1;
+}
+
+// Block instructions.  The repeating forms rewind PC so the instruction is
+// fetched again, with 5 extra T-states per iteration.
+
+static inline void Z80_FN(ld_block)(Z80* z, i32 dir, bool repeat)
+{
+    u8 v = RD(HL);
+    WR(DE, v);
+    NOMREQ(DE, 2);
+    BC--;
+    v += A;
+    F = (F & (FLAG_C | FLAG_Z | FLAG_S)) | (BC ? FLAG_V : 0) | (v & FLAG_3) |
+        ((v & 0x02) ? FLAG_5 : 0);
+    if (repeat && BC) {
+        NOMREQ(DE, 5);
+        PC -= 2;
+        WZ = PC + 1;
+    }
+    HL += dir;
+    DE += dir;
+}
+
+static inline void Z80_FN(cp_block)(Z80* z, i32 dir, bool repeat)
+{
+    u8 v  = RD(HL);
+    u8 r  = A - v;
+    u8 lu = (u8)(((A & 0x08) >> 3) | ((v & 0x08) >> 2) | ((r & 0x08) >> 1));
+    NOMREQ(HL, 5);
+    BC--;
+    F = (F & FLAG_C) | (BC ? (FLAG_V | FLAG_N) : FLAG_N) | g_halfcarry_sub[lu] |
+        (r ? 0 : FLAG_Z) | (r & FLAG_S);
+    if (F & FLAG_H) {
+        r--;
+    }
+    F |= (r & FLAG_3) | ((r & 0x02) ? FLAG_5 : 0);
+    if (repeat && (F & (FLAG_V | FLAG_Z)) == FLAG_V) {
+        NOMREQ(HL, 5);
+        PC -= 2;
+        WZ = PC + 1;
+    } else {
+        WZ += dir;
+    }
+    HL += dir;
+}
+
+static inline void Z80_FN(in_block)(Z80* z, i32 dir, bool repeat)
+{
+    NOMREQ(IR, 1);
+    u8 v = IN(BC);
+    WR(HL, v);
+    WZ = BC + dir;
+    B--;
+    u8 k = v + C + dir;
+    F    = ((v & 0x80) ? FLAG_N : 0) | ((k < v) ? (FLAG_H | FLAG_C) : 0) |
+        g_parity[(k & 0x07) ^ B] | g_sz53[B];
+    if (repeat && B) {
+        NOMREQ(HL, 5);
+        PC -= 2;
+    }
+    HL += dir;
+}
+
+static inline void Z80_FN(out_block)(Z80* z, i32 dir, bool repeat)
+{
+    NOMREQ(IR, 1);
+    u8 v = RD(HL);
+    B--;
+    WZ = BC + dir;
+    OUT(BC, v);
+    HL += dir;
+    u8 k = v + L;
+    F    = ((v & 0x80) ? FLAG_N : 0) | ((k < v) ? (FLAG_H | FLAG_C) : 0) |
+        g_parity[(k & 0x07) ^ B] | g_sz53[B];
+    if (repeat && B) {
+        NOMREQ(BC, 5);
+        PC -= 2;
+    }
+}
+
+#define BLOCK(name, kind, dir, repeat)                                         \
+    OP(name) { Z80_FN(kind##_block)(z, dir, repeat); }
+
+BLOCK(ldi, ld, 1, false)
+BLOCK(ldd, ld, -1, false)
+BLOCK(ldir, ld, 1, true)
+BLOCK(lddr, ld, -1, true)
+BLOCK(cpi, cp, 1, false)
+BLOCK(cpd, cp, -1, false)
+BLOCK(cpir, cp, 1, true)
+BLOCK(cpdr, cp, -1, true)
+BLOCK(ini, in, 1, false)
+BLOCK(ind, in, -1, false)
+BLOCK(inir, in, 1, true)
+BLOCK(indr, in, -1, true)
+BLOCK(outi, out, 1, false)
+BLOCK(outd, out, -1, false)
+BLOCK(otir, out, 1, true)
+BLOCK(otdr, out, -1, true)
+
+//------------------------------------------------------------------------------
+// DD/FD page
+//
+// Only instructions that involve HL are overridden; everything else runs the
+// unprefixed handler after the prefix's extra 4T.
+//------------------------------------------------------------------------------
+
+#define LD_XY_R(d, s)                                                          \
+    OP(ld_##d##_##s) { d = s; }
+
+LD_XY_R(B, XYH)
+LD_XY_R(B, XYL)
+LD_XY_R(C, XYH)
+LD_XY_R(C, XYL)
+LD_XY_R(D, XYH)
+LD_XY_R(D, XYL)
+LD_XY_R(E, XYH)
+LD_XY_R(E, XYL)
+LD_XY_R(A, XYH)
+LD_XY_R(A, XYL)
+LD_XY_R(XYH, B)
+LD_XY_R(XYH, C)
+LD_XY_R(XYH, D)
+LD_XY_R(XYH, E)
+LD_XY_R(XYH, XYL)
+LD_XY_R(XYH, A)
+LD_XY_R(XYL, B)
+LD_XY_R(XYL, C)
+LD_XY_R(XYL, D)
+LD_XY_R(XYL, E)
+LD_XY_R(XYL, XYH)
+LD_XY_R(XYL, A)
+
+OP(ld_XYH_n) { XYH = RD(PC++); }
+OP(ld_XYL_n) { XYL = RD(PC++); }
+
+#define LD_XYD(r)                                                              \
+    OP(ld_##r##_XYd)                                                           \
+    {                                                                          \
+        u16 addr = Z80_FN(xy_addr)(z);                                         \
+        r        = RD(addr);                                                   \
+    }                                                                          \
+    OP(ld_XYd_##r)                                                             \
+    {                                                                          \
+        u16 addr = Z80_FN(xy_addr)(z);                                         \
+        WR(addr, r);                                                           \
+    }
+
+LD_XYD(B)
+LD_XYD(C)
+LD_XYD(D)
+LD_XYD(E)
+LD_XYD(H)
+LD_XYD(L)
+LD_XYD(A)
+
+OP(ld_XYd_n)
+{
+    i8 d = (i8)RD(PC++);
+    u8 v = RD(PC);
+    NOMREQ(PC, 2);
+    PC++;
+    WZ = (u16)(XY + d);
+    WR(WZ, v);
+}
+
+OP(inc_XYd)
+{
+    u16 addr = Z80_FN(xy_addr)(z);
+    u8  v    = RD(addr);
+    NOMREQ(addr, 1);
+    WR(addr, alu_inc(z, v));
+}
+
+OP(dec_XYd)
+{
+    u16 addr = Z80_FN(xy_addr)(z);
+    u8  v    = RD(addr);
+    NOMREQ(addr, 1);
+    WR(addr, alu_dec(z, v));
+}
+
+// DDCB/FDCB d op: the displacement comes before the opcode, which is read as
+// ordinary data rather than with an M1 cycle.
+OP(prefix_xycb)
+{
+    i8 d = (i8)RD(PC++);
+    u8 op = RD(PC);
+    NOMREQ(PC, 2);
+    PC++;
+    WZ = (u16)(XY + d);
+    Z80_FN(ops_xycb)[op](z);
+}
+
+//------------------------------------------------------------------------------
+// DDCB/FDCB page
+//
+// The address is in WZ.  Apart from BIT, every instruction also copies its
+// result into the register named by the low three bits of the opcode.
+//------------------------------------------------------------------------------
+
+#define XYCB_OP(name)                                                    \
+    OP(xy##name##_B) { B = Z80_FN(xy##name)(z); }                              \
+    OP(xy##name##_C) { C = Z80_FN(xy##name)(z); }                              \
+    OP(xy##name##_D) { D = Z80_FN(xy##name)(z); }                              \
+    OP(xy##name##_E) { E = Z80_FN(xy##name)(z); }                              \
+    OP(xy##name##_H) { H = Z80_FN(xy##name)(z); }                              \
+    OP(xy##name##_L) { L = Z80_FN(xy##name)(z); }                              \
+    OP(xy##name##_HL) { Z80_FN(xy##name)(z); }                                 \
+    OP(xy##name##_A) { A = Z80_FN(xy##name)(z); }
+
+#define XYCB_DEFINE(name, expr)                                                \
+    static inline u8 Z80_FN(xy##name)(Z80* z)                                 \
+    {                                                                          \
+        u8 v = RD(WZ);                                                         \
+        NOMREQ(WZ, 1);                                                         \
+        v = (expr);                                                            \
+        WR(WZ, v);                                                             \
+        return v;                                                              \
+    }                                                                          \
+    XYCB_OP(name)
+
+XYCB_DEFINE(rlc, alu_rlc(z, v))
+XYCB_DEFINE(rrc, alu_rrc(z, v))
+XYCB_DEFINE(rl, alu_rl(z, v))
+XYCB_DEFINE(rr, alu_rr(z, v))
+XYCB_DEFINE(sla, alu_sla(z, v))
+XYCB_DEFINE(sra, alu_sra(z, v))
+XYCB_DEFINE(sll, alu_sll(z, v))
+XYCB_DEFINE(srl, alu_srl(z, v))
+
+#define XYCB_BIT(n)                                                            \
+    OP(xybit_##n)                                                              \
+    {                                                                          \
+        u8 v = RD(WZ);                                                         \
+        NOMREQ(WZ, 1);                                                         \
+        alu_bit(z, n, v, z->wz.h);                                             \
+    }                                                                          \
+    XYCB_DEFINE(res_##n, v & ~(1 << n))                                        \
+    XYCB_DEFINE(set_##n, v | (1 << n))
+
+XYCB_BIT(0)
+XYCB_BIT(1)
+XYCB_BIT(2)
+XYCB_BIT(3)
+XYCB_BIT(4)
+XYCB_BIT(5)
+XYCB_BIT(6)
+XYCB_BIT(7)
+
+//------------------------------------------------------------------------------
+// Opcode tables
+//------------------------------------------------------------------------------
+
+// Fill 8 consecutive entries whose low three bits select B, C, D, E, H, L,
+// (HL) and A.
+#define SET_R8(page, n, prefix)                                                \
+    SET(page, (n) + 0, prefix##_B);                                            \
+    SET(page, (n) + 1, prefix##_C);                                            \
+    SET(page, (n) + 2, prefix##_D);                                            \
+    SET(page, (n) + 3, prefix##_E);                                            \
+    SET(page, (n) + 4, prefix##_H);                                            \
+    SET(page, (n) + 5, prefix##_L);                                            \
+    SET(page, (n) + 6, prefix##_HL);                                           \
+    SET(page, (n) + 7, prefix##_A)
+
+static void Z80_FN(tables_init)(void)
+{
+    //
+    // Unprefixed
+    //
+
+    SET(base, 0x00, nop);
+    SET(base, 0x01, ld_bc_nn);
+    SET(base, 0x02, ld_BC_A);
+    SET(base, 0x03, inc_bc);
+    SET(base, 0x04, inc_B);
+    SET(base, 0x05, dec_B);
+    SET(base, 0x06, ld_B_n);
+    SET(base, 0x07, rlca);
+    SET(base, 0x08, ex_af);
+    SET(base, 0x09, add_hl_bc);
+    SET(base, 0x0a, ld_A_BC);
+    SET(base, 0x0b, dec_bc);
+    SET(base, 0x0c, inc_C);
+    SET(base, 0x0d, dec_C);
+    SET(base, 0x0e, ld_C_n);
+    SET(base, 0x0f, rrca);
+
+    SET(base, 0x10, djnz);
+    SET(base, 0x11, ld_de_nn);
+    SET(base, 0x12, ld_DE_A);
+    SET(base, 0x13, inc_de);
+    SET(base, 0x14, inc_D);
+    SET(base, 0x15, dec_D);
+    SET(base, 0x16, ld_D_n);
+    SET(base, 0x17, rla);
+    SET(base, 0x18, jr);
+    SET(base, 0x19, add_hl_de);
+    SET(base, 0x1a, ld_A_DE);
+    SET(base, 0x1b, dec_de);
+    SET(base, 0x1c, inc_E);
+    SET(base, 0x1d, dec_E);
+    SET(base, 0x1e, ld_E_n);
+    SET(base, 0x1f, rra);
+
+    SET(base, 0x20, jr_NZ);
+    SET(base, 0x21, ld_hl_nn);
+    SET(base, 0x22, ld_nn_hl);
+    SET(base, 0x23, inc_hl);
+    SET(base, 0x24, inc_H);
+    SET(base, 0x25, dec_H);
+    SET(base, 0x26, ld_H_n);
+    SET(base, 0x27, daa);
+    SET(base, 0x28, jr_Z);
+    SET(base, 0x29, add_hl_hl);
+    SET(base, 0x2a, ld_hl_nni);
+    SET(base, 0x2b, dec_hl);
+    SET(base, 0x2c, inc_L);
+    SET(base, 0x2d, dec_L);
+    SET(base, 0x2e, ld_L_n);
+    SET(base, 0x2f, cpl);
+
+    SET(base, 0x30, jr_NC);
+    SET(base, 0x31, ld_sp_nn);
+    SET(base, 0x32, ld_nn_A);
+    SET(base, 0x33, inc_sp);
+    SET(base, 0x34, inc_HL);
+    SET(base, 0x35, dec_HL);
+    SET(base, 0x36, ld_HL_n);
+    SET(base, 0x37, scf);
+    SET(base, 0x38, jr_C);
+    SET(base, 0x39, add_hl_sp);
+    SET(base, 0x3a, ld_A_nni);
+    SET(base, 0x3b, dec_sp);
+    SET(base, 0x3c, inc_A);
+    SET(base, 0x3d, dec_A);
+    SET(base, 0x3e, ld_A_n);
+    SET(base, 0x3f, ccf);
+
+    SET_R8(base, 0x40, ld_B);
+    SET_R8(base, 0x48, ld_C);
+    SET_R8(base, 0x50, ld_D);
+    SET_R8(base, 0x58, ld_E);
+    SET_R8(base, 0x60, ld_H);
+    SET_R8(base, 0x68, ld_L);
+    SET(base, 0x70, ld_HL_B);
+    SET(base, 0x71, ld_HL_C);
+    SET(base, 0x72, ld_HL_D);
+    SET(base, 0x73, ld_HL_E);
+    SET(base, 0x74, ld_HL_H);
+    SET(base, 0x75, ld_HL_L);
+    SET(base, 0x76, halt);
+    SET(base, 0x77, ld_HL_A);
+    SET_R8(base, 0x78, ld_A);
+
+    SET_R8(base, 0x80, add);
+    SET_R8(base, 0x88, adc);
+    SET_R8(base, 0x90, sub);
+    SET_R8(base, 0x98, sbc);
+    SET_R8(base, 0xa0, and);
+    SET_R8(base, 0xa8, xor);
+    SET_R8(base, 0xb0, or);
+    SET_R8(base, 0xb8, cp);
+
+    SET(base, 0xc0, ret_NZ);
+    SET(base, 0xc1, pop_bc);
+    SET(base, 0xc2, jp_NZ);
+    SET(base, 0xc3, jp);
+    SET(base, 0xc4, call_NZ);
+    SET(base, 0xc5, push_bc);
+    SET(base, 0xc6, add_n);
+    SET(base, 0xc7, rst_00);
+    SET(base, 0xc8, ret_Z);
+    SET(base, 0xc9, ret);
+    SET(base, 0xca, jp_Z);
+    SET(base, 0xcb, prefix_cb);
+    SET(base, 0xcc, call_Z);
+    SET(base, 0xcd, call);
+    SET(base, 0xce, adc_n);
+    SET(base, 0xcf, rst_08);
+
+    SET(base, 0xd0, ret_NC);
+    SET(base, 0xd1, pop_de);
+    SET(base, 0xd2, jp_NC);
+    SET(base, 0xd3, out_n_A);
+    SET(base, 0xd4, call_NC);
+    SET(base, 0xd5, push_de);
+    SET(base, 0xd6, sub_n);
+    SET(base, 0xd7, rst_10);
+    SET(base, 0xd8, ret_C);
+    SET(base, 0xd9, exx);
+    SET(base, 0xda, jp_C);
+    SET(base, 0xdb, in_A_n);
+    SET(base, 0xdc, call_C);
+    SET(base, 0xdd, prefix_dd);
+    SET(base, 0xde, sbc_n);
+    SET(base, 0xdf, rst_18);
+
+    SET(base, 0xe0, ret_PO);
+    SET(base, 0xe1, pop_hl);
+    SET(base, 0xe2, jp_PO);
+    SET(base, 0xe3, ex_sp_hl);
+    SET(base, 0xe4, call_PO);
+    SET(base, 0xe5, push_hl);
+    SET(base, 0xe6, and_n);
+    SET(base, 0xe7, rst_20);
+    SET(base, 0xe8, ret_PE);
+    SET(base, 0xe9, jp_hl);
+    SET(base, 0xea, jp_PE);
+    SET(base, 0xeb, ex_de_hl);
+    SET(base, 0xec, call_PE);
+    SET(base, 0xed, prefix_ed);
+    SET(base, 0xee, xor_n);
+    SET(base, 0xef, rst_28);
+
+    SET(base, 0xf0, ret_P);
+    SET(base, 0xf1, pop_af);
+    SET(base, 0xf2, jp_P);
+    SET(base, 0xf3, di);
+    SET(base, 0xf4, call_P);
+    SET(base, 0xf5, push_af);
+    SET(base, 0xf6, or_n);
+    SET(base, 0xf7, rst_30);
+    SET(base, 0xf8, ret_M);
+    SET(base, 0xf9, ld_sp_hl);
+    SET(base, 0xfa, jp_M);
+    SET(base, 0xfb, ei);
+    SET(base, 0xfc, call_M);
+    SET(base, 0xfd, prefix_fd);
+    SET(base, 0xfe, cp_n);
+    SET(base, 0xff, rst_38);
+
+    //
+    // CB
+    //
+
+    SET_R8(cb, 0x00, rlc);
+    SET_R8(cb, 0x08, rrc);
+    SET_R8(cb, 0x10, rl);
+    SET_R8(cb, 0x18, rr);
+    SET_R8(cb, 0x20, sla);
+    SET_R8(cb, 0x28, sra);
+    SET_R8(cb, 0x30, sll);
+    SET_R8(cb, 0x38, srl);
+    SET_R8(cb, 0x40, bit_0);
+    SET_R8(cb, 0x48, bit_1);
+    SET_R8(cb, 0x50, bit_2);
+    SET_R8(cb, 0x58, bit_3);
+    SET_R8(cb, 0x60, bit_4);
+    SET_R8(cb, 0x68, bit_5);
+    SET_R8(cb, 0x70, bit_6);
+    SET_R8(cb, 0x78, bit_7);
+    SET_R8(cb, 0x80, res_0);
+    SET_R8(cb, 0x88, res_1);
+    SET_R8(cb, 0x90, res_2);
+    SET_R8(cb, 0x98, res_3);
+    SET_R8(cb, 0xa0, res_4);
+    SET_R8(cb, 0xa8, res_5);
+    SET_R8(cb, 0xb0, res_6);
+    SET_R8(cb, 0xb8, res_7);
+    SET_R8(cb, 0xc0, set_0);
+    SET_R8(cb, 0xc8, set_1);
+    SET_R8(cb, 0xd0, set_2);
+    SET_R8(cb, 0xd8, set_3);
+    SET_R8(cb, 0xe0, set_4);
+    SET_R8(cb, 0xe8, set_5);
+    SET_R8(cb, 0xf0, set_6);
+    SET_R8(cb, 0xf8, set_7);
+
+    //
+    // ED: undefined opcodes act as an 8T NOP
+    //
+
+    for (u32 i = 0; i < 256; ++i) {
+        SET(ed, i, nop);
+    }
+
+    SET(ed, 0x40, in_B_C);
+    SET(ed, 0x41, out_C_B);
+    SET(ed, 0x42, sbc_hl_bc);
+    SET(ed, 0x43, ld_nn_bc);
+    SET(ed, 0x47, ld_I_A);
+    SET(ed, 0x48, in_C_C);
+    SET(ed, 0x49, out_C_C);
+    SET(ed, 0x4a, adc_hl_bc);
+    SET(ed, 0x4b, ld_bc_nni);
+    SET(ed, 0x4f, ld_R_A);
+    SET(ed, 0x50, in_D_C);
+    SET(ed, 0x51, out_C_D);
+    SET(ed, 0x52, sbc_hl_de);
+    SET(ed, 0x53, ld_nn_de);
+    SET(ed, 0x57, ld_A_I);
+    SET(ed, 0x58, in_E_C);
+    SET(ed, 0x59, out_C_E);
+    SET(ed, 0x5a, adc_hl_de);
+    SET(ed, 0x5b, ld_de_nni);
+    SET(ed, 0x5f, ld_A_R);
+    SET(ed, 0x60, in_H_C);
+    SET(ed, 0x61, out_C_H);
+    SET(ed, 0x62, sbc_hl_hl);
+    SET(ed, 0x63, ld_nn_hl);
+    SET(ed, 0x67, rrd);
+    SET(ed, 0x68, in_L_C);
+    SET(ed, 0x69, out_C_L);
+    SET(ed, 0x6a, adc_hl_hl);
+    SET(ed, 0x6b, ld_hl_nni);
+    SET(ed, 0x6f, rld);
+    SET(ed, 0x70, in_F_C);
+    SET(ed, 0x71, out_C_0);
+    SET(ed, 0x72, sbc_hl_sp);
+    SET(ed, 0x73, ld_nn_sp);
+    SET(ed, 0x78, in_A_C);
+    SET(ed, 0x79, out_C_A);
+    SET(ed, 0x7a, adc_hl_sp);
+    SET(ed, 0x7b, ld_sp_nni);
+
+    for (u32 i = 0x44; i < 0x80; i += 8) {
+        SET(ed, i, neg);
+        SET(ed, i + 1, retn);
+    }
+    SET(ed, 0x46, im_0);
+    SET(ed, 0x4e, im_0);
+    SET(ed, 0x56, im_1);
+    SET(ed, 0x5e, im_2);
+    SET(ed, 0x66, im_0);
+    SET(ed, 0x6e, im_0);
+    SET(ed, 0x76, im_1);
+    SET(ed, 0x7e, im_2);
+
+    SET(ed, 0xa0, ldi);
+    SET(ed, 0xa1, cpi);
+    SET(ed, 0xa2, ini);
+    SET(ed, 0xa3, outi);
+    SET(ed, 0xa8, ldd);
+    SET(ed, 0xa9, cpd);
+    SET(ed, 0xaa, ind);
+    SET(ed, 0xab, outd);
+    SET(ed, 0xb0, ldir);
+    SET(ed, 0xb1, cpir);
+    SET(ed, 0xb2, inir);
+    SET(ed, 0xb3, otir);
+    SET(ed, 0xb8, lddr);
+    SET(ed, 0xb9, cpdr);
+    SET(ed, 0xba, indr);
+    SET(ed, 0xbb, otdr);
+
+    //
+    // DD/FD
+    //
+
+    for (u32 i = 0; i < 256; ++i) {
+        Z80_FN(ops_xy)[i] = Z80_FN(ops_base)[i];
+    }
+
+    SET(xy, 0x09, add_xy_bc);
+    SET(xy, 0x19, add_xy_de);
+    SET(xy, 0x21, ld_xy_nn);
+    SET(xy, 0x22, ld_nn_xy);
+    SET(xy, 0x23, inc_xy);
+    SET(xy, 0x24, inc_XYH);
+    SET(xy, 0x25, dec_XYH);
+    SET(xy, 0x26, ld_XYH_n);
+    SET(xy, 0x29, add_xy_xy);
+    SET(xy, 0x2a, ld_xy_nni);
+    SET(xy, 0x2b, dec_xy);
+    SET(xy, 0x2c, inc_XYL);
+    SET(xy, 0x2d, dec_XYL);
+    SET(xy, 0x2e, ld_XYL_n);
+    SET(xy, 0x34, inc_XYd);
+    SET(xy, 0x35, dec_XYd);
+    SET(xy, 0x36, ld_XYd_n);
+    SET(xy, 0x39, add_xy_sp);
+
+    SET(xy, 0x44, ld_B_XYH);
+    SET(xy, 0x45, ld_B_XYL);
+    SET(xy, 0x46, ld_B_XYd);
+    SET(xy, 0x4c, ld_C_XYH);
+    SET(xy, 0x4d, ld_C_XYL);
+    SET(xy, 0x4e, ld_C_XYd);
+    SET(xy, 0x54, ld_D_XYH);
+    SET(xy, 0x55, ld_D_XYL);
+    SET(xy, 0x56, ld_D_XYd);
+    SET(xy, 0x5c, ld_E_XYH);
+    SET(xy, 0x5d, ld_E_XYL);
+    SET(xy, 0x5e, ld_E_XYd);
+    SET(xy, 0x60, ld_XYH_B);
+    SET(xy, 0x61, ld_XYH_C);
+    SET(xy, 0x62, ld_XYH_D);
+    SET(xy, 0x63, ld_XYH_E);
+    SET(xy, 0x64, nop);
+    SET(xy, 0x65, ld_XYH_XYL);
+    SET(xy, 0x66, ld_H_XYd);
+    SET(xy, 0x67, ld_XYH_A);
+    SET(xy, 0x68, ld_XYL_B);
+    SET(xy, 0x69, ld_XYL_C);
+    SET(xy, 0x6a, ld_XYL_D);
+    SET(xy, 0x6b, ld_XYL_E);
+    SET(xy, 0x6c, ld_XYL_XYH);
+    SET(xy, 0x6d, nop);
+    SET(xy, 0x6e, ld_L_XYd);
+    SET(xy, 0x6f, ld_XYL_A);
+    SET(xy, 0x70, ld_XYd_B);
+    SET(xy, 0x71, ld_XYd_C);
+    SET(xy, 0x72, ld_XYd_D);
+    SET(xy, 0x73, ld_XYd_E);
+    SET(xy, 0x74, ld_XYd_H);
+    SET(xy, 0x75, ld_XYd_L);
+    SET(xy, 0x77, ld_XYd_A);
+    SET(xy, 0x7c, ld_A_XYH);
+    SET(xy, 0x7d, ld_A_XYL);
+    SET(xy, 0x7e, ld_A_XYd);
+
+    SET(xy, 0x84, add_XYH);
+    SET(xy, 0x85, add_XYL);
+    SET(xy, 0x86, add_XYd);
+    SET(xy, 0x8c, adc_XYH);
+    SET(xy, 0x8d, adc_XYL);
+    SET(xy, 0x8e, adc_XYd);
+    SET(xy, 0x94, sub_XYH);
+    SET(xy, 0x95, sub_XYL);
+    SET(xy, 0x96, sub_XYd);
+    SET(xy, 0x9c, sbc_XYH);
+    SET(xy, 0x9d, sbc_XYL);
+    SET(xy, 0x9e, sbc_XYd);
+    SET(xy, 0xa4, and_XYH);
+    SET(xy, 0xa5, and_XYL);
+    SET(xy, 0xa6, and_XYd);
+    SET(xy, 0xac, xor_XYH);
+    SET(xy, 0xad, xor_XYL);
+    SET(xy, 0xae, xor_XYd);
+    SET(xy, 0xb4, or_XYH);
+    SET(xy, 0xb5, or_XYL);
+    SET(xy, 0xb6, or_XYd);
+    SET(xy, 0xbc, cp_XYH);
+    SET(xy, 0xbd, cp_XYL);
+    SET(xy, 0xbe, cp_XYd);
+
+    SET(xy, 0xcb, prefix_xycb);
+    SET(xy, 0xe1, pop_xy);
+    SET(xy, 0xe3, ex_sp_xy);
+    SET(xy, 0xe5, push_xy);
+    SET(xy, 0xe9, jp_xy);
+    SET(xy, 0xf9, ld_sp_xy);
+
+    //
+    // DDCB/FDCB
+    //
+
+    SET_R8(xycb, 0x00, xyrlc);
+    SET_R8(xycb, 0x08, xyrrc);
+    SET_R8(xycb, 0x10, xyrl);
+    SET_R8(xycb, 0x18, xyrr);
+    SET_R8(xycb, 0x20, xysla);
+    SET_R8(xycb, 0x28, xysra);
+    SET_R8(xycb, 0x30, xysll);
+    SET_R8(xycb, 0x38, xysrl);
+
+    for (u32 i = 0; i < 8; ++i) {
+        SET(xycb, 0x40 + i, xybit_0);
+        SET(xycb, 0x48 + i, xybit_1);
+        SET(xycb, 0x50 + i, xybit_2);
+        SET(xycb, 0x58 + i, xybit_3);
+        SET(xycb, 0x60 + i, xybit_4);
+        SET(xycb, 0x68 + i, xybit_5);
+        SET(xycb, 0x70 + i, xybit_6);
+        SET(xycb, 0x78 + i, xybit_7);
+    }
+
+    SET_R8(xycb, 0x80, xyres_0);
+    SET_R8(xycb, 0x88, xyres_1);
+    SET_R8(xycb, 0x90, xyres_2);
+    SET_R8(xycb, 0x98, xyres_3);
+    SET_R8(xycb, 0xa0, xyres_4);
+    SET_R8(xycb, 0xa8, xyres_5);
+    SET_R8(xycb, 0xb0, xyres_6);
+    SET_R8(xycb, 0xb8, xyres_7);
+    SET_R8(xycb, 0xc0, xyset_0);
+    SET_R8(xycb, 0xc8, xyset_1);
+    SET_R8(xycb, 0xd0, xyset_2);
+    SET_R8(xycb, 0xd8, xyset_3);
+    SET_R8(xycb, 0xe0, xyset_4);
+    SET_R8(xycb, 0xe8, xyset_5);
+    SET_R8(xycb, 0xf0, xyset_6);
+    SET_R8(xycb, 0xf8, xyset_7);
+}
+
+//------------------------------------------------------------------------------
+// Interrupts and the run loop
+//------------------------------------------------------------------------------
+
+static void Z80_FN(interrupt)(Z80* z)
+{
+    if (z->halted) {
+        PC++;
+        z->halted = false;
+    }
+    z->iff1 = z->iff2 = 0;
+    z->r++;
+    z->t += 7;
+    Z80_FN(push)(z, PC);
+
+    if (z->im == 2) {
+        u16 vector = (u16)((z->i << 8) | 0xff);
+        u8  lo     = RD(vector);
+        u8  hi     = RD(vector + 1);
+        PC         = (u16)(lo | (hi << 8));
+    } else {
+        // IM 0 assumes RST 38h is floating on the bus
+        PC = 0x0038;
+    }
+    WZ = PC;
+}
+
+static void Z80_FN(run)(Z80* z, u32 t_end)
+{
+    z->t_end = t_end;
+#if Z80_BREAK
+    // Don't stop on the instruction we stopped on last time.  A run that only
+    // ran out of time stops on a breakpoint it starts at.
+    bool resume = z->stopped;
+#endif
+    z->stopped = false;
+    while (z->t < t_end) {
+        if (z->t < z->irq_end && z->iff1 && z->t != z->ei_t) {
+            Z80_FN(interrupt)(z);
+            continue;
+        }
+#if Z80_BREAK
+        if ((z->breakpoints[PC >> 3] & (1 << (PC & 7))) && !resume &&
+            !z->halted) {
+            z->stopped = true;
+            break;
+        }
+        resume = false;
+#endif
+        z->instructions++;
+        Z80_FN(ops_base)[FETCH()](z);
+    }
+}
+
+#undef OP
+#undef SET
+#undef SET_R8
+#undef FETCH
+#undef RD
+#undef WR
+#undef CONTEND
+#undef NOMREQ
+#undef IN
+#undef OUT
+#undef LD_R_R
+#undef LD_R_MEM
+#undef LD16
+#undef ADD16
+#undef ADC_SBC16
+#undef PUSH_POP
+#undef INC_DEC
+#undef ALU_ALL
+#undef EX_SP
+#undef COND_NZ
+#undef COND_Z
+#undef COND_NC
+#undef COND_C
+#undef COND_PO
+#undef COND_PE
+#undef COND_P
+#undef COND_M
+#undef JR_CC
+#undef JP_CC
+#undef CALL_CC
+#undef RET_CC
+#undef RST
+#undef CB_SHIFT
+#undef CB_BIT
+#undef IN_OUT_C
+#undef BLOCK
+#undef LD_XY_R
+#undef LD_XYD
+#undef XYCB_OP
+#undef XYCB_DEFINE
+#undef XYCB_BIT
+#undef Z80_CONTEND
+#undef Z80_TRACE
+#undef Z80_BREAK
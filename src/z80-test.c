@@ -0,0 +1,341 @@
+//------------------------------------------------------------------------------
+// Z80 core tests
+//------------------------------------------------------------------------------
+
+#include "z80-test.h"
+#include "z80.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+// Tokeniser
+//------------------------------------------------------------------------------
+
+typedef struct {
+    const char* cursor;
+    const char* end;
+} Tokens;
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Copies the next whitespace-separated token into out.  Returns false at the
+// end of the input.
+static bool token_next(Tokens* t, char* out, usize size)
+{
+    while (t->cursor < t->end && is_space(*t->cursor)) {
+        t->cursor++;
+    }
+    if (t->cursor >= t->end) {
+        return false;
+    }
+
+    usize len = 0;
+    while (t->cursor < t->end && !is_space(*t->cursor)) {
+        if (len + 1 < size) {
+            out[len++] = *t->cursor;
+        }
+        t->cursor++;
+    }
+    out[len] = '\0';
+    return true;
+}
+
+static u32 token_hex(Tokens* t)
+{
+    char buf[32];
+    return token_next(t, buf, sizeof(buf)) ? (u32)strtoul(buf, NULL, 16) : 0;
+}
+
+static u32 token_dec(Tokens* t)
+{
+    char buf[32];
+    return token_next(t, buf, sizeof(buf)) ? (u32)strtoul(buf, NULL, 10) : 0;
+}
+
+// Returns the next block of the expected output: everything up to the next
+// blank line.
+static Tokens block_next(Tokens* t)
+{
+    while (t->cursor < t->end && is_space(*t->cursor)) {
+        t->cursor++;
+    }
+
+    Tokens block = {.cursor = t->cursor, .end = t->cursor};
+    while (t->cursor < t->end) {
+        const char* eol = memchr(t->cursor, '\n', t->end - t->cursor);
+        eol             = eol ? eol + 1 : t->end;
+
+        bool blank      = true;
+        for (const char* p = t->cursor; p < eol; ++p) {
+            if (!is_space(*p)) {
+                blank = false;
+                break;
+            }
+        }
+
+        t->cursor = eol;
+        if (blank) {
+            break;
+        }
+        block.end = eol;
+    }
+    return block;
+}
+
+//------------------------------------------------------------------------------
+// Test output
+//------------------------------------------------------------------------------
+
+#define OUTPUT_SIZE (256 * 1024)
+
+typedef struct {
+    char* buffer;
+    usize length;
+} Output;
+
+static void output_printf(Output* out, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    usize space = OUTPUT_SIZE - out->length;
+    i32   n     = vsnprintf(out->buffer + out->length, space, format, args);
+    va_end(args);
+    if (n > 0) {
+        out->length += (usize)n < space ? (usize)n : space - 1;
+    }
+}
+
+static void test_trace(void* user, Z80Event event, u32 t, u16 addr, u8 data)
+{
+    static const char* names[] = {"MC", "MR", "MW", "PC", "PR", "PW"};
+
+    Output* out                = (Output*)user;
+    if (event == Z80Event_MemoryContend || event == Z80Event_PortContend) {
+        output_printf(out, "%5u %s %04x\n", t, names[event], addr);
+    } else {
+        output_printf(out, "%5u %s %04x %02x\n", t, names[event], addr, data);
+    }
+}
+
+// The test machine returns the high byte of the port address for every read
+static u8 test_port_in(void* user, u16 port)
+{
+    (void)user;
+    return (u8)(port >> 8);
+}
+
+static void test_port_out(void* user, u16 port, u8 value)
+{
+    (void)user;
+    (void)port;
+    (void)value;
+}
+
+//------------------------------------------------------------------------------
+// Test runner
+//------------------------------------------------------------------------------
+
+// Runs one test from the input.  Returns false if there are no more tests.
+static bool test_one(Tokens* in, Memory* memory, Output* out, char* name)
+{
+    if (!token_next(in, name, 64)) {
+        return false;
+    }
+
+    // Fill memory with the same pattern the FUSE test harness uses
+    for (u32 i = 0; i < 65536; i += 4) {
+        mem_poke(memory, (u16)(i + 0), 0xde);
+        mem_poke(memory, (u16)(i + 1), 0xad);
+        mem_poke(memory, (u16)(i + 2), 0xbe);
+        mem_poke(memory, (u16)(i + 3), 0xef);
+    }
+
+    Z80 z;
+    z80_init(&z, memory);
+    z.port_in  = test_port_in;
+    z.port_out = test_port_out;
+    z.trace    = test_trace;
+    z.user     = out;
+
+    z.af.w     = (u16)token_hex(in);
+    z.bc.w     = (u16)token_hex(in);
+    z.de.w     = (u16)token_hex(in);
+    z.hl.w     = (u16)token_hex(in);
+    z.af_.w    = (u16)token_hex(in);
+    z.bc_.w    = (u16)token_hex(in);
+    z.de_.w    = (u16)token_hex(in);
+    z.hl_.w    = (u16)token_hex(in);
+    z.ix.w     = (u16)token_hex(in);
+    z.iy.w     = (u16)token_hex(in);
+    z.sp.w     = (u16)token_hex(in);
+    z.pc.w     = (u16)token_hex(in);
+    z.i        = (u8)token_hex(in);
+    z80_set_r(&z, (u8)token_hex(in));
+    z.iff1     = (u8)token_dec(in);
+    z.iff2     = (u8)token_dec(in);
+    z.im       = (u8)token_dec(in);
+    z.halted   = token_dec(in) != 0;
+    u32 t_end  = token_dec(in);
+
+    // Memory blocks: <address> <bytes...> -1, terminated by a lone -1
+    char tok[64];
+    while (token_next(in, tok, sizeof(tok)) && strcmp(tok, "-1") != 0) {
+        u16 addr = (u16)strtoul(tok, NULL, 16);
+        while (token_next(in, tok, sizeof(tok)) && strcmp(tok, "-1") != 0) {
+            mem_poke(memory, addr++, (u8)strtoul(tok, NULL, 16));
+        }
+    }
+
+    static u8 initial[65536];
+    for (u32 i = 0; i < 65536; ++i) {
+        initial[i] = mem_peek(memory, (u16)i);
+    }
+
+    out->length = 0;
+    output_printf(out, "%s\n", name);
+    z80_run(&z, t_end);
+
+    output_printf(out,
+                  "%04x %04x %04x %04x %04x %04x %04x %04x %04x %04x %04x "
+                  "%04x\n",
+                  z.af.w,
+                  z.bc.w,
+                  z.de.w,
+                  z.hl.w,
+                  z.af_.w,
+                  z.bc_.w,
+                  z.de_.w,
+                  z.hl_.w,
+                  z.ix.w,
+                  z.iy.w,
+                  z.sp.w,
+                  z.pc.w);
+    output_printf(out,
+                  "%02x %02x %d %d %d %d %d\n",
+                  z.i,
+                  z80_get_r(&z),
+                  z.iff1,
+                  z.iff2,
+                  z.im,
+                  z.halted ? 1 : 0,
+                  z.t);
+
+    for (u32 i = 0; i < 65536; ++i) {
+        if (mem_peek(memory, (u16)i) == initial[i]) {
+            continue;
+        }
+        output_printf(out, "%04x ", i);
+        while (i < 65536 && mem_peek(memory, (u16)i) != initial[i]) {
+            output_printf(out, "%02x ", mem_peek(memory, (u16)i++));
+        }
+        output_printf(out, "-1\n");
+    }
+
+    return true;
+}
+
+// A breakpoint at the address a run starts from stops it before the
+// instruction, unless the run before stopped there.  A CALL that ends exactly
+// at one run's end time puts the next run on the breakpoint.
+static bool test_breakpoint_resume(Memory* memory)
+{
+    static u8 breakpoints[8192];
+    memset(breakpoints, 0, sizeof(breakpoints));
+    breakpoints[0x1000 >> 3] |= 1 << (0x1000 & 7);
+
+    for (u32 i = 0; i < 65536; ++i) {
+        mem_poke(memory, (u16)i, 0x00); // NOP
+    }
+    mem_poke(memory, 0x0000, 0xcd); // CALL 0x1000
+    mem_poke16(memory, 0x0001, 0x1000);
+
+    Z80 z;
+    z80_init(&z, memory);
+    z.port_in     = test_port_in;
+    z.port_out    = test_port_out;
+    z.breakpoints = breakpoints;
+    z.sp.w        = 0x8000;
+
+    z80_run(&z, 17);
+    bool ok = !z.stopped && z.pc.w == 0x1000 && z.t == 17;
+
+    z80_run(&z, 100);
+    ok = ok && z.stopped && z.pc.w == 0x1000 && z.t == 17;
+
+    z80_run(&z, 100);
+    ok = ok && !z.stopped && z.pc.w > 0x1000;
+    return ok;
+}
+
+static bool test_compare(Tokens actual, Tokens expected)
+{
+    char a[64];
+    char e[64];
+    for (;;) {
+        bool has_a = token_next(&actual, a, sizeof(a));
+        bool has_e = token_next(&expected, e, sizeof(e));
+        if (!has_a || !has_e) {
+            return has_a == has_e;
+        }
+        if (strcmp(a, e) != 0) {
+            return false;
+        }
+    }
+}
+
+i32 z80_test_run(const char* in_file, const char* expected_file)
+{
+    KData in_data       = $.data_load(in_file);
+    KData expected_data = $.data_load(expected_file);
+    if (!$.is_data_loaded(&in_data) || !$.is_data_loaded(&expected_data)) {
+        $.eprn("Failed to load Z80 tests: %s, %s", in_file, expected_file);
+        $.data_unload(&in_data);
+        $.data_unload(&expected_data);
+        return -1;
+    }
+
+    Tokens in       = {.cursor = (const char*)in_data.data,
+                       .end    = (const char*)in_data.data + in_data.size};
+    Tokens expected = {.cursor = (const char*)expected_data.data,
+                       .end = (const char*)expected_data.data +
+                              expected_data.size};
+
+    Memory memory   = {0};
+    mem_init(&memory, MemoryModel_Ram64);
+
+    Output out      = {.buffer = KORE_ARRAY_ALLOC(char, OUTPUT_SIZE)};
+    char   name[64];
+    i32    passed   = 0;
+    i32    failed   = 0;
+
+    while (test_one(&in, &memory, &out, name)) {
+        Tokens actual = {.cursor = out.buffer, .end = out.buffer + out.length};
+        if (test_compare(actual, block_next(&expected))) {
+            passed++;
+        } else {
+            failed++;
+            $.eprn("Z80 test failed: %s", name);
+        }
+    }
+
+    if (test_breakpoint_resume(&memory)) {
+        passed++;
+    } else {
+        failed++;
+        $.eprn("Z80 test failed: breakpoint resume");
+    }
+
+    $.prn("Z80 tests: %d passed, %d failed", passed, failed);
+
+    KORE_ARRAY_FREE(out.buffer);
+    mem_done(&memory);
+    $.data_unload(&in_data);
+    $.data_unload(&expected_data);
+    return failed;
+}
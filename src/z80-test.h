@@ -0,0 +1,13 @@
+//------------------------------------------------------------------------------
+// Z80 core tests
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "kore.h"
+
+// Run every test in in_file through the traced core and compare the bus events
+// and final machine state with expected_file.  Both files use the FUSE test
+// formats described in etc/tests/tests.readme.md.  Returns the number of
+// failing tests, or -1 if the files could not be read.
+i32 z80_test_run(const char* in_file, const char* expected_file);
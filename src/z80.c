@@ -0,0 +1,494 @@
+//------------------------------------------------------------------------------
+// Z80 CPU emulation
+//
+// The instruction handlers live in z80-ops.h, which is included once for each
+// variant of the core so that features such as bus tracing are resolved at
+// compile time instead of being tested on every memory access.  Everything in
+// this file is shared between the variants.
+//------------------------------------------------------------------------------
+
+#include "z80.h"
+
+// The bus cycles are used by every instruction and must be inlined into each
+// one, or the contended core pays a call on every memory access
+#if defined(_MSC_VER)
+#    define Z80_BUS static __forceinline
+#else
+#    define Z80_BUS static inline __attribute__((always_inline))
+#endif
+
+//------------------------------------------------------------------------------
+// Register access
+//------------------------------------------------------------------------------
+
+#define A z->af.h
+#define F z->af.l
+#define B z->bc.h
+#define C z->bc.l
+#define D z->de.h
+#define E z->de.l
+#define H z->hl.h
+#define L z->hl.l
+
+#define AF z->af.w
+#define BC z->bc.w
+#define DE z->de.w
+#define HL z->hl.w
+#define SP z->sp.w
+#define PC z->pc.w
+#define WZ z->wz.w
+
+// The index register selected by the DD or FD prefix
+#define XY z->xy->w
+#define XYH z->xy->h
+#define XYL z->xy->l
+
+// Address used for contention during internal cycles that put IR on the bus
+#define IR ((u16)((z->i << 8) | (z->r7 & 0x80) | (z->r & 0x7f)))
+
+//------------------------------------------------------------------------------
+// Flag tables
+//------------------------------------------------------------------------------
+
+#define FLAG_C 0x01
+#define FLAG_N 0x02
+#define FLAG_P 0x04
+#define FLAG_V FLAG_P
+#define FLAG_3 0x08
+#define FLAG_H 0x10
+#define FLAG_5 0x20
+#define FLAG_Z 0x40
+#define FLAG_S 0x80
+
+// S, Z, 5 and 3 flags for a result, with and without the parity flag
+static u8 g_sz53[256];
+static u8 g_sz53p[256];
+static u8 g_parity[256];
+
+// Indexed by bit 3 (or 11) of the two operands and the result
+static const u8 g_halfcarry_add[8] = {0, FLAG_H, FLAG_H, FLAG_H, 0, 0, 0, FLAG_H};
+static const u8 g_halfcarry_sub[8] = {0, 0, FLAG_H, 0, FLAG_H, 0, FLAG_H, FLAG_H};
+
+// Indexed by bit 7 (or 15) of the two operands and the result
+static const u8 g_overflow_add[8] = {0, 0, 0, FLAG_V, FLAG_V, 0, 0, 0};
+static const u8 g_overflow_sub[8] = {0, FLAG_V, 0, 0, 0, 0, FLAG_V, 0};
+
+static void z80_flags_init(void)
+{
+    for (u32 i = 0; i < 256; ++i) {
+        u8 p = 1;
+        for (u32 b = 0; b < 8; ++b) {
+            p ^= (i >> b) & 1;
+        }
+
+        g_parity[i] = p ? FLAG_P : 0;
+        g_sz53[i]   = (u8)(i & (FLAG_S | FLAG_5 | FLAG_3));
+        if (i == 0) {
+            g_sz53[i] |= FLAG_Z;
+        }
+        g_sz53p[i] = g_sz53[i] | g_parity[i];
+    }
+}
+
+//------------------------------------------------------------------------------
+// ALU operations
+//
+// None of these touch the bus, so they are shared by every core variant.
+//------------------------------------------------------------------------------
+
+static inline u8 alu_lookup(u8 a, u8 b, u8 r)
+{
+    return (u8)(((a & 0x88) >> 3) | ((b & 0x88) >> 2) | ((r & 0x88) >> 1));
+}
+
+static inline void alu_add(Z80* z, u8 v)
+{
+    u16 r  = A + v;
+    u8  lu = alu_lookup(A, v, (u8)r);
+    A      = (u8)r;
+    F      = ((r & 0x100) ? FLAG_C : 0) | g_halfcarry_add[lu & 7] |
+        g_overflow_add[lu >> 4] | g_sz53[A];
+}
+
+static inline void alu_adc(Z80* z, u8 v)
+{
+    u16 r  = A + v + (F & FLAG_C);
+    u8  lu = alu_lookup(A, v, (u8)r);
+    A      = (u8)r;
+    F      = ((r & 0x100) ? FLAG_C : 0) | g_halfcarry_add[lu & 7] |
+        g_overflow_add[lu >> 4] | g_sz53[A];
+}
+
+static inline void alu_sub(Z80* z, u8 v)
+{
+    u16 r  = A - v;
+    u8  lu = alu_lookup(A, v, (u8)r);
+    A      = (u8)r;
+    F      = ((r & 0x100) ? FLAG_C : 0) | FLAG_N | g_halfcarry_sub[lu & 7] |
+        g_overflow_sub[lu >> 4] | g_sz53[A];
+}
+
+static inline void alu_sbc(Z80* z, u8 v)
+{
+    u16 r  = A - v - (F & FLAG_C);
+    u8  lu = alu_lookup(A, v, (u8)r);
+    A      = (u8)r;
+    F      = ((r & 0x100) ? FLAG_C : 0) | FLAG_N | g_halfcarry_sub[lu & 7] |
+        g_overflow_sub[lu >> 4] | g_sz53[A];
+}
+
+static inline void alu_and(Z80* z, u8 v)
+{
+    A &= v;
+    F = FLAG_H | g_sz53p[A];
+}
+
+static inline void alu_xor(Z80* z, u8 v)
+{
+    A ^= v;
+    F = g_sz53p[A];
+}
+
+static inline void alu_or(Z80* z, u8 v)
+{
+    A |= v;
+    F = g_sz53p[A];
+}
+
+static inline void alu_cp(Z80* z, u8 v)
+{
+    u16 r  = A - v;
+    u8  lu = alu_lookup(A, v, (u8)r);
+    F      = ((r & 0x100) ? FLAG_C : (r ? 0 : FLAG_Z)) | FLAG_N |
+        g_halfcarry_sub[lu & 7] | g_overflow_sub[lu >> 4] |
+        (v & (FLAG_3 | FLAG_5)) | (r & FLAG_S);
+}
+
+static inline u8 alu_inc(Z80* z, u8 v)
+{
+    v++;
+    F = (F & FLAG_C) | (v == 0x80 ? FLAG_V : 0) | ((v & 0x0f) ? 0 : FLAG_H) |
+        g_sz53[v];
+    return v;
+}
+
+static inline u8 alu_dec(Z80* z, u8 v)
+{
+    F = (F & FLAG_C) | ((v & 0x0f) ? 0 : FLAG_H) | FLAG_N;
+    v--;
+    F |= (v == 0x7f ? FLAG_V : 0) | g_sz53[v];
+    return v;
+}
+
+static inline u16 alu_add16(Z80* z, u16 a, u16 b)
+{
+    u32 r  = a + b;
+    u8  lu = (u8)(((a & 0x0800) >> 11) | ((b & 0x0800) >> 10) |
+                 ((r & 0x0800) >> 9));
+    WZ     = a + 1;
+    F      = (F & (FLAG_V | FLAG_Z | FLAG_S)) | ((r & 0x10000) ? FLAG_C : 0) |
+        ((r >> 8) & (FLAG_3 | FLAG_5)) | g_halfcarry_add[lu];
+    return (u16)r;
+}
+
+static inline void alu_adc16(Z80* z, u16 v)
+{
+    u32 r  = HL + v + (F & FLAG_C);
+    u8  lu = (u8)(((HL & 0x8800) >> 11) | ((v & 0x8800) >> 10) |
+                 ((r & 0x8800) >> 9));
+    WZ     = HL + 1;
+    HL     = (u16)r;
+    F      = ((r & 0x10000) ? FLAG_C : 0) | g_overflow_add[lu >> 4] |
+        (H & (FLAG_3 | FLAG_5 | FLAG_S)) | g_halfcarry_add[lu & 7] |
+        (HL ? 0 : FLAG_Z);
+}
+
+static inline void alu_sbc16(Z80* z, u16 v)
+{
+    u32 r  = HL - v - (F & FLAG_C);
+    u8  lu = (u8)(((HL & 0x8800) >> 11) | ((v & 0x8800) >> 10) |
+                 ((r & 0x8800) >> 9));
+    WZ     = HL + 1;
+    HL     = (u16)r;
+    F      = ((r & 0x10000) ? FLAG_C : 0) | FLAG_N | g_overflow_sub[lu >> 4] |
+        (H & (FLAG_3 | FLAG_5 | FLAG_S)) | g_halfcarry_sub[lu & 7] |
+        (HL ? 0 : FLAG_Z);
+}
+
+static inline u8 alu_rlc(Z80* z, u8 v)
+{
+    v = (u8)((v << 1) | (v >> 7));
+    F = (v & FLAG_C) | g_sz53p[v];
+    return v;
+}
+
+static inline u8 alu_rrc(Z80* z, u8 v)
+{
+    F = v & FLAG_C;
+    v = (u8)((v >> 1) | (v << 7));
+    F |= g_sz53p[v];
+    return v;
+}
+
+static inline u8 alu_rl(Z80* z, u8 v)
+{
+    u8 old = v;
+    v      = (u8)((v << 1) | (F & FLAG_C));
+    F      = (old >> 7) | g_sz53p[v];
+    return v;
+}
+
+static inline u8 alu_rr(Z80* z, u8 v)
+{
+    u8 old = v;
+    v      = (u8)((v >> 1) | (F << 7));
+    F      = (old & FLAG_C) | g_sz53p[v];
+    return v;
+}
+
+static inline u8 alu_sla(Z80* z, u8 v)
+{
+    F = v >> 7;
+    v = (u8)(v << 1);
+    F |= g_sz53p[v];
+    return v;
+}
+
+static inline u8 alu_sra(Z80* z, u8 v)
+{
+    F = v & FLAG_C;
+    v = (v & 0x80) | (v >> 1);
+    F |= g_sz53p[v];
+    return v;
+}
+
+static inline u8 alu_sll(Z80* z, u8 v)
+{
+    F = v >> 7;
+    v = (u8)((v << 1) | 0x01);
+    F |= g_sz53p[v];
+    return v;
+}
+
+static inline u8 alu_srl(Z80* z, u8 v)
+{
+    F = v & FLAG_C;
+    v >>= 1;
+    F |= g_sz53p[v];
+    return v;
+}
+
+// Flags 3 and 5 come from the operand for BIT n,r but from the high byte of
+// MEMPTR for BIT n,(HL) and BIT n,(XY+d), so the caller supplies them.
+static inline void alu_bit(Z80* z, u8 bit, u8 v, u8 xy)
+{
+    F = (F & FLAG_C) | FLAG_H | (xy & (FLAG_3 | FLAG_5));
+    if (!(v & (1 << bit))) {
+        F |= FLAG_P | FLAG_Z;
+    }
+    if (bit == 7 && (v & 0x80)) {
+        F |= FLAG_S;
+    }
+}
+
+static inline void alu_rlca(Z80* z)
+{
+    A = (u8)((A << 1) | (A >> 7));
+    F = (F & (FLAG_P | FLAG_Z | FLAG_S)) | (A & (FLAG_C | FLAG_3 | FLAG_5));
+}
+
+static inline void alu_rrca(Z80* z)
+{
+    F = (F & (FLAG_P | FLAG_Z | FLAG_S)) | (A & FLAG_C);
+    A = (u8)((A >> 1) | (A << 7));
+    F |= A & (FLAG_3 | FLAG_5);
+}
+
+static inline void alu_rla(Z80* z)
+{
+    u8 old = A;
+    A      = (u8)((A << 1) | (F & FLAG_C));
+    F = (F & (FLAG_P | FLAG_Z | FLAG_S)) | (A & (FLAG_3 | FLAG_5)) | (old >> 7);
+}
+
+static inline void alu_rra(Z80* z)
+{
+    u8 old = A;
+    A      = (u8)((A >> 1) | (F << 7));
+    F = (F & (FLAG_P | FLAG_Z | FLAG_S)) | (A & (FLAG_3 | FLAG_5)) |
+        (old & FLAG_C);
+}
+
+static inline void alu_daa(Z80* z)
+{
+    u8 add   = 0;
+    u8 carry = F & FLAG_C;
+
+    if ((F & FLAG_H) || (A & 0x0f) > 9) {
+        add = 6;
+    }
+    if (carry || A > 0x99) {
+        add |= 0x60;
+    }
+    if (A > 0x99) {
+        carry = FLAG_C;
+    }
+
+    if (F & FLAG_N) {
+        alu_sub(z, add);
+    } else {
+        alu_add(z, add);
+    }
+    F = (F & ~(FLAG_C | FLAG_P)) | carry | g_parity[A];
+}
+
+static inline void alu_cpl(Z80* z)
+{
+    A ^= 0xff;
+    F = (F & (FLAG_C | FLAG_P | FLAG_Z | FLAG_S)) | (A & (FLAG_3 | FLAG_5)) |
+        FLAG_N | FLAG_H;
+}
+
+static inline void alu_scf(Z80* z)
+{
+    F = (F & (FLAG_P | FLAG_Z | FLAG_S)) | (A & (FLAG_3 | FLAG_5)) | FLAG_C;
+}
+
+static inline void alu_ccf(Z80* z)
+{
+    F = (F & (FLAG_P | FLAG_Z | FLAG_S)) | ((F & FLAG_C) ? FLAG_H : FLAG_C) |
+        (A & (FLAG_3 | FLAG_5));
+}
+
+static inline void alu_neg(Z80* z)
+{
+    u8 v = A;
+    A    = 0;
+    alu_sub(z, v);
+}
+
+//------------------------------------------------------------------------------
+// Core variants
+//------------------------------------------------------------------------------
+
+typedef void (*Z80Op)(Z80* z);
+
+#define Z80_CAT_(a, b) a##_##b
+#define Z80_CAT(a, b) Z80_CAT_(a, b)
+#define Z80_VARIANT_(c, t, b) v##c##t##b
+#define Z80_VARIANT(c, t, b) Z80_VARIANT_(c, t, b)
+#define Z80_FN(name)                                                           \
+    Z80_CAT(name, Z80_VARIANT(Z80_CONTEND, Z80_TRACE, Z80_BREAK))
+
+#define Z80_CONTEND 0
+#define Z80_TRACE 0
+#define Z80_BREAK 0
+#include "z80-ops.h"
+
+#define Z80_CONTEND 1
+#define Z80_TRACE 0
+#define Z80_BREAK 0
+#include "z80-ops.h"
+
+#define Z80_CONTEND 0
+#define Z80_TRACE 1
+#define Z80_BREAK 0
+#include "z80-ops.h"
+
+#define Z80_CONTEND 1
+#define Z80_TRACE 1
+#define Z80_BREAK 0
+#include "z80-ops.h"
+
+#define Z80_CONTEND 0
+#define Z80_TRACE 0
+#define Z80_BREAK 1
+#include "z80-ops.h"
+
+#define Z80_CONTEND 1
+#define Z80_TRACE 0
+#define Z80_BREAK 1
+#include "z80-ops.h"
+
+#define Z80_CONTEND 0
+#define Z80_TRACE 1
+#define Z80_BREAK 1
+#include "z80-ops.h"
+
+#define Z80_CONTEND 1
+#define Z80_TRACE 1
+#define Z80_BREAK 1
+#include "z80-ops.h"
+
+// Every variant, indexed by contention (bit 0), tracing (bit 1) and breakpoints
+// (bit 2)
+#define Z80_VARIANTS(X)                                                        \
+    X(v000) X(v100) X(v010) X(v110) X(v001) X(v101) X(v011) X(v111)
+
+typedef void (*Z80Run)(Z80* z, u32 t_end);
+
+#define Z80_RUN_ENTRY(v) run_##v,
+#define Z80_TABLES_INIT(v) tables_init_##v();
+
+static const Z80Run g_run[8] = {Z80_VARIANTS(Z80_RUN_ENTRY)};
+
+//------------------------------------------------------------------------------
+// Z80 API
+//------------------------------------------------------------------------------
+
+void z80_init(Z80* z, Memory* memory)
+{
+    static bool tables_ready = false;
+    if (!tables_ready) {
+        z80_flags_init();
+        Z80_VARIANTS(Z80_TABLES_INIT)
+        tables_ready = true;
+    }
+
+    *z        = (Z80){0};
+    z->memory = memory;
+    z80_reset(z);
+}
+
+void z80_reset(Z80* z)
+{
+    AF        = 0xffff;
+    SP        = 0xffff;
+    PC        = 0x0000;
+    WZ        = 0x0000;
+    z->xy     = &z->ix;
+    z->i      = 0;
+    z->r      = 0;
+    z->r7     = 0;
+    z->iff1   = 0;
+    z->iff2   = 0;
+    z->im     = 0;
+    z->halted = false;
+    z->ei_t   = ~0u;
+}
+
+u8 z80_get_r(const Z80* z) { return (z->r7 & 0x80) | (z->r & 0x7f); }
+
+void z80_set_r(Z80* z, u8 r)
+{
+    z->r  = r;
+    z->r7 = r;
+}
+
+void z80_start_frame(Z80* z, u32 frame_length, u32 int_length)
+{
+    z->t       = z->t >= frame_length ? z->t - frame_length : 0;
+    z->irq_end = int_length;
+
+    // An EI at the very end of the last frame still blocks the next interrupt
+    z->ei_t    = (z->ei_t != ~0u && z->ei_t >= frame_length)
+                     ? z->ei_t - frame_length
+                     : ~0u;
+}
+
+void z80_run(Z80* z, u32 t_end)
+{
+    u32 variant = (z->contention ? 1 : 0) | (z->trace ? 2 : 0) |
+                  (z->breakpoints ? 4 : 0);
+    g_run[variant](z, t_end);
+}
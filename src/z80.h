@@ -0,0 +1,94 @@
+//------------------------------------------------------------------------------
+// Z80 CPU emulation
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "memory.h"
+
+// A 16-bit register pair with access to its high and low halves.  This assumes
+// a little-endian host.
+typedef union {
+    u16 w;
+    struct {
+        u8 l;
+        u8 h;
+    };
+} Z80Pair;
+
+// Bus events reported by the traced core.  These match the event types used by
+// the FUSE test suite in etc/tests/tests.expected.
+typedef enum {
+    Z80Event_MemoryContend, // MC
+    Z80Event_MemoryRead,    // MR
+    Z80Event_MemoryWrite,   // MW
+    Z80Event_PortContend,   // PC
+    Z80Event_PortRead,      // PR
+    Z80Event_PortWrite,     // PW
+} Z80Event;
+
+typedef u8 (*Z80PortIn)(void* user, u16 port);
+typedef void (*Z80PortOut)(void* user, u16 port, u8 value);
+typedef void (*Z80Trace)(void* user, Z80Event event, u32 t, u16 addr, u8 data);
+
+typedef struct Z80 {
+    Z80Pair af, bc, de, hl;
+    Z80Pair af_, bc_, de_, hl_;
+    Z80Pair ix, iy, sp, pc;
+    Z80Pair wz; // Internal MEMPTR register
+
+    // Index register used by the current DD/FD prefixed instruction
+    Z80Pair* xy;
+
+    u8   i;
+    u8   r;  // Bits 0-6 count M1 cycles, bit 7 is ignored
+    u8   r7; // Bit 7 of R as last set by LD R,A
+    u8   iff1;
+    u8   iff2;
+    u8   im;
+    bool halted;
+
+    // Timing, in T-states since the start of the current frame
+    u32 t;
+    u32 t_end;   // End of the current z80_run call
+    u32 irq_end; // The INT line is held active while t < irq_end
+    u32 ei_t;    // Time EI last completed; no interrupt is accepted until later
+
+    u64 instructions; // Instructions dispatched since z80_init, for profiling
+
+    Memory*    memory;
+    Z80PortIn  port_in;
+    Z80PortOut port_out;
+    void*      user;
+
+    // Optional features.  z80_run picks a core compiled with exactly the
+    // features that are set here, so unused ones cost nothing.
+    Z80Trace  trace;         // Called for every bus cycle
+    const u8* contention;    // Extra T-states for each T-state of a frame
+    const u8* io_contention; // The same for I/O, set with contention
+    const u8* breakpoints;   // One bit per address (8K), bit n = addr & 7
+    bool      stopped;       // The last z80_run stopped at a breakpoint
+} Z80;
+
+//------------------------------------------------------------------------------
+// Z80 API
+//------------------------------------------------------------------------------
+
+void z80_init(Z80* z, Memory* memory);
+void z80_reset(Z80* z);
+
+// The value of the R register as software sees it.
+u8 z80_get_r(const Z80* z);
+void z80_set_r(Z80* z, u8 r);
+
+// Start a new frame: rewind the T-state counter by the previous frame's length
+// and raise the INT line for int_length T-states.
+void z80_start_frame(Z80* z, u32 frame_length, u32 int_length);
+
+// Execute instructions until t reaches t_end.  The last instruction is allowed
+// to complete, so t may end up slightly past t_end.  If breakpoints are set the
+// run may stop early with z->stopped set; the next call resumes from there.
+//
+// The core variant is chosen from the trace, contention and breakpoints fields
+// once per call, so it is best called once per frame.
+void z80_run(Z80* z, u32 t_end);